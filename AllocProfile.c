@@ -0,0 +1,210 @@
+#include "./AllocProfile.h"
+
+#ifdef ALLOC_PROFILE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// glibc's own allocator, under the names it exports for interposers.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void __libc_free(void* p);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static const char* other_names[NUM_ALLOC_SITES - NUM_PHASES] = {
+  "update_other",
+  "render",
+  "outside"
+};
+
+typedef struct {
+  unsigned long allocs;  // malloc, calloc, realloc and the aligned ones
+  unsigned long frees;
+  unsigned long bytes;   // requested by the allocations
+  unsigned long growth;  // calls of either kind made under ALLOC_GROWTH
+} AllocCounts;
+
+static AllocCounts totals[NUM_ALLOC_SITES];
+static AllocCounts* frame_counts = NULL;  // max_frames x NUM_ALLOC_SITES
+static unsigned int max_frames = 0;
+static unsigned int frame = 0;
+
+// Where the calls of the simulation and its Cilk workers go: the open
+// phase, or else the rest of CollisionWorld_updateLines while it runs.
+static volatile int open_site = ALLOC_OUTSIDE;
+static bool in_update = false;
+static AllocCounts update_counts[NUM_ALLOC_SITES];  // this update only
+static unsigned long update_calls = 0;  // of which not growth
+static bool checking = false;
+
+static __thread bool render_thread = false;
+static __thread int growth_depth = 0;
+
+static inline void add(unsigned long* counter, unsigned long n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static void record(bool isFree, size_t bytes) {
+  int site = render_thread ? ALLOC_RENDER : open_site;
+  bool growth = growth_depth > 0;
+  AllocCounts* counts[3] = {&totals[site], NULL, NULL};
+  if (frame_counts && frame < max_frames) {
+    counts[1] = &frame_counts[frame * NUM_ALLOC_SITES + site];
+  }
+  if (in_update && site != ALLOC_RENDER) {
+    counts[2] = &update_counts[site];
+    if (!growth) {
+      add(&update_calls, 1);
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    if (counts[k] == NULL) {
+      continue;
+    }
+    add(isFree ? &counts[k]->frees : &counts[k]->allocs, 1);
+    add(&counts[k]->bytes, bytes);
+    if (growth) {
+      add(&counts[k]->growth, 1);
+    }
+  }
+}
+
+void* malloc(size_t size) {
+  void* p = __libc_malloc(size);
+  record(false, size);
+  return p;
+}
+
+void* calloc(size_t n, size_t size) {
+  void* p = __libc_calloc(n, size);
+  record(false, n * size);
+  return p;
+}
+
+void* realloc(void* p, size_t size) {
+  void* q = __libc_realloc(p, size);
+  record(p != NULL && size == 0, size);
+  return q;
+}
+
+void free(void* p) {
+  if (p != NULL) {
+    record(true, 0);
+  }
+  __libc_free(p);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  void* p = __libc_memalign(alignment, size);
+  record(false, size);
+  return p;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+  void* p = memalign(alignment, size);
+  if (p == NULL) {
+    return ENOMEM;
+  }
+  *out = p;
+  return 0;
+}
+
+void AllocProfile_init(unsigned int maxFrames) {
+  // Not through calloc, so the profiler's own storage is not counted.
+  frame_counts = __libc_calloc((size_t) maxFrames * NUM_ALLOC_SITES,
+                               sizeof(AllocCounts));
+  max_frames = frame_counts ? maxFrames : 0;
+  memset(totals, 0, sizeof(totals));
+  frame = 0;
+  checking = getenv("ALLOC_CHECK") != NULL;
+}
+
+void AllocProfile_begin(Phase phase) {
+  open_site = phase;
+}
+
+void AllocProfile_end(Phase phase) {
+  open_site = in_update ? ALLOC_UPDATE : ALLOC_OUTSIDE;
+}
+
+void AllocProfile_endFrame() {
+  frame++;
+}
+
+void AllocProfile_beginUpdate() {
+  memset(update_counts, 0, sizeof(update_counts));
+  update_calls = 0;
+  in_update = true;
+  open_site = ALLOC_UPDATE;
+}
+
+static const char* site_name(int site) {
+  return site < NUM_PHASES ? Instrument_phaseName(site)
+      : other_names[site - NUM_PHASES];
+}
+
+void AllocProfile_endUpdate(bool check) {
+  in_update = false;
+  open_site = ALLOC_OUTSIDE;
+  if (!checking || !check || frame < ALLOC_WARMUP_FRAMES ||
+      update_calls == 0) {
+    return;
+  }
+  fprintf(stderr, "Frame %u: CollisionWorld_updateLines made %lu heap calls "
+          "after warming up\n", frame, update_calls);
+  for (int s = 0; s < NUM_ALLOC_SITES; s++) {
+    const AllocCounts* c = &update_counts[s];
+    if (c->allocs + c->frees > c->growth) {
+      fprintf(stderr, "  %s: %lu allocations of %lu bytes, %lu frees, "
+              "%lu of them growth\n", site_name(s), c->allocs, c->bytes,
+              c->frees, c->growth);
+    }
+  }
+  abort();
+}
+
+void AllocProfile_renderThread() {
+  render_thread = true;
+}
+
+void AllocProfile_beginGrowth() {
+  growth_depth++;
+}
+
+void* AllocProfile_endGrowth(void* p) {
+  growth_depth--;
+  return p;
+}
+
+void AllocProfile_report(FILE* out) {
+  unsigned int recorded = frame < max_frames ? frame : max_frames;
+  fprintf(out, "{\n    \"checked\": %s,\n    \"warmup_frames\": %d,\n",
+          checking ? "true" : "false", ALLOC_WARMUP_FRAMES);
+  fprintf(out, "    \"sites\": {\n");
+  for (int s = 0; s < NUM_ALLOC_SITES; s++) {
+    const AllocCounts* c = &totals[s];
+    fprintf(out, "      \"%s\": {\"allocs\": %lu, \"frees\": %lu, "
+            "\"bytes\": %lu, \"growth\": %lu,\n", site_name(s), c->allocs,
+            c->frees, c->bytes, c->growth);
+    const char* series[3] = {"allocs", "frees", "bytes"};
+    for (int k = 0; k < 3; k++) {
+      fprintf(out, "        \"per_frame_%s\": [", series[k]);
+      for (unsigned int f = 0; f < recorded; f++) {
+        const AllocCounts* fc = &frame_counts[f * NUM_ALLOC_SITES + s];
+        fprintf(out, "%s%lu", f ? ", " : "",
+                k == 0 ? fc->allocs : k == 1 ? fc->frees : fc->bytes);
+      }
+      fprintf(out, "]%s\n", k < 2 ? "," : "");
+    }
+    fprintf(out, "      }%s\n", s + 1 < NUM_ALLOC_SITES ? "," : "");
+  }
+  fprintf(out, "    }\n  }");
+}
+
+#endif  // ALLOC_PROFILE
@@ -0,0 +1,82 @@
+#ifndef ALLOCPROFILE_H_
+#define ALLOCPROFILE_H_
+
+// Heap calls per simulation phase and per frame.
+//
+// Built in only with ALLOC_PROFILE defined ("make alloc"), on top of the
+// INSTRUMENT phase timers.  The profiler defines malloc, calloc, realloc,
+// free and the aligned allocators itself and passes them on to glibc's
+// __libc_ versions, so every heap call in the process is seen, including
+// those made by libraries and the Cilk runtime.  Each call is charged to the
+// phase open at the time, to the rest of CollisionWorld_updateLines, to the
+// render thread, or to everything else, and counted per frame.
+//
+// CollisionWorld_updateLines should make no heap calls once warmed up,
+// other than to grow a buffer or pool past the largest size it has needed
+// so far; such calls are wrapped in ALLOC_GROWTH and counted apart.  With
+// ALLOC_CHECK set in the environment, a frame past the first
+// ALLOC_WARMUP_FRAMES that makes any other heap call in
+// CollisionWorld_updateLines prints them and aborts ("make alloccheck").
+//
+// The check holds only with a single worker (CILK_NWORKERS=1), and that is
+// all "make alloccheck" runs.  The simulation's own code makes no heap
+// calls with any number of workers, since events go into per-worker lists
+// rather than reducer views.  But a steal makes the Cilk runtime allocate
+// for itself, and those calls cannot be told apart from the simulation's,
+// so with more workers the check may abort on them.
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "./Instrument.h"
+
+#define ALLOC_WARMUP_FRAMES 1
+
+typedef enum {
+  ALLOC_UPDATE = NUM_PHASES,  // in CollisionWorld_updateLines, between phases
+  ALLOC_RENDER,               // on the render thread
+  ALLOC_OUTSIDE,              // anywhere else
+  NUM_ALLOC_SITES
+} AllocSite;
+
+#ifdef ALLOC_PROFILE
+
+// Allocates storage for up to maxFrames frames of per-frame counts.
+void AllocProfile_init(unsigned int maxFrames);
+
+void AllocProfile_begin(Phase phase);
+void AllocProfile_end(Phase phase);
+void AllocProfile_endFrame();
+
+// Bracket CollisionWorld_updateLines.  The frame is checked at the end if
+// check is true.
+void AllocProfile_beginUpdate();
+void AllocProfile_endUpdate(bool check);
+
+// Charges the heap calls of the calling thread to the render thread.
+void AllocProfile_renderThread();
+
+// Marks the heap calls of the calling thread as growth until
+// AllocProfile_endGrowth, which returns p.
+void AllocProfile_beginGrowth();
+void* AllocProfile_endGrowth(void* p);
+
+// Writes the collected counts as a JSON value to out.
+void AllocProfile_report(FILE* out);
+
+#define ALLOC_BEGIN_UPDATE() AllocProfile_beginUpdate()
+#define ALLOC_END_UPDATE(check) AllocProfile_endUpdate(check)
+#define ALLOC_RENDER_THREAD() AllocProfile_renderThread()
+#define ALLOC_GROWTH(call) \
+  (AllocProfile_beginGrowth(), AllocProfile_endGrowth(call))
+
+#else
+
+#define ALLOC_BEGIN_UPDATE() ((void) 0)
+#define ALLOC_END_UPDATE(check) ((void) 0)
+#define ALLOC_RENDER_THREAD() ((void) 0)
+#define ALLOC_GROWTH(call) (call)
+
+#endif  // ALLOC_PROFILE
+
+#endif  // ALLOCPROFILE_H_
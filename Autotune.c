@@ -0,0 +1,320 @@
+#include "./Autotune.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <assert.h>
+
+typedef enum {
+  TUNE_MAX_LINES,
+  TUNE_MAX_DEPTH,
+  TUNE_SPAWN_GRAIN,
+  TUNE_SETTLED,
+  TUNE_RECHECK
+} TuneStage;
+
+// The settings chosen and, for each parameter, the candidates on either side
+// of its chosen value.
+#define MAX_NEIGHBOURS (1 + 2 * TUNE_SETTLED)
+
+static const int max_lines_candidates[] = {8, 16, 32, 50, 100, 200};
+static const int max_depth_candidates[] = {3, 4, 5, 6, 7, 8};
+static const int spawn_grain_candidates[] = {256, 1024, 4096, 16384};
+
+static const struct {
+  const int* values;
+  int count;
+} candidates[TUNE_SETTLED] = {
+  {max_lines_candidates, 6},
+  {max_depth_candidates, 6},
+  {spawn_grain_candidates, 4}
+};
+
+struct Autotune {
+  char* cachePath;
+  TuneStage stage;
+  int candidate;           // index into the candidates of stage
+  int samples;             // frames timed under the current candidate
+  double sampleTime;       // fastest of those frames
+  int bestValue;           // fastest candidate of stage so far
+  double bestTime;
+  QuadTreeParams best;     // settings chosen by the finished stages
+  QuadTreeParams current;  // settings being timed
+  unsigned int settledFrames;
+  QuadTreeParams neighbours[MAX_NEIGHBOURS];  // timed by a recheck
+  int numNeighbours;
+  int fastest;             // fastest neighbour so far
+  double fastestTime;
+};
+
+static int* stage_param(QuadTreeParams* params, TuneStage stage) {
+  switch (stage) {
+    case TUNE_MAX_LINES:
+      return &params->maxLines;
+    case TUNE_MAX_DEPTH:
+      return &params->maxDepth;
+    default:
+      return &params->spawnGrain;
+  }
+}
+
+static void try_candidate(Autotune* a) {
+  a->current = a->best;
+  *stage_param(&a->current, a->stage) =
+      candidates[a->stage].values[a->candidate];
+  a->samples = 0;
+}
+
+// Lists the settings chosen and their neighbours, with the chosen ones
+// first.
+static void find_neighbours(Autotune* a) {
+  a->neighbours[0] = a->best;
+  a->numNeighbours = 1;
+  for (int s = 0; s < TUNE_SETTLED; s++) {
+    int value = *stage_param(&a->best, s);
+    for (int i = 0; i < candidates[s].count; i++) {
+      if (candidates[s].values[i] != value) {
+        continue;
+      }
+      for (int j = i - 1; j <= i + 1; j += 2) {
+        if (j >= 0 && j < candidates[s].count) {
+          QuadTreeParams* n = &a->neighbours[a->numNeighbours++];
+          *n = a->best;
+          *stage_param(n, s) = candidates[s].values[j];
+        }
+      }
+    }
+  }
+}
+
+static void start_stage(Autotune* a, TuneStage stage) {
+  a->stage = stage;
+  a->candidate = 0;
+  a->bestTime = INFINITY;
+  a->samples = 0;
+  if (stage == TUNE_SETTLED) {
+    a->current = a->best;
+    a->settledFrames = 0;
+  } else if (stage == TUNE_RECHECK) {
+    find_neighbours(a);
+    a->fastest = 0;
+    a->current = a->neighbours[0];
+  } else {
+    try_candidate(a);
+  }
+}
+
+// Refuses to follow a symlink at the cache path, so that the cache cannot be
+// pointed at another file.
+static bool load_cache(Autotune* a) {
+  if (a->cachePath == NULL) {
+    return false;
+  }
+  int fd = open(a->cachePath, O_RDONLY | O_NOFOLLOW);
+  if (fd < 0) {
+    return false;
+  }
+  FILE* in = fdopen(fd, "r");
+  if (in == NULL) {
+    close(fd);
+    return false;
+  }
+  QuadTreeParams params;
+  bool ok = fscanf(in, "%d %d %d", &params.maxLines, &params.spawnGrain,
+                   &params.maxDepth) == 3 && QuadTreeParams_valid(&params);
+  fclose(in);
+  if (ok) {
+    a->best = params;
+  }
+  return ok;
+}
+
+// Writes the cache to a new file next to it and renames that over it, so
+// that an existing file or symlink at the cache path is replaced rather than
+// written through, and a reader never sees a partial cache.
+static void save_cache(Autotune* a) {
+  if (a->cachePath == NULL) {
+    return;
+  }
+  size_t size = strlen(a->cachePath) + sizeof(".XXXXXX");
+  char* tmpPath = malloc(size);
+  if (tmpPath == NULL) {
+    return;
+  }
+  snprintf(tmpPath, size, "%s.XXXXXX", a->cachePath);
+  int fd = mkstemp(tmpPath);
+  if (fd < 0) {
+    free(tmpPath);
+    return;
+  }
+  FILE* out = fdopen(fd, "w");
+  if (out == NULL) {
+    close(fd);
+    unlink(tmpPath);
+    free(tmpPath);
+    return;
+  }
+  bool ok = fprintf(out, "%d %d %d\n", a->best.maxLines, a->best.spawnGrain,
+                    a->best.maxDepth) > 0;
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(tmpPath, a->cachePath) != 0) {
+    unlink(tmpPath);
+  }
+  free(tmpPath);
+}
+
+// Creates path as a directory private to the user unless it exists.
+static bool make_dir(const char* path) {
+  return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+// Returns the directory to keep caches in, creating it if needed:
+// $AUTOTUNE_DIR if set, and otherwise screensaver under $XDG_CACHE_HOME or
+// ~/.cache.  A shared directory such as /tmp is never the default, since
+// another user could plant a file at the cache path there.  Returns NULL if
+// there is no such directory.
+static char* cache_dir(void) {
+  const char* dir = getenv("AUTOTUNE_DIR");
+  if (dir != NULL && dir[0] != '\0') {
+    return strdup(dir);
+  }
+
+  char* base;
+  dir = getenv("XDG_CACHE_HOME");
+  if (dir != NULL && dir[0] == '/') {
+    base = strdup(dir);
+  } else {
+    const char* home = getenv("HOME");
+    if (home == NULL || home[0] == '\0') {
+      return NULL;
+    }
+    size_t size = strlen(home) + sizeof("/.cache");
+    base = malloc(size);
+    if (base) {
+      snprintf(base, size, "%s/.cache", home);
+    }
+  }
+  if (base == NULL || !make_dir(base)) {
+    free(base);
+    return NULL;
+  }
+
+  size_t size = strlen(base) + sizeof("/screensaver");
+  char* cacheDir = malloc(size);
+  if (cacheDir) {
+    snprintf(cacheDir, size, "%s/screensaver", base);
+    if (!make_dir(cacheDir)) {
+      free(cacheDir);
+      cacheDir = NULL;
+    }
+  }
+  free(base);
+  return cacheDir;
+}
+
+// Names the cache after the input file and a hash of its full path, so that
+// inputs of the same name in different directories do not share one.
+// Returns NULL if there is nowhere to keep it.
+static char* cache_path(const char* inputPath) {
+  char* dir = cache_dir();
+  if (dir == NULL) {
+    return NULL;
+  }
+  char* full = realpath(inputPath, NULL);
+  const char* path = full ? full : inputPath;
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (const char* c = path; *c; c++) {
+    hash = (hash ^ (unsigned char) *c) * 16777619u;
+  }
+  const char* name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+
+  size_t size = strlen(dir) + strlen(name) + sizeof("/-12345678.tune");
+  char* cachePath = malloc(size);
+  if (cachePath) {
+    snprintf(cachePath, size, "%s/%s-%08x.tune", dir, name, (unsigned) hash);
+  }
+  free(full);
+  free(dir);
+  return cachePath;
+}
+
+Autotune* Autotune_new(const char* inputPath, const QuadTreeParams* initial) {
+  Autotune* a = malloc(sizeof(Autotune));
+  if (a == NULL) {
+    return NULL;
+  }
+  a->cachePath = cache_path(inputPath);
+  a->best = *initial;
+  start_stage(a, load_cache(a) ? TUNE_SETTLED : TUNE_MAX_LINES);
+  return a;
+}
+
+void Autotune_delete(Autotune* autotune) {
+  free(autotune->cachePath);
+  free(autotune);
+}
+
+bool Autotune_isSettled(const Autotune* autotune) {
+  return autotune->stage >= TUNE_SETTLED;
+}
+
+const QuadTreeParams* Autotune_params(const Autotune* autotune) {
+  return &autotune->current;
+}
+
+void Autotune_frame(Autotune* a, double seconds) {
+  if (a->stage == TUNE_SETTLED) {
+    if (++a->settledFrames >= AUTOTUNE_RECHECK) {
+      start_stage(a, TUNE_RECHECK);
+    }
+    return;
+  }
+
+  a->sampleTime = a->samples ? fmin(a->sampleTime, seconds) : seconds;
+  if (++a->samples < AUTOTUNE_SAMPLES) {
+    return;
+  }
+
+  if (a->stage == TUNE_RECHECK) {
+    if (a->candidate == 0) {
+      a->bestTime = a->sampleTime;
+      a->fastestTime = a->sampleTime;
+    } else if (a->sampleTime < a->fastestTime) {
+      a->fastest = a->candidate;
+      a->fastestTime = a->sampleTime;
+    }
+    if (++a->candidate < a->numNeighbours) {
+      a->current = a->neighbours[a->candidate];
+      a->samples = 0;
+      return;
+    }
+    // Search again only if a neighbour beats the settings chosen by a clear
+    // margin; timing noise alone should not set off a full search.
+    bool diverged = a->fastest != 0 &&
+        a->fastestTime < (1 - AUTOTUNE_DIVERGENCE) * a->bestTime;
+    start_stage(a, diverged ? TUNE_MAX_LINES : TUNE_SETTLED);
+    return;
+  }
+
+  if (a->sampleTime < a->bestTime) {
+    a->bestTime = a->sampleTime;
+    a->bestValue = candidates[a->stage].values[a->candidate];
+  }
+  if (++a->candidate < candidates[a->stage].count) {
+    try_candidate(a);
+    return;
+  }
+
+  *stage_param(&a->best, a->stage) = a->bestValue;
+  start_stage(a, a->stage + 1);
+  if (a->stage == TUNE_SETTLED) {
+    save_cache(a);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+// Online tuning of the quadtree parameters.
+//
+// The tuner times frames of the running simulation under candidate
+// settings.  It tunes the maximum lines per leaf first, then the tree depth,
+// then the spawn grain, each time keeping the fastest candidate.  Each
+// candidate is scored by its fastest of AUTOTUNE_SAMPLES frames.  The
+// settings it picks are written to a cache file in $AUTOTUNE_DIR, or else
+// in $XDG_CACHE_HOME/screensaver or ~/.cache/screensaver, named after the
+// input and a hash of its full path (e.g. line.in-1a2b3c4d.tune), and a later
+// run on the same input starts from them.  The input directory is never
+// written to, and the cache is never read or written through a symlink.
+//
+// Every AUTOTUNE_RECHECK frames it checks the settings again, since the best
+// ones change as the scene evolves.  It times only the settings chosen and
+// those one candidate away in each parameter, and runs the full search again
+// only if one of them is faster by more than AUTOTUNE_DIVERGENCE.  The
+// collision counts do not depend on the parameters, so tuning never changes
+// the results of the simulation.
+
+#include <stdbool.h>
+
+#include "./Quadtree.h"
+
+#define AUTOTUNE_SAMPLES 3
+#define AUTOTUNE_RECHECK 1000
+#define AUTOTUNE_DIVERGENCE 0.05
+
+typedef struct Autotune Autotune;
+
+// Creates a tuner for the scene in inputPath.  It starts from the settings
+// cached for that input if there are any, and from initial otherwise.  If
+// there is no cache directory, it tunes without a cache.  Returns NULL if out
+// of memory.
+Autotune* Autotune_new(const char* inputPath, const QuadTreeParams* initial);
+
+void Autotune_delete(Autotune* autotune);
+
+// Whether the settings came from the cache or from a finished search.
+bool Autotune_isSettled(const Autotune* autotune);
+
+// Returns the settings to use for the next frame.
+const QuadTreeParams* Autotune_params(const Autotune* autotune);
+
+// Records that the last frame, run with Autotune_params, took seconds.
+void Autotune_frame(Autotune* autotune, double seconds);
+
+#endif  // AUTOTUNE_H_
@@ -0,0 +1,51 @@
+#include "./CalendarQueue.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "./AllocProfile.h"
+
+CalendarQueue* CalendarQueue_new() {
+  return calloc(1, sizeof(CalendarQueue));
+}
+
+void CalendarQueue_delete(CalendarQueue* cq) {
+  for (int i = 0; i < CALENDAR_BUCKETS; i++) {
+    free(cq->buckets[i].entries);
+  }
+  free(cq->ready.entries);
+  free(cq);
+}
+
+static inline void bucket_append(CalendarBucket* b, CalendarEntry entry) {
+  if (b->count == b->capacity) {
+    b->capacity = b->capacity ? 2 * b->capacity : 16;
+    b->entries = ALLOC_GROWTH(realloc(b->entries,
+                                      b->capacity * sizeof(CalendarEntry)));
+    assert(b->entries);
+  }
+  b->entries[b->count++] = entry;
+}
+
+inline void CalendarQueue_push(CalendarQueue* cq, Line* line,
+                               unsigned int due) {
+  CalendarEntry entry = {.line = line, .due = due};
+  bucket_append(&cq->buckets[due % CALENDAR_BUCKETS], entry);
+}
+
+int CalendarQueue_popDue(CalendarQueue* cq, unsigned int now,
+                         CalendarEntry** entries) {
+  CalendarBucket* b = &cq->buckets[now % CALENDAR_BUCKETS];
+  cq->ready.count = 0;
+  int kept = 0;
+  for (int i = 0; i < b->count; i++) {
+    if (b->entries[i].due == now) {
+      bucket_append(&cq->ready, b->entries[i]);
+    } else {
+      b->entries[kept++] = b->entries[i];
+    }
+  }
+  b->count = kept;
+  *entries = cq->ready.entries;
+  return cq->ready.count;
+}
@@ -0,0 +1,41 @@
+#ifndef CALENDARQUEUE_H_
+#define CALENDARQUEUE_H_
+
+#include "./Line.h"
+
+// A calendar queue of lines keyed by the integer time they are due.  Time
+// t lives in bucket t % CALENDAR_BUCKETS, so pushing is O(1) and taking out
+// everything due at one time scans a single bucket; entries due in a later
+// "year" simply wait in their bucket.  The queue does not support removal:
+// callers keep the due time of each line next to it and skip entries that
+// no longer match.
+#define CALENDAR_BUCKETS 256
+
+typedef struct CalendarEntry {
+  Line* line;
+  unsigned int due;
+} CalendarEntry;
+
+typedef struct CalendarBucket {
+  CalendarEntry* entries;
+  int count;
+  int capacity;
+} CalendarBucket;
+
+typedef struct CalendarQueue {
+  CalendarBucket buckets[CALENDAR_BUCKETS];
+  CalendarBucket ready;  // entries returned by the last CalendarQueue_popDue
+} CalendarQueue;
+
+CalendarQueue* CalendarQueue_new();
+
+void CalendarQueue_delete(CalendarQueue* cq);
+
+void CalendarQueue_push(CalendarQueue* cq, Line* line, unsigned int due);
+
+// Takes every entry due at time now out of the queue.  Returns their number
+// and points *entries at them; they stay valid until the next call.
+int CalendarQueue_popDue(CalendarQueue* cq, unsigned int now,
+                         CalendarEntry** entries);
+
+#endif  // CALENDARQUEUE_H_
@@ -0,0 +1,251 @@
+#include "./Clearance.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "./AllocProfile.h"
+
+// Slack around predicted boxes for rounding in the position updates.
+#define CLEARANCE_SLACK 1e-12
+
+typedef struct {
+  double x1, x2, y1, y2;
+} Box;
+
+// Boxes bucketed by the grid cells they touch.  Boxes outside the grid go
+// in its border cells.  The arrays are kept from one build to the next.
+typedef struct {
+  int nx, ny;
+  double cellW, cellH;
+  int* start;   // boxes of cell c are items[start[c]] to items[start[c+1]-1]
+  int* items;
+  int* fill;    // next free slot of each cell while building
+  int startCapacity, itemsCapacity, fillCapacity;
+  const Box* boxes;
+  Line* const* lines;  // line of each box
+} Grid;
+
+// Every buffer is kept and only grows, so that planning and querying make
+// no heap calls once they have seen the most lines they will.
+struct Clearance {
+  Grid obstacles;  // the predicted boxes, while planning
+  Grid sleepers;
+  Box* predicted;
+  Box* boxes;
+  Line** lines;
+  Line** hits;
+  int predictedCapacity, boxesCapacity, linesCapacity, hitsCapacity;
+};
+
+// Returns buffer, grown if need be to hold n items of size bytes each.
+static void* reserve(void* buffer, int* capacity, int n, size_t size) {
+  if (n <= *capacity) {
+    return buffer;
+  }
+  *capacity = MAX(n, 2 * *capacity);
+  buffer = ALLOC_GROWTH(realloc(buffer, *capacity * size));
+  assert(buffer);
+  return buffer;
+}
+
+static inline bool boxes_overlap(const Box* a, const Box* b) {
+  return a->x1 <= b->x2 && b->x1 <= a->x2 && a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+// The box swept by l over the next frames frames at its current velocity.
+static inline Box swept_box(const Line* l, double t, int frames) {
+  double dx = l->velocity.x * t * frames;
+  double dy = l->velocity.y * t * frames;
+  double x1 = MIN(l->p1.x, l->p2.x);
+  double x2 = MAX(l->p1.x, l->p2.x);
+  double y1 = MIN(l->p1.y, l->p2.y);
+  double y2 = MAX(l->p1.y, l->p2.y);
+  Box b = {
+    .x1 = x1 + MIN(dx, 0) - CLEARANCE_SLACK,
+    .x2 = x2 + MAX(dx, 0) + CLEARANCE_SLACK,
+    .y1 = y1 + MIN(dy, 0) - CLEARANCE_SLACK,
+    .y2 = y2 + MAX(dy, 0) + CLEARANCE_SLACK
+  };
+  return b;
+}
+
+// Frames before l could be carried past the wall it is heading for.
+static inline int frames_to_wall(const Line* l, double t, int maxFrames) {
+  double frames = maxFrames;
+  double vx = l->velocity.x * t;
+  double vy = l->velocity.y * t;
+  if (vx > 0) {
+    frames = MIN(frames, (BOX_XMAX - MAX(l->p1.x, l->p2.x)) / vx);
+  } else if (vx < 0) {
+    frames = MIN(frames, (MIN(l->p1.x, l->p2.x) - BOX_XMIN) / -vx);
+  }
+  if (vy > 0) {
+    frames = MIN(frames, (BOX_YMAX - MAX(l->p1.y, l->p2.y)) / vy);
+  } else if (vy < 0) {
+    frames = MIN(frames, (MIN(l->p1.y, l->p2.y) - BOX_YMIN) / -vy);
+  }
+  return frames > 0 ? (int) floor(frames * (1 - 1e-6)) : 0;
+}
+
+static inline int cell_of(double v, double lo, double size, int n) {
+  int c = (int) floor((v - lo) / size);
+  return c < 0 ? 0 : (c >= n ? n - 1 : c);
+}
+
+static inline void cell_range(const Grid* g, const Box* b, int* cx1, int* cx2,
+                              int* cy1, int* cy2) {
+  *cx1 = cell_of(b->x1, BOX_XMIN, g->cellW, g->nx);
+  *cx2 = cell_of(b->x2, BOX_XMIN, g->cellW, g->nx);
+  *cy1 = cell_of(b->y1, BOX_YMIN, g->cellH, g->ny);
+  *cy2 = cell_of(b->y2, BOX_YMIN, g->cellH, g->ny);
+}
+
+// Buckets n boxes into a grid with a few boxes per cell: count, prefix
+// sum, then fill.
+static void Grid_build(Grid* g, const Box* boxes, Line* const* lines,
+                       int n) {
+  g->nx = g->ny = MIN(CLEARANCE_MAX_CELLS, MAX(1, (int) sqrt(n / 4)));
+  g->cellW = (BOX_XMAX - BOX_XMIN) / g->nx;
+  g->cellH = (BOX_YMAX - BOX_YMIN) / g->ny;
+  g->boxes = boxes;
+  g->lines = lines;
+  int cells = g->nx * g->ny;
+  g->start = reserve(g->start, &g->startCapacity, cells + 1, sizeof(int));
+  memset(g->start, 0, (cells + 1) * sizeof(int));
+
+  int cx1, cx2, cy1, cy2;
+  for (int i = 0; i < n; i++) {
+    cell_range(g, &boxes[i], &cx1, &cx2, &cy1, &cy2);
+    for (int cy = cy1; cy <= cy2; cy++) {
+      for (int cx = cx1; cx <= cx2; cx++) {
+        g->start[cy * g->nx + cx + 1]++;
+      }
+    }
+  }
+  for (int c = 0; c < cells; c++) {
+    g->start[c + 1] += g->start[c];
+  }
+  int* fill = g->fill = reserve(g->fill, &g->fillCapacity, cells,
+                                sizeof(int));
+  for (int c = 0; c < cells; c++) {
+    fill[c] = g->start[c];
+  }
+  g->items = reserve(g->items, &g->itemsCapacity, MAX(1, g->start[cells]),
+                     sizeof(int));
+  for (int i = 0; i < n; i++) {
+    cell_range(g, &boxes[i], &cx1, &cx2, &cy1, &cy2);
+    for (int cy = cy1; cy <= cy2; cy++) {
+      for (int cx = cx1; cx <= cx2; cx++) {
+        g->items[fill[cy * g->nx + cx]++] = i;
+      }
+    }
+  }
+}
+
+static void Grid_free(Grid* g) {
+  free(g->start);
+  free(g->items);
+  free(g->fill);
+}
+
+// Whether the box of any line in the grid but skip touches b.
+static bool Grid_overlapsOther(const Grid* g, const Box* b, const Line* skip) {
+  int cx1, cx2, cy1, cy2;
+  cell_range(g, b, &cx1, &cx2, &cy1, &cy2);
+  for (int cy = cy1; cy <= cy2; cy++) {
+    for (int cx = cx1; cx <= cx2; cx++) {
+      int c = cy * g->nx + cx;
+      for (int j = g->start[c]; j < g->start[c + 1]; j++) {
+        int i = g->items[j];
+        if (g->lines[i] != skip && boxes_overlap(b, &g->boxes[i])) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+Clearance* Clearance_new() {
+  return calloc(1, sizeof(Clearance));
+}
+
+void Clearance_delete(Clearance* clearance) {
+  Grid_free(&clearance->obstacles);
+  Grid_free(&clearance->sleepers);
+  free(clearance->predicted);
+  free(clearance->boxes);
+  free(clearance->lines);
+  free(clearance->hits);
+  free(clearance);
+}
+
+void Clearance_plan(Clearance* clearance, Line** candidates, int numCandidates,
+                    Line** obstacles, int numObstacles, double timeStep,
+                    int minFrames, int maxFrames, int* frames) {
+  // Where every line would go over the whole horizon.
+  Box* predicted = clearance->predicted = reserve(
+      clearance->predicted, &clearance->predictedCapacity,
+      MAX(1, numObstacles), sizeof(Box));
+  for (int i = 0; i < numObstacles; i++) {
+    predicted[i] = swept_box(obstacles[i], timeStep, maxFrames);
+  }
+  Grid* grid = &clearance->obstacles;
+  Grid_build(grid, predicted, obstacles, numObstacles);
+
+  // A candidate sleeps while it stays clear of the walls and its box while
+  // asleep, which lies within its predicted box, touches no other
+  // predicted box.  In particular the sleepers' boxes are disjoint.
+  clearance->boxes = reserve(clearance->boxes, &clearance->boxesCapacity,
+                             MAX(1, numCandidates), sizeof(Box));
+  clearance->lines = reserve(clearance->lines, &clearance->linesCapacity,
+                             MAX(1, numCandidates), sizeof(Line*));
+  int numSleepers = 0;
+  for (int i = 0; i < numCandidates; i++) {
+    Line* l = candidates[i];
+    frames[i] = 0;
+    int k = frames_to_wall(l, timeStep, maxFrames);
+    if (k < minFrames) {
+      continue;
+    }
+    Box b = swept_box(l, timeStep, k);
+    if (Grid_overlapsOther(grid, &b, l)) {
+      continue;
+    }
+    frames[i] = k;
+    clearance->boxes[numSleepers] = b;
+    clearance->lines[numSleepers] = l;
+    numSleepers++;
+  }
+
+  Grid_build(&clearance->sleepers, clearance->boxes, clearance->lines,
+             numSleepers);
+}
+
+int Clearance_query(Clearance* clearance, const Line* l, Line*** hits) {
+  const Grid* g = &clearance->sleepers;
+  Box b = {.x1 = l->l_x, .x2 = l->u_x, .y1 = l->l_y, .y2 = l->u_y};
+  int cx1, cx2, cy1, cy2;
+  cell_range(g, &b, &cx1, &cx2, &cy1, &cy2);
+  int n = 0;
+  for (int cy = cy1; cy <= cy2; cy++) {
+    for (int cx = cx1; cx <= cx2; cx++) {
+      int c = cy * g->nx + cx;
+      for (int j = g->start[c]; j < g->start[c + 1]; j++) {
+        if (!boxes_overlap(&b, &g->boxes[g->items[j]])) {
+          continue;
+        }
+        if (n == clearance->hitsCapacity) {
+          clearance->hitsCapacity = MAX(16, 2 * n);
+          clearance->hits = ALLOC_GROWTH(realloc(
+              clearance->hits, clearance->hitsCapacity * sizeof(Line*)));
+        }
+        clearance->hits[n++] = g->lines[g->items[j]];
+      }
+    }
+  }
+  *hits = clearance->hits;
+  return n;
+}
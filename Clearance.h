@@ -0,0 +1,35 @@
+#ifndef CLEARANCE_H_
+#define CLEARANCE_H_
+
+// Finds moving lines that can safely skip frames.
+//
+// A line that keeps its velocity sweeps a known box over the next k frames.
+// If that box stays inside the walls and clear of the boxes every other
+// line would sweep at its current velocity, the line can sleep for those
+// k frames: nothing can reach it except a line whose velocity changes, and
+// Clearance_query finds such a line in time to wake it.
+
+#include "./Line.h"
+
+// Most cells per axis of the grids used to find nearby lines.
+#define CLEARANCE_MAX_CELLS 256
+
+typedef struct Clearance Clearance;
+
+Clearance* Clearance_new();
+
+void Clearance_delete(Clearance* clearance);
+
+// Decides for each candidate how many frames, from minFrames up to
+// maxFrames, it may sleep, or 0 if it should stay awake.  The candidates
+// should be among the obstacles, which are all the lines in the box.
+void Clearance_plan(Clearance* clearance, Line** candidates, int numCandidates,
+                    Line** obstacles, int numObstacles, double timeStep,
+                    int minFrames, int maxFrames, int* frames);
+
+// Sets *hits to the lines put to sleep by the last plan whose box while
+// asleep touches the box that l sweeps this frame, and returns their number.
+// The same line may be listed more than once.
+int Clearance_query(Clearance* clearance, const Line* l, Line*** hits);
+
+#endif  // CLEARANCE_H_
@@ -21,6 +21,9 @@
  * SOFTWARE. 
  **/
 
+#ifdef WORKSPAN
+#include "./fasttime.h"
+#endif
 #include "./CollisionWorld.h"
 
 #include <stdlib.h>
@@ -28,12 +31,16 @@
 #include <assert.h>
 #include <stdio.h>
 #include <cilk/cilk.h>
-#include <cilk/reducer.h>
 
+#include "./AllocProfile.h"
+#include "./Clearance.h"
+#include "./Instrument.h"
 #include "./IntersectionDetection.h"
 #include "./IntersectionEventList.h"
 #include "./Line.h"
+#include "./Oracle.h"
 #include "./Quadtree.h"
+#include "./SpatialQuery.h"
 
 CollisionWorld* CollisionWorld_new(const unsigned int capacity) {
   assert(capacity > 0);
@@ -48,17 +55,61 @@ CollisionWorld* CollisionWorld_new(const unsigned int capacity) {
   collisionWorld->timeStep = 0.5;
   collisionWorld->lines = malloc(capacity * sizeof(Line*));
   collisionWorld->numOfLines = 0;
-  collisionWorld->q = QuadTree_make(BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX);
-  QuadTree_build(collisionWorld->q, MAX_DEPTH);
+  collisionWorld->capacity = capacity;
+  collisionWorld->byId = malloc(capacity * sizeof(Line*));
+  collisionWorld->numIds = 0;
+  collisionWorld->freeIds = malloc(capacity * sizeof(unsigned int));
+  collisionWorld->numFreeIds = 0;
+  collisionWorld->dynamicLines = malloc(capacity * sizeof(Line*));
+  collisionWorld->numDynamicLines = 0;
+  collisionWorld->staticLines = malloc(capacity * sizeof(Line*));
+  collisionWorld->numStaticLines = 0;
+  collisionWorld->staticTree = NULL;
+  collisionWorld->staticEvents = IntersectionEventList_make();
+  collisionWorld->staticDirty = true;
+  collisionWorld->staticEventsStale = false;
+  collisionWorld->wallPass = 0;
+  collisionWorld->wallQueue = CalendarQueue_new();
+  collisionWorld->adaptiveStepping = false;
+  collisionWorld->sleepingLines = malloc(capacity * sizeof(Line*));
+  collisionWorld->numSleepingLines = 0;
+  collisionWorld->nextWake = 0;
+  collisionWorld->sleepFrames = malloc(capacity * sizeof(int));
+  collisionWorld->clearance = Clearance_new();
+  collisionWorld->numPositionUpdates = 0;
+  collisionWorld->params = (QuadTreeParams) QUADTREE_DEFAULT_PARAMS;
+  collisionWorld->q = QuadTree_make(BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX,
+                                    &collisionWorld->params);
+  QuadTree_build(collisionWorld->q, collisionWorld->params.maxDepth);
+  collisionWorld->treeBuilt = false;
+  IntersectionEventCollector_init(&collisionWorld->events);
+  collisionWorld->validateEvery = 0;
+  collisionWorld->oracle = NULL;
   return collisionWorld;
 }
 
 void CollisionWorld_delete(CollisionWorld* collisionWorld) {
-  for (int i = 0; i < collisionWorld->numOfLines; i++) {
-    free(collisionWorld->lines[i]);
+  for (int i = 0; i < collisionWorld->numIds; i++) {
+    free(collisionWorld->byId[i]);
   }
   free(collisionWorld->lines);
+  free(collisionWorld->byId);
+  free(collisionWorld->freeIds);
+  free(collisionWorld->dynamicLines);
+  free(collisionWorld->staticLines);
+  free(collisionWorld->sleepingLines);
+  free(collisionWorld->sleepFrames);
+  Clearance_delete(collisionWorld->clearance);
+  if (collisionWorld->staticTree) {
+    QuadTree_delete(collisionWorld->staticTree);
+  }
+  IntersectionEventList_deleteNodes(&collisionWorld->staticEvents);
+  CalendarQueue_delete(collisionWorld->wallQueue);
   QuadTree_delete(collisionWorld->q);
+  IntersectionEventCollector_destroy(&collisionWorld->events);
+  if (collisionWorld->oracle) {
+    Oracle_delete(collisionWorld->oracle);
+  }
   free(collisionWorld);
 }
 
@@ -66,9 +117,106 @@ unsigned int CollisionWorld_getNumOfLines(CollisionWorld* collisionWorld) {
   return collisionWorld->numOfLines;
 }
 
-void CollisionWorld_addLine(CollisionWorld* collisionWorld, Line *line) {
-  collisionWorld->lines[collisionWorld->numOfLines] = line;
-  collisionWorld->numOfLines++;
+// Brings a sleeping line up to date by replaying, in order, the position
+// updates it has missed.
+static inline void flush_line(CollisionWorld* cw, Line* l) {
+  INSTRUMENT_COUNT(COUNTER_SLEEP_FLUSHES);
+  for (; l->stepsDone < cw->numPositionUpdates; l->stepsDone++) {
+    step_line(l, cw->timeStep);
+  }
+}
+
+static inline void add_dynamic(CollisionWorld* cw, Line* l) {
+  l->dynamicIndex = cw->numDynamicLines;
+  cw->dynamicLines[cw->numDynamicLines++] = l;
+}
+
+static void wake_line(CollisionWorld* cw, Line* l) {
+  if (!l->asleep) {
+    return;  // woken early, or removed
+  }
+  flush_line(cw, l);
+  l->asleep = false;
+  add_dynamic(cw, l);
+}
+
+static void wake_all(CollisionWorld* cw) {
+  while (cw->nextWake < cw->numSleepingLines) {
+    wake_line(cw, cw->sleepingLines[cw->nextWake++]);
+  }
+  cw->numSleepingLines = 0;
+  cw->nextWake = 0;
+}
+
+// Puts to sleep the moving lines that are clear of every other line and of
+// the walls for at least SLEEP_MIN frames, each for as long as it is clear.
+static void plan_sleep(CollisionWorld* cw) {
+  int* frames = cw->sleepFrames;
+  Clearance_plan(cw->clearance, cw->dynamicLines, cw->numDynamicLines,
+                 cw->lines, cw->numOfLines, cw->timeStep, SLEEP_MIN,
+                 SLEEP_EPOCH, frames);
+
+  // Counting sort of the sleepers by frames asleep, hence by wake frame.
+  unsigned int offset[SLEEP_EPOCH + 2] = {0};
+  for (int i = 0; i < cw->numDynamicLines; i++) {
+    if (frames[i] > 0) {
+      offset[frames[i] + 1]++;
+    }
+  }
+  for (int k = 0; k <= SLEEP_EPOCH; k++) {
+    offset[k + 1] += offset[k];
+  }
+
+  unsigned int now = cw->numPositionUpdates;
+  unsigned int awake = 0;
+  for (int i = 0; i < cw->numDynamicLines; i++) {
+    Line* l = cw->dynamicLines[i];
+    if (frames[i] == 0) {
+      l->dynamicIndex = awake;
+      cw->dynamicLines[awake++] = l;
+      continue;
+    }
+    INSTRUMENT_COUNT(COUNTER_SLEEPS);
+    INSTRUMENT_ADD(COUNTER_SLEEP_FRAMES, frames[i]);
+    l->asleep = true;
+    l->wakeFrame = now + frames[i];
+    l->stepsDone = now;
+    cw->sleepingLines[offset[frames[i]]++] = l;
+  }
+  cw->numSleepingLines = cw->numDynamicLines - awake;
+  cw->numDynamicLines = awake;
+  cw->nextWake = 0;
+}
+
+// Wakes the lines due this frame, and every SLEEP_EPOCH frames decides
+// afresh which lines sleep.  A sleeping line is clear of every line that
+// keeps its velocity, so it is also woken early once the box an awake line
+// sweeps this frame touches the box it sweeps while asleep.  Lines woken
+// here are checked in turn, as they join dynamicLines.
+static void update_sleep(CollisionWorld* cw) {
+  if (cw->numPositionUpdates % SLEEP_EPOCH == 0) {
+    wake_all(cw);
+    plan_sleep(cw);
+  } else {
+    while (cw->nextWake < cw->numSleepingLines &&
+           cw->sleepingLines[cw->nextWake]->wakeFrame <=
+           cw->numPositionUpdates) {
+      wake_line(cw, cw->sleepingLines[cw->nextWake++]);
+    }
+  }
+
+  for (int i = 0; i < cw->numDynamicLines; i++) {
+    Line* l = cw->dynamicLines[i];
+    update_box(l, cw->timeStep);
+    Line** hits;
+    int n = Clearance_query(cw->clearance, l, &hits);
+    for (int j = 0; j < n; j++) {
+      if (hits[j]->asleep) {
+        INSTRUMENT_COUNT(COUNTER_EARLY_WAKES);
+        wake_line(cw, hits[j]);
+      }
+    }
+  }
 }
 
 Line* CollisionWorld_getLine(CollisionWorld* collisionWorld,
@@ -76,104 +224,424 @@ Line* CollisionWorld_getLine(CollisionWorld* collisionWorld,
   if (index >= collisionWorld->numOfLines) {
     return NULL;
   }
-  return collisionWorld->lines[index];
+  Line* l = collisionWorld->lines[index];
+  if (l->asleep) {
+    flush_line(collisionWorld, l);
+  }
+  return l;
+}
+
+Line* CollisionWorld_getLineById(CollisionWorld* collisionWorld,
+                                 const unsigned int id) {
+  if (id >= collisionWorld->numIds ||
+      collisionWorld->byId[id]->slot == LINE_REMOVED) {
+    return NULL;
+  }
+  return CollisionWorld_getLine(collisionWorld, collisionWorld->byId[id]->slot);
+}
+
+const QuadTreeParams* CollisionWorld_getQuadTreeParams(
+    CollisionWorld* collisionWorld) {
+  return &collisionWorld->params;
+}
+
+void CollisionWorld_setQuadTreeParams(CollisionWorld* collisionWorld,
+                                      const QuadTreeParams* params) {
+  assert(QuadTreeParams_valid(params));
+  bool rebuild = params->maxDepth != collisionWorld->params.maxDepth;
+  if (params->maxLines != collisionWorld->params.maxLines || rebuild) {
+    collisionWorld->treeBuilt = false;
+  }
+  collisionWorld->params = *params;
+  if (rebuild) {
+    QuadTree_delete(collisionWorld->q);
+    collisionWorld->q = QuadTree_make(BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX,
+                                      &collisionWorld->params);
+    QuadTree_build(collisionWorld->q, collisionWorld->params.maxDepth);
+  }
+}
+
+void CollisionWorld_setAdaptiveStepping(CollisionWorld* collisionWorld,
+                                        bool enabled) {
+  if (!enabled) {
+    wake_all(collisionWorld);
+  }
+  collisionWorld->adaptiveStepping = enabled;
+  collisionWorld->treeBuilt = false;
+}
+
+void CollisionWorld_setValidation(CollisionWorld* collisionWorld,
+                                  unsigned int k) {
+  if (k == 0 && collisionWorld->oracle) {
+    Oracle_delete(collisionWorld->oracle);
+    collisionWorld->oracle = NULL;
+  } else if (k > 0 && !collisionWorld->oracle) {
+    collisionWorld->oracle = Oracle_new();
+  }
+  collisionWorld->validateEvery = k;
+}
+
+const Oracle* CollisionWorld_getOracle(CollisionWorld* collisionWorld) {
+  return collisionWorld->oracle;
+}
+
+// Brings every sleeping line up to date.
+static void flush_all(CollisionWorld* cw) {
+  for (int i = 0; i < cw->numOfLines; i++) {
+    if (cw->lines[i]->asleep) {
+      flush_line(cw, cw->lines[i]);
+    }
+  }
 }
 
 inline void CollisionWorld_updateLines(CollisionWorld* collisionWorld) {
+  ALLOC_BEGIN_UPDATE();
+
+  // The reference runs the frame from the same lines before the engine
+  // does, and checks the events and the lines the engine ends up with.
+  unsigned int frame = collisionWorld->numPositionUpdates;
+  bool validate = collisionWorld->oracle &&
+      frame % collisionWorld->validateEvery == 0;
+  unsigned int numLineWallCollisions = collisionWorld->numLineWallCollisions;
+  if (validate) {
+    flush_all(collisionWorld);
+    Oracle_beginFrame(collisionWorld->oracle, collisionWorld->lines,
+                      collisionWorld->numOfLines, collisionWorld->timeStep,
+                      frame + 1);
+  }
+
   CollisionWorld_detectIntersection(collisionWorld);
+
+  INSTRUMENT_BEGIN(PHASE_UPDATE_POSITION);
   CollisionWorld_updatePosition(collisionWorld);
+  INSTRUMENT_END(PHASE_UPDATE_POSITION);
+
+  INSTRUMENT_BEGIN(PHASE_WALL_COLLISION);
   CollisionWorld_lineWallCollision(collisionWorld);
+  INSTRUMENT_END(PHASE_WALL_COLLISION);
+
+  if (validate) {
+    flush_all(collisionWorld);
+    Oracle_endFrame(collisionWorld->oracle, collisionWorld->lines,
+                    collisionWorld->numOfLines,
+                    collisionWorld->numLineWallCollisions -
+                    numLineWallCollisions);
+  }
+  // Frames checked by the reference allocate for it.
+  ALLOC_END_UPDATE(!validate);
+  INSTRUMENT_END_FRAME();
 }
 
 inline void CollisionWorld_updatePosition(CollisionWorld* cw) {
   double t = cw->timeStep;
-  double dx, dy;
-  Line* l;
-  int n = cw->numOfLines;
+  int n = cw->numDynamicLines;
   for (int i = 0; i < n; i++) {
-    l = cw->lines[i];
-    dx = l->velocity.x * t;
-    dy = l->velocity.y * t;
-    l->p1.x += dx;
-    l->p1.y += dy;
-    l->p2.x += dx;
-    l->p2.y += dy;
+    step_line(cw->dynamicLines[i], t);
+  }
+  cw->numPositionUpdates++;
+}
+
+// Passes until a side at distance gap is crossed at step per pass, rounded
+// down generously so that rounding in the position updates can never make
+// the prediction late.
+static inline double passes_until(double gap, double step) {
+  if (gap < 0) {
+    return 1;
   }
+  return MAX(1, floor(gap / step * (1 - 1e-4)) - 1);
 }
 
+// Queues l for the earliest wall pass at which its velocity could carry it
+// past a wall, or for none if it cannot reach one.
+static void schedule_wall_check(CollisionWorld* cw, Line* l) {
+  double t = cw->timeStep;
+  double passes = INFINITY;
+  if (l->velocity.x > 0) {
+    passes = MIN(passes, passes_until(BOX_XMAX - MAX(l->p1.x, l->p2.x),
+                                      l->velocity.x * t));
+  } else if (l->velocity.x < 0) {
+    passes = MIN(passes, passes_until(MIN(l->p1.x, l->p2.x) - BOX_XMIN,
+                                      -l->velocity.x * t));
+  }
+  if (l->velocity.y > 0) {
+    passes = MIN(passes, passes_until(BOX_YMAX - MAX(l->p1.y, l->p2.y),
+                                      l->velocity.y * t));
+  } else if (l->velocity.y < 0) {
+    passes = MIN(passes, passes_until(MIN(l->p1.y, l->p2.y) - BOX_YMIN,
+                                      -l->velocity.y * t));
+  }
+  if (passes == INFINITY) {
+    l->wallDue = 0;
+    return;
+  }
+  l->wallDue = cw->wallPass + (unsigned int) MIN(passes, WALL_HORIZON);
+  CalendarQueue_push(cw->wallQueue, l, l->wallDue);
+}
+
+// Queues l for the next wall pass, after its velocity has changed.
+static inline void invalidate_wall_check(CollisionWorld* cw, Line* l) {
+  if (l->wallDue != cw->wallPass + 1) {
+    l->wallDue = cw->wallPass + 1;
+    CalendarQueue_push(cw->wallQueue, l, l->wallDue);
+  }
+}
+
+// Only lines whose predicted wall pass has come are checked; each is then
+// queued again from its new position and velocity.
 inline void CollisionWorld_lineWallCollision(CollisionWorld* cw) {
-  Line* l;
-  int n = cw->numOfLines;
+  unsigned int now = ++cw->wallPass;
+  CalendarEntry* due;
+  int n = CalendarQueue_popDue(cw->wallQueue, now, &due);
   for (int i = 0; i < n; i++) {
-    l = cw->lines[i];
-
-    // Right side
-    if ((l->p1.x > BOX_XMAX || l->p2.x > BOX_XMAX) && (l->velocity.x > 0)) {
-      l->velocity.x = -l->velocity.x;
-      cw->numLineWallCollisions++;
-      continue;
+    Line* l = due[i].line;
+    if (l->wallDue != now) {
+      continue;  // rescheduled since this entry was queued
     }
-    // Left side
-    if ((l->p1.x < BOX_XMIN || l->p2.x < BOX_XMIN) && (l->velocity.x < 0)) {
-      l->velocity.x = -l->velocity.x;
-      cw->numLineWallCollisions++;
-      continue;
+    INSTRUMENT_COUNT(COUNTER_WALL_CHECKS);
+    if (l->asleep) {
+      flush_line(cw, l);
     }
-    // Top side
-    if ((l->p1.y > BOX_YMAX || l->p2.y > BOX_YMAX) && (l->velocity.y > 0)) {
-      l->velocity.y = -l->velocity.y;
+    if (bounce_off_walls(l)) {
       cw->numLineWallCollisions++;
-      continue;
     }
-    // Bottom side
-    if ((l->p1.y < BOX_YMIN || l->p2.y < BOX_YMIN) && (l->velocity.y < 0)) {
-      l->velocity.y = -l->velocity.y;
-      cw->numLineWallCollisions++;
-      continue;
+    schedule_wall_check(cw, l);
+  }
+}
+
+static inline bool line_is_moving(Line* l) {
+  return l->velocity.x != 0 || l->velocity.y != 0;
+}
+
+// Moves a static line that has started moving over to the dynamic lines.
+static void release_static(CollisionWorld* cw, Line* l) {
+  INSTRUMENT_COUNT(COUNTER_STATIC_RELEASES);
+  QuadTree_removeLine(cw->staticTree, l, cw->timeStep);
+  l->isStatic = false;
+  cw->numStaticLines--;
+  add_dynamic(cw, l);
+  invalidate_wall_check(cw, l);
+}
+
+// Drops the static events of lines that are no longer static.
+static void filter_static_events(CollisionWorld* cw) {
+  IntersectionEventList kept = IntersectionEventList_make();
+  for (IntersectionEventNode* node = cw->staticEvents.head; node;
+       node = node->next) {
+    if (node->l1->isStatic && node->l2->isStatic) {
+      IntersectionEventList_appendNode(&kept, node->l1, node->l2,
+                                       node->intersectionType);
     }
   }
+  IntersectionEventList_deleteNodes(&cw->staticEvents);
+  cw->staticEvents = kept;
 }
 
-inline static void build_quadtree(CollisionWorld* cw) {
-  assert(cw);
+// Splits the lines into moving and static ones, indexes the static lines
+// and finds the events among them.
+static void rebuild_static(CollisionWorld* cw) {
+  INSTRUMENT_COUNT(COUNTER_STATIC_REBUILDS);
+  wake_all(cw);
+  cw->numDynamicLines = 0;
+  cw->numStaticLines = 0;
+  for (int i = 0; i < cw->numOfLines; i++) {
+    Line* l = cw->lines[i];
+    l->isStatic = !line_is_moving(l);
+    l->asleep = false;
+    if (l->isStatic) {
+      cw->staticLines[cw->numStaticLines++] = l;
+      l->wallDue = 0;
+    } else {
+      add_dynamic(cw, l);
+      l->wallDue = cw->wallPass + 1;
+      CalendarQueue_push(cw->wallQueue, l, l->wallDue);
+    }
+  }
 
-  // Put lines in appropriate line lists
-  int n = cw->numOfLines;
-  Line* curr;
-  int type;
-  QuadTree_reset(cw->q);
-  for (int i = 0; i < n; i++) {
-    curr = cw->lines[i];
-    update_box(curr, cw->timeStep);
-    type = QuadTree_getQuad(cw->q, curr, cw->timeStep);
-    assert(0 <= type && type <= 4);
-    LineList_addLine(cw->q->quads[type]->lines, curr);
+  IntersectionEventList_deleteNodes(&cw->staticEvents);
+  if (cw->staticTree) {
+    QuadTree_delete(cw->staticTree);
   }
+  cw->staticTree = QuadTree_make(BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX,
+                                 &cw->params);
+  QuadTree_build(cw->staticTree, cw->params.maxDepth);
+
+  if (cw->numStaticLines > 0) {
+    QuadTree_sortLines(cw->staticTree, cw->staticLines, cw->numStaticLines,
+                   cw->timeStep);
+    QuadTree_detectEvents(cw->staticTree, NULL, cw->timeStep, &cw->events);
+    cw->staticEvents = IntersectionEventCollector_take(&cw->events);
+
+    // QuadTree_detectEvents passes lines down into the lists of the nodes
+    // below them, so sort the lines in again before the tree is queried.
+    QuadTree_sortLines(cw->staticTree, cw->staticLines, cw->numStaticLines,
+                   cw->timeStep);
+  }
+  cw->staticDirty = false;
+  cw->staticEventsStale = false;
+}
 
-  cilk_for (int i = 0; i < 4; i++) {
-    QuadTree_addLines(cw->q->quads[i], cw->timeStep);
+// Doubles the length of the per-line arrays.
+static void grow(CollisionWorld* cw) {
+  unsigned int capacity = 2 * cw->capacity;
+  cw->lines = realloc(cw->lines, capacity * sizeof(Line*));
+  cw->byId = realloc(cw->byId, capacity * sizeof(Line*));
+  cw->freeIds = realloc(cw->freeIds, capacity * sizeof(unsigned int));
+  cw->dynamicLines = realloc(cw->dynamicLines, capacity * sizeof(Line*));
+  cw->staticLines = realloc(cw->staticLines, capacity * sizeof(Line*));
+  cw->sleepingLines = realloc(cw->sleepingLines, capacity * sizeof(Line*));
+  cw->sleepFrames = realloc(cw->sleepFrames, capacity * sizeof(int));
+  assert(cw->lines && cw->byId && cw->freeIds && cw->dynamicLines &&
+         cw->staticLines && cw->sleepingLines && cw->sleepFrames);
+  cw->capacity = capacity;
+}
+
+unsigned int CollisionWorld_addLine(CollisionWorld* cw, Line* line) {
+  if (cw->numOfLines == cw->capacity) {
+    grow(cw);
   }
+
+  unsigned int id;
+  if (cw->numFreeIds > 0) {
+    id = cw->freeIds[--cw->numFreeIds];
+    *cw->byId[id] = *line;
+    free(line);
+    line = cw->byId[id];
+  } else {
+    id = cw->numIds++;
+    cw->byId[id] = line;
+  }
+  line->id = id;
+  line->slot = cw->numOfLines;
+  cw->treeBuilt = false;
+  line->asleep = false;
+  line->wakeFrame = 0;
+  cw->lines[cw->numOfLines++] = line;
+
+  // Before the first frame, the lines are sorted into static and moving
+  // ones all at once.  Afterwards they simply start out moving.
+  if (!cw->staticDirty) {
+    line->isStatic = false;
+    add_dynamic(cw, line);
+    line->wallDue = cw->wallPass + 1;
+    CalendarQueue_push(cw->wallQueue, line, line->wallDue);
+  }
+  return id;
 }
 
-inline void CollisionWorld_detectIntersection(CollisionWorld* cw) {
-  IntersectionEventListReducer ielr = CILK_C_INIT_REDUCER(
-    IntersectionEventList,
-    intersection_event_list_reduce,
-    intersection_event_list_identity,
-    intersection_event_list_destroy,
-    IntersectionEventList_make()
-  );
-  CILK_C_REGISTER_REDUCER(ielr);
+bool CollisionWorld_removeLine(CollisionWorld* cw, const unsigned int id) {
+  if (id >= cw->numIds || cw->byId[id]->slot == LINE_REMOVED) {
+    return false;
+  }
+  Line* l = cw->byId[id];
+  cw->treeBuilt = false;
+
+  Line* last = cw->lines[--cw->numOfLines];
+  cw->lines[l->slot] = last;
+  last->slot = l->slot;
+
+  if (!cw->staticDirty) {
+    if (l->isStatic) {
+      QuadTree_removeLine(cw->staticTree, l, cw->timeStep);
+      cw->numStaticLines--;
+      cw->staticEventsStale = true;
+    } else if (!l->asleep) {
+      last = cw->dynamicLines[--cw->numDynamicLines];
+      cw->dynamicLines[l->dynamicIndex] = last;
+      last->dynamicIndex = l->dynamicIndex;
+    }
+  }
+
+  l->slot = LINE_REMOVED;
+  l->isStatic = false;
+  l->asleep = false;
+  l->wakeFrame = 0;
+  l->wallDue = 0;
+  cw->freeIds[cw->numFreeIds++] = id;
+  return true;
+}
 
+// Readies the lines for the next frame's intersection detection: sorts out
+// the static lines if needed, wakes and puts lines to sleep, and sorts the
+// moving lines into the quadtree.
+static void build_frame_tree(CollisionWorld* cw) {
+  if (cw->staticDirty) {
+    rebuild_static(cw);
+  }
+  if (cw->staticEventsStale) {
+    filter_static_events(cw);
+    cw->staticEventsStale = false;
+  }
+  if (cw->adaptiveStepping) {
+    update_sleep(cw);
+  }
+  QuadTree_sortLines(cw->q, cw->dynamicLines, cw->numDynamicLines, cw->timeStep);
+  cw->treeBuilt = true;
+}
+
+// The moving lines are in the quadtree built for the next frame, and the
+// static lines in theirs.  The sleeping lines are in neither, so they are
+// brought up to date and scanned; those woken early are dropped from
+// sleepingLines first, in order, as they are in the quadtree.
+void CollisionWorld_runQueries(CollisionWorld* cw, SpatialQueryBatch* batch) {
+  if (!cw->treeBuilt) {
+    build_frame_tree(cw);
+  }
+
+  unsigned int asleep = cw->nextWake;
+  for (int i = cw->nextWake; i < cw->numSleepingLines; i++) {
+    Line* l = cw->sleepingLines[i];
+    if (l->asleep) {
+      flush_line(cw, l);
+      cw->sleepingLines[asleep++] = l;
+    }
+  }
+  cw->numSleepingLines = asleep;
+
+  QuadTree* trees[2] = {cw->q, cw->staticTree};
+  SpatialQueryBatch_run(batch, trees, cw->numStaticLines > 0 ? 2 : 1,
+                        cw->sleepingLines + cw->nextWake,
+                        cw->numSleepingLines - cw->nextWake);
+}
+
+inline void CollisionWorld_detectIntersection(CollisionWorld* cw) {
   // Use QuadTree to get line-line intersections
-  build_quadtree(cw);
-  QuadTree_detectEvents(cw->q, NULL, cw->timeStep, &ielr);
-  IntersectionEventList iel = REDUCER_VIEW(ielr);
+  INSTRUMENT_BEGIN(PHASE_BUILD_QUADTREE);
+  if (!cw->treeBuilt) {
+    build_frame_tree(cw);
+  }
+#ifdef WORKSPAN
+  INSTRUMENT_WORKSPAN(PHASE_BUILD_QUADTREE, cw->q->work, cw->q->span,
+                      cw->q->burdenedSpan);
+#endif
+  INSTRUMENT_END(PHASE_BUILD_QUADTREE);
+
+  INSTRUMENT_ADD(COUNTER_ESTIMATED_TESTS, cw->q->subtreeTests);
+  INSTRUMENT_BEGIN(PHASE_DETECT_EVENTS);
+  QuadTree_detectEvents(cw->q, NULL, cw->timeStep, &cw->events);
+  cw->treeBuilt = false;
+  if (cw->numStaticLines > 0) {
+    cilk_for (int i = 0; i < cw->numDynamicLines; i++) {
+      QuadTree_detectEventsWithLine(cw->staticTree, cw->dynamicLines[i],
+                                    cw->timeStep, &cw->events);
+    }
+  }
+#ifdef WORKSPAN
+  INSTRUMENT_WORKSPAN(PHASE_DETECT_EVENTS, cw->q->work, cw->q->span,
+                      cw->q->burdenedSpan);
+#endif
+  INSTRUMENT_END(PHASE_DETECT_EVENTS);
+  IntersectionEventList iel = IntersectionEventCollector_take(&cw->events);
+
+  // Static lines that touch stay touching, so their events recur every frame.
+  for (IntersectionEventNode* node = cw->staticEvents.head; node;
+       node = node->next) {
+    IntersectionEventList_appendNode(&iel, node->l1, node->l2,
+                                     node->intersectionType);
+  }
   cw->numLineLineCollisions += iel.count;
 
-  CILK_C_UNREGISTER_REDUCER(ielr);
-
   // Sort the intersection event list.
+  INSTRUMENT_BEGIN(PHASE_SORT_EVENTS);
   IntersectionEventNode* startNode = iel.head;
   while (startNode != NULL) {
     IntersectionEventNode* minNode = startNode;
@@ -189,15 +657,40 @@ inline void CollisionWorld_detectIntersection(CollisionWorld* cw) {
     }
     startNode = startNode->next;
   }
+  INSTRUMENT_END(PHASE_SORT_EVENTS);
+  if (cw->oracle) {
+    Oracle_checkEvents(cw->oracle, &iel);
+  }
 
   // Call the collision solver for each intersection event.
+  INSTRUMENT_BEGIN(PHASE_SOLVE);
   IntersectionEventNode* curNode = iel.head;
+  bool released = false;
 
   while (curNode) {
     CollisionWorld_collisionSolver(cw, curNode->l1, curNode->l2,
                                    curNode->intersectionType);
+
+    // A static line that was struck moves from this frame on; any other
+    // line may now reach a wall at a different pass.
+    if (!curNode->l1->isStatic) {
+      invalidate_wall_check(cw, curNode->l1);
+    } else if (line_is_moving(curNode->l1)) {
+      release_static(cw, curNode->l1);
+      released = true;
+    }
+    if (!curNode->l2->isStatic) {
+      invalidate_wall_check(cw, curNode->l2);
+    } else if (line_is_moving(curNode->l2)) {
+      release_static(cw, curNode->l2);
+      released = true;
+    }
     curNode = curNode->next;
   }
+  if (released) {
+    filter_static_events(cw);
+  }
+  INSTRUMENT_END(PHASE_SOLVE);
 
   IntersectionEventList_deleteNodes(&iel);
 }
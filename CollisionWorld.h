@@ -25,19 +25,102 @@
 #define COLLISIONWORLD_H_
 
 #include "./Line.h"
+#include "./CalendarQueue.h"
+#include "./Clearance.h"
 #include "./IntersectionDetection.h"
+#include "./IntersectionEventList.h"
+#include "./Oracle.h"
 #include "./Quadtree.h"
+#include "./SpatialQuery.h"
+
+// Lines are checked against the walls at least this often (in frames), however
+// far from a wall they are predicted to be.
+#define WALL_HORIZON (1 << 20)
+
+// With adaptive stepping, which lines may sleep is decided every SLEEP_EPOCH
+// frames, and only lines clear for at least SLEEP_MIN frames are put to sleep.
+#define SLEEP_EPOCH 16
+#define SLEEP_MIN 2
 
 struct CollisionWorld {
   // Time step used for simulation
   double timeStep;
 
-  // Container that holds all the lines as an array of Line* lines.
-  // This CollisionWorld owns the Line* lines.
+  // Container that holds all the lines as an array of Line* lines, in no
+  // particular order; line->slot is the index of each.  capacity is the
+  // length of this and the other per-line arrays, which grow as lines are
+  // added.  This CollisionWorld owns the Line* lines.
   Line** lines;
   unsigned int numOfLines;
-
+  unsigned int capacity;
+
+  // Every Line by its ID.  The IDs of removed lines wait in freeIds for
+  // later lines, and the Line of a removed line stays in byId to be reused
+  // with its ID.  So the lists that drop removed lines lazily (the wall
+  // queue, sleepingLines and clearance) never point at freed memory; a
+  // removed Line has slot LINE_REMOVED and reads as awake, not static and
+  // not due at any wall pass.
+  Line** byId;
+  unsigned int numIds;
+  unsigned int* freeIds;
+  unsigned int numFreeIds;
+
+  // The same lines split into moving and static (zero velocity) ones.
+  // Static lines are left out of the per-frame work and indexed once in
+  // staticTree, and the events among them, which repeat every frame, are
+  // kept in staticEvents.  A static line that is struck and starts moving
+  // is taken out of both and joins dynamicLines; everything is rebuilt
+  // only when staticDirty is set, before the first frame.  Lines added later
+  // join dynamicLines whatever their velocity.  staticLines holds the static
+  // lines as of the last rebuild, numStaticLines the number still in
+  // staticTree.  staticEventsStale is set when a static line was removed
+  // and its events are still to be dropped.
+  Line** dynamicLines;
+  unsigned int numDynamicLines;
+  Line** staticLines;
+  unsigned int numStaticLines;
+  QuadTree* staticTree;
+  IntersectionEventList staticEvents;
+  bool staticDirty;
+  bool staticEventsStale;
+
+  // Number of wall passes run so far, and the moving lines keyed by the
+  // earliest pass at which they could hit a wall.
+  unsigned int wallPass;
+  CalendarQueue* wallQueue;
+
+  // Adaptive stepping: moving lines that are clear of the walls and of
+  // every other line for a while are taken out of dynamicLines and sleep,
+  // sorted by wake frame, in sleepingLines.  Their skipped position updates
+  // are replayed when they wake or are read, so they end up exactly where
+  // stepping them every frame would have put them.  nextWake is the first
+  // of them still due to wake; numPositionUpdates counts the frames stepped.
+  bool adaptiveStepping;
+  Line** sleepingLines;
+  unsigned int numSleepingLines;
+  unsigned int nextWake;
+  int* sleepFrames;
+  Clearance* clearance;
+  unsigned int numPositionUpdates;
+
+  // Quadtree over the box, and the parameters shared by all its nodes.
+  // treeBuilt is set when the moving lines have been sorted into q for the
+  // next frame ahead of time, to answer spatial queries, and that frame can
+  // use the tree as it is.  Adding or removing lines, or changing the
+  // parameters, clears it.
+  QuadTreeParams params;
   QuadTree* q;
+  bool treeBuilt;
+
+  // Collects the events found in parallel, in a list per worker that is
+  // emptied every frame.
+  IntersectionEventCollector events;
+
+  // Differential validation: every validateEvery frames, starting with the
+  // first, the frame is also run by oracle and the results are compared.
+  // oracle is NULL when not validating.
+  unsigned int validateEvery;
+  Oracle* oracle;
 
   // Record the total number of line-wall collisions.
   unsigned int numLineWallCollisions;
@@ -47,6 +130,7 @@ struct CollisionWorld {
 };
 typedef struct CollisionWorld CollisionWorld;
 
+// Creates an empty box with room for capacity lines to start with.
 CollisionWorld* CollisionWorld_new(const unsigned int capacity);
 
 void CollisionWorld_delete(CollisionWorld* collisionWorld);
@@ -54,21 +138,61 @@ void CollisionWorld_delete(CollisionWorld* collisionWorld);
 // Return the total number of lines in the box.
 unsigned int CollisionWorld_getNumOfLines(CollisionWorld* collisionWorld);
 
-// Add a line into the box.  Must be under capacity.
-// This CollisionWorld becomes owner of the Line* line.
-void CollisionWorld_addLine(CollisionWorld* collisionWorld, Line *line);
+// Add a line into the box between frames, and return the ID it is given.
+// IDs of removed lines are reused.  This CollisionWorld becomes owner of
+// the Line* line, which it may free and replace by the Line of a removed
+// line; use CollisionWorld_getLineById to find it.
+unsigned int CollisionWorld_addLine(CollisionWorld* collisionWorld,
+                                    Line *line);
+
+// Remove the line with ID id from the box between frames.  Returns false if
+// there is no such line.
+bool CollisionWorld_removeLine(CollisionWorld* collisionWorld,
+                               const unsigned int id);
 
-// Get a line from box.
+// Get a line from box, by index from 0 to the number of lines.  Removing
+// a line changes the index of another one.
 Line* CollisionWorld_getLine(CollisionWorld* collisionWorld,
                              const unsigned int index);
 
+// Get the line with ID id, or NULL if there is none.
+Line* CollisionWorld_getLineById(CollisionWorld* collisionWorld,
+                                 const unsigned int id);
+
+// Get the parameters of the quadtree.
+const QuadTreeParams* CollisionWorld_getQuadTreeParams(
+    CollisionWorld* collisionWorld);
+
+// Set the parameters of the quadtree, rebuilding it if its depth changes.
+void CollisionWorld_setQuadTreeParams(CollisionWorld* collisionWorld,
+                                      const QuadTreeParams* params);
+
+// Turn adaptive stepping of isolated lines on or off.  The simulation is
+// the same either way.
+void CollisionWorld_setAdaptiveStepping(CollisionWorld* collisionWorld,
+                                        bool enabled);
+
+// Check every kth frame against a brute-force reference, or none if k is 0.
+// The first divergence is reported on stderr.  Checked frames take O(n^2)
+// time, but the simulation is the same.
+void CollisionWorld_setValidation(CollisionWorld* collisionWorld,
+                                  unsigned int k);
+
+// Get the reference the frames are checked against, or NULL if none are.
+const Oracle* CollisionWorld_getOracle(CollisionWorld* collisionWorld);
+
+// Answer the queries in batch against the lines where they are now, in
+// parallel.  The quadtree this builds is the one the next frame uses.
+void CollisionWorld_runQueries(CollisionWorld* collisionWorld,
+                               SpatialQueryBatch* batch);
+
 // Update lines' situation in the box.
 void CollisionWorld_updateLines(CollisionWorld* collisionWorld);
 
 // Update position of lines.
 void CollisionWorld_updatePosition(CollisionWorld* collisionWorld);
 
-// Handle line-wall collision.
+// Handle line-wall collision for the lines that may have reached a wall.
 void CollisionWorld_lineWallCollision(CollisionWorld* collisionWorld);
 
 // Detect line-line intersection.
@@ -0,0 +1,80 @@
+#include "./CommandPipe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COMMANDPIPE_BUFFER 4096
+
+struct CommandPipe {
+  int fd;
+  bool ownsFd;
+  // Bytes read but not yet returned are buffer[start] to buffer[end - 1].
+  char* buffer;
+  size_t start;
+  size_t end;
+  size_t capacity;
+};
+
+CommandPipe* CommandPipe_open(const char* path) {
+  bool isStdin = strcmp(path, "-") == 0;
+  int fd = isStdin ? STDIN_FILENO : open(path, O_RDONLY | O_NONBLOCK);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  if (isStdin) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  CommandPipe* cp = malloc(sizeof(CommandPipe));
+  cp->fd = fd;
+  cp->ownsFd = !isStdin;
+  cp->capacity = COMMANDPIPE_BUFFER;
+  cp->buffer = malloc(cp->capacity);
+  cp->start = 0;
+  cp->end = 0;
+  return cp;
+}
+
+void CommandPipe_close(CommandPipe* cp) {
+  if (cp->ownsFd) {
+    close(cp->fd);
+  }
+  free(cp->buffer);
+  free(cp);
+}
+
+char* CommandPipe_next(CommandPipe* cp) {
+  while (true) {
+    char* line = cp->buffer + cp->start;
+    char* newline = memchr(line, '\n', cp->end - cp->start);
+    if (newline) {
+      *newline = '\0';
+      cp->start = newline + 1 - cp->buffer;
+      return line;
+    }
+
+    // Keep the partial line at the front and read more after it.
+    memmove(cp->buffer, line, cp->end - cp->start);
+    cp->end -= cp->start;
+    cp->start = 0;
+    if (cp->end == cp->capacity) {
+      cp->capacity *= 2;
+      cp->buffer = realloc(cp->buffer, cp->capacity);
+    }
+    ssize_t n = read(cp->fd, cp->buffer + cp->end,
+                     cp->capacity - cp->end);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return NULL;  // nothing more for now, or no writer
+    }
+    cp->end += n;
+  }
+}
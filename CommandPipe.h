@@ -0,0 +1,21 @@
+#ifndef COMMANDPIPE_H_
+#define COMMANDPIPE_H_
+
+// Reads commands, one per line, from a pipe without blocking, so that the
+// simulation can apply whatever has arrived between two frames and carry
+// on.  A writer may come and go: until the pipe has a writer, and after it
+// closes the pipe, there are simply no commands.
+
+typedef struct CommandPipe CommandPipe;
+
+// Opens the file or named pipe at path, or standard input if path is "-".
+// Returns NULL on failure.
+CommandPipe* CommandPipe_open(const char* path);
+
+void CommandPipe_close(CommandPipe* commandPipe);
+
+// Returns the next complete line that has arrived, without its newline, or
+// NULL if there is none yet.  The line stays valid until the next call.
+char* CommandPipe_next(CommandPipe* commandPipe);
+
+#endif  // COMMANDPIPE_H_
@@ -0,0 +1,572 @@
+#include "./ContinuousWorld.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "./fasttime.h"
+#include "./IntersectionDetection.h"
+#include "./Line.h"
+
+// The most cells along a side of the grid.
+#define GRID_MAX 512
+
+// The b of a contact with a wall.
+#define WALL UINT_MAX
+
+// A predicted contact between lines a < b, or of line a with a wall across
+// axis 0 (x) or 1 (y), at the given time of the step.  It holds if neither
+// line's version has changed since.
+typedef struct {
+  double time;
+  unsigned int a, b;
+  unsigned int versionA, versionB;
+  IntersectionType type;
+  int axis;
+} Contact;
+
+typedef struct {
+  double since;            // time of the step the line's position is at
+  unsigned int version;    // bumped whenever the velocity changes
+  unsigned int contacts;   // line-line contacts this step
+  unsigned int stamp;      // last candidate search that found the line
+  int cx0, cx1, cy0, cy1;  // the cells the line is in
+  double lx, ux, ly, uy;   // the box of its path over the rest of the step
+} LineState;
+
+typedef struct {
+  unsigned int* lines;
+  unsigned int count, capacity;
+} Cell;
+
+struct ContinuousWorld {
+  int framesPerStep;
+  double timeStep;
+  Line* lines;
+  LineState* states;
+  unsigned int numLines;
+
+  // The time at which the current step ends.
+  double end;
+
+  // A binary min-heap of contacts by time.
+  Contact* heap;
+  unsigned int heapSize, heapCapacity;
+
+  // The grid of g x g cells over the box, and the latest candidate search.
+  Cell* cells;
+  int g, cellCapacity;
+  unsigned int stamp;
+
+  unsigned int numSteps;
+  unsigned int numLineWallCollisions;
+  unsigned int numLineLineCollisions;
+  unsigned long numPredictions;
+  unsigned long numStale;
+  unsigned long numCapped;
+  Histogram stepLatency;
+};
+
+static int compare_ids(const void* a, const void* b) {
+  return compareLines((Line*) a, (Line*) b);
+}
+
+ContinuousWorld* ContinuousWorld_new(CollisionWorld* collisionWorld,
+                                     int framesPerStep) {
+  if (framesPerStep <= 0) {
+    return NULL;
+  }
+  ContinuousWorld* w = malloc(sizeof(ContinuousWorld));
+  if (w == NULL) {
+    return NULL;
+  }
+  unsigned int n = CollisionWorld_getNumOfLines(collisionWorld);
+  w->framesPerStep = framesPerStep;
+  w->timeStep = collisionWorld->timeStep;
+  w->lines = malloc(n * sizeof(Line));
+  w->states = calloc(n, sizeof(LineState));
+  assert(n == 0 || (w->lines && w->states));
+  w->numLines = n;
+  for (unsigned int i = 0; i < n; i++) {
+    w->lines[i] = *CollisionWorld_getLine(collisionWorld, i);
+  }
+  qsort(w->lines, n, sizeof(Line), compare_ids);
+
+  w->end = 0;
+  w->heap = NULL;
+  w->heapSize = w->heapCapacity = 0;
+  w->cells = NULL;
+  w->g = w->cellCapacity = 0;
+  w->stamp = 0;
+  w->numSteps = 0;
+  w->numLineWallCollisions = 0;
+  w->numLineLineCollisions = 0;
+  w->numPredictions = 0;
+  w->numStale = 0;
+  w->numCapped = 0;
+  Histogram_init(&w->stepLatency);
+  return w;
+}
+
+void ContinuousWorld_delete(ContinuousWorld* continuousWorld) {
+  for (int c = 0; c < continuousWorld->cellCapacity; c++) {
+    free(continuousWorld->cells[c].lines);
+  }
+  free(continuousWorld->cells);
+  free(continuousWorld->heap);
+  free(continuousWorld->lines);
+  free(continuousWorld->states);
+  free(continuousWorld);
+}
+
+// Contacts come out by time, and those at the same time by line index.
+static inline bool earlier(const Contact* x, const Contact* y) {
+  if (x->time != y->time) {
+    return x->time < y->time;
+  }
+  if (x->a != y->a) {
+    return x->a < y->a;
+  }
+  return x->b < y->b;
+}
+
+static void heap_insert(ContinuousWorld* w, Contact c) {
+  if (w->heapSize == w->heapCapacity) {
+    w->heapCapacity = MAX(1024, 2 * w->heapCapacity);
+    w->heap = realloc(w->heap, w->heapCapacity * sizeof(Contact));
+    assert(w->heap != NULL);
+  }
+  unsigned int k = w->heapSize++;
+  while (k > 0 && earlier(&c, &w->heap[(k - 1) / 2])) {
+    w->heap[k] = w->heap[(k - 1) / 2];
+    k = (k - 1) / 2;
+  }
+  w->heap[k] = c;
+}
+
+static void heap_push(ContinuousWorld* w, Contact c) {
+  heap_insert(w, c);
+  w->numPredictions++;
+}
+
+static Contact heap_pop(ContinuousWorld* w) {
+  Contact top = w->heap[0];
+  Contact last = w->heap[--w->heapSize];
+  unsigned int k = 0;
+  while (true) {
+    unsigned int child = 2 * k + 1;
+    if (child >= w->heapSize) {
+      break;
+    }
+    if (child + 1 < w->heapSize &&
+        earlier(&w->heap[child + 1], &w->heap[child])) {
+      child++;
+    }
+    if (!earlier(&w->heap[child], &last)) {
+      break;
+    }
+    w->heap[k] = w->heap[child];
+    k = child;
+  }
+  w->heap[k] = last;
+  return top;
+}
+
+// Moves line i to time t of the step.
+static inline void advance(ContinuousWorld* w, unsigned int i, double t) {
+  Line* l = &w->lines[i];
+  double dt = t - w->states[i].since;
+  if (dt != 0) {
+    step_line(l, dt);
+    w->states[i].since = t;
+  }
+}
+
+// The endpoints of line i at time t of the step.
+static inline void position_at(const ContinuousWorld* w, unsigned int i,
+                               double t, Vec* p1, Vec* p2) {
+  const Line* l = &w->lines[i];
+  double dt = t - w->states[i].since;
+  p1->x = l->p1.x + l->velocity.x * dt;
+  p1->y = l->p1.y + l->velocity.y * dt;
+  p2->x = l->p2.x + l->velocity.x * dt;
+  p2->y = l->p2.y + l->velocity.y * dt;
+}
+
+static inline int cell_of(const ContinuousWorld* w, double v, double origin) {
+  double c = floor((v - origin) * w->g / ((double) BOX_XMAX - BOX_XMIN));
+  return c < 0 ? 0 : c >= w->g ? w->g - 1 : (int) c;
+}
+
+static void cell_add(Cell* cell, unsigned int i) {
+  if (cell->count == cell->capacity) {
+    cell->capacity = MAX(8, 2 * cell->capacity);
+    cell->lines = realloc(cell->lines, cell->capacity * sizeof(unsigned int));
+    assert(cell->lines != NULL);
+  }
+  cell->lines[cell->count++] = i;
+}
+
+static void cell_remove(Cell* cell, unsigned int i) {
+  for (unsigned int k = 0; k < cell->count; k++) {
+    if (cell->lines[k] == i) {
+      cell->lines[k] = cell->lines[--cell->count];
+      return;
+    }
+  }
+}
+
+// Puts line i into the cells its path over the rest of the step crosses.
+static void grid_insert(ContinuousWorld* w, unsigned int i) {
+  LineState* s = &w->states[i];
+  Vec p1, p2, q1, q2;
+  position_at(w, i, s->since, &p1, &p2);
+  position_at(w, i, w->end, &q1, &q2);
+  s->lx = MIN(MIN(p1.x, p2.x), MIN(q1.x, q2.x));
+  s->ux = MAX(MAX(p1.x, p2.x), MAX(q1.x, q2.x));
+  s->ly = MIN(MIN(p1.y, p2.y), MIN(q1.y, q2.y));
+  s->uy = MAX(MAX(p1.y, p2.y), MAX(q1.y, q2.y));
+  s->cx0 = cell_of(w, s->lx, BOX_XMIN);
+  s->cx1 = cell_of(w, s->ux, BOX_XMIN);
+  s->cy0 = cell_of(w, s->ly, BOX_YMIN);
+  s->cy1 = cell_of(w, s->uy, BOX_YMIN);
+  for (int y = s->cy0; y <= s->cy1; y++) {
+    for (int x = s->cx0; x <= s->cx1; x++) {
+      cell_add(&w->cells[y * w->g + x], i);
+    }
+  }
+}
+
+static void grid_remove(ContinuousWorld* w, unsigned int i) {
+  const LineState* s = &w->states[i];
+  for (int y = s->cy0; y <= s->cy1; y++) {
+    for (int x = s->cx0; x <= s->cx1; x++) {
+      cell_remove(&w->cells[y * w->g + x], i);
+    }
+  }
+}
+
+// Sizes the grid for the paths of the lines over a step of the given
+// length, and puts every line in it.
+static void grid_build(ContinuousWorld* w, double duration) {
+  double extent = 0;
+  for (unsigned int i = 0; i < w->numLines; i++) {
+    const Line* l = &w->lines[i];
+    double dx = fabs(l->p1.x - l->p2.x) + fabs(l->velocity.x) * duration;
+    double dy = fabs(l->p1.y - l->p2.y) + fabs(l->velocity.y) * duration;
+    extent += MAX(dx, dy);
+  }
+  extent = w->numLines > 0 ? extent / w->numLines : 1;
+  // Cells about twice the size of a mean path hold few lines each, and
+  // most paths cross few cells.  More than about four cells per line would
+  // mostly be empty, and still have to be cleared every step.
+  double size = ((double) BOX_XMAX - BOX_XMIN) / (2 * extent);
+  size = MIN(size, 2 * sqrt((double) w->numLines));
+  w->g = size < 1 ? 1 : size > GRID_MAX ? GRID_MAX : (int) size;
+  int numCells = w->g * w->g;
+  if (numCells > w->cellCapacity) {
+    w->cells = realloc(w->cells, numCells * sizeof(Cell));
+    assert(w->cells != NULL);
+    for (int c = w->cellCapacity; c < numCells; c++) {
+      w->cells[c].lines = NULL;
+      w->cells[c].capacity = 0;
+    }
+    w->cellCapacity = numCells;
+  }
+  for (int c = 0; c < numCells; c++) {
+    w->cells[c].count = 0;
+  }
+  for (unsigned int i = 0; i < w->numLines; i++) {
+    grid_insert(w, i);
+  }
+}
+
+static inline bool paths_overlap(const LineState* a, const LineState* b) {
+  return a->lx <= b->ux && a->ux >= b->lx && a->ly <= b->uy && a->uy >= b->ly;
+}
+
+// Calls visit(w, i, j, now, skip) once for every other line j whose path
+// over the rest of the step may meet line i's.
+static void for_candidates(ContinuousWorld* w, unsigned int i, double now,
+                           unsigned int skip,
+                           void (*visit)(ContinuousWorld*, unsigned int,
+                                         unsigned int, double, unsigned int)) {
+  unsigned int stamp = ++w->stamp;
+  const LineState* s = &w->states[i];
+  w->states[i].stamp = stamp;
+  for (int y = s->cy0; y <= s->cy1; y++) {
+    for (int x = s->cx0; x <= s->cx1; x++) {
+      const Cell* cell = &w->cells[y * w->g + x];
+      for (unsigned int k = 0; k < cell->count; k++) {
+        unsigned int j = cell->lines[k];
+        if (w->states[j].stamp != stamp) {
+          w->states[j].stamp = stamp;
+          if (paths_overlap(s, &w->states[j])) {
+            visit(w, i, j, now, skip);
+          }
+        }
+      }
+    }
+  }
+}
+
+// The time within horizon after which point p, moving at velocity v, first
+// reaches the segment q1 q2 while approaching it, if it does.
+static inline bool endpoint_hits(Vec p, Vec v, Vec q1, Vec q2,
+                                 double horizon, double* when) {
+  double dx = q2.x - q1.x;
+  double dy = q2.y - q1.y;
+  double s0 = crossProduct(dx, dy, p.x - q1.x, p.y - q1.y);
+  double s1 = crossProduct(dx, dy, v.x, v.y);
+  if (s0 == 0 || s1 == 0 || (s0 > 0) == (s1 > 0)) {
+    return false;
+  }
+  double t = -s0 / s1;
+  if (t > horizon) {
+    return false;
+  }
+  double u = (p.x + v.x * t - q1.x) * dx + (p.y + v.y * t - q1.y) * dy;
+  if (u < 0 || u > dx * dx + dy * dy) {
+    return false;
+  }
+  *when = t;
+  return true;
+}
+
+// Predicts when line i first reaches a wall while moving towards it.
+static void predict_wall(ContinuousWorld* w, unsigned int i, double now) {
+  const Line* l = &w->lines[i];
+  Vec p1, p2;
+  position_at(w, i, now, &p1, &p2);
+  double best = INFINITY;
+  int axis = 0;
+  if (l->velocity.x != 0) {
+    double edge = l->velocity.x > 0 ? BOX_XMAX - MAX(p1.x, p2.x) :
+        BOX_XMIN - MIN(p1.x, p2.x);
+    best = MAX(0, edge / l->velocity.x);
+  }
+  if (l->velocity.y != 0) {
+    double edge = l->velocity.y > 0 ? BOX_YMAX - MAX(p1.y, p2.y) :
+        BOX_YMIN - MIN(p1.y, p2.y);
+    double t = MAX(0, edge / l->velocity.y);
+    if (t < best) {
+      best = t;
+      axis = 1;
+    }
+  }
+  if (now + best <= w->end) {
+    Contact c = {now + best, i, WALL, w->states[i].version, 0,
+                 NO_INTERSECTION, axis};
+    heap_push(w, c);
+  }
+}
+
+// Predicts the first contact between lines i and j, whichever is lower,
+// unless j is skip.
+static void predict_pair(ContinuousWorld* w, unsigned int i, unsigned int j,
+                         double now, unsigned int skip) {
+  if (j == skip) {
+    return;
+  }
+  unsigned int a = MIN(i, j);
+  unsigned int b = MAX(i, j);
+  Vec a1, a2, b1, b2;
+  position_at(w, a, now, &a1, &a2);
+  position_at(w, b, now, &b1, &b2);
+
+  // The motion of b as seen from a, and of a as seen from b.
+  Vec v = {w->lines[b].velocity.x - w->lines[a].velocity.x,
+           w->lines[b].velocity.y - w->lines[a].velocity.y};
+  Vec back = {-v.x, -v.y};
+  double horizon = w->end - now;
+  double best = INFINITY;
+  double t;
+  IntersectionType type = NO_INTERSECTION;
+  if (endpoint_hits(a1, back, b1, b2, horizon, &t) && t < best) {
+    best = t;
+    type = L1_WITH_L2;
+  }
+  if (endpoint_hits(a2, back, b1, b2, horizon, &t) && t < best) {
+    best = t;
+    type = L1_WITH_L2;
+  }
+  if (endpoint_hits(b1, v, a1, a2, horizon, &t) && t < best) {
+    best = t;
+    type = L2_WITH_L1;
+  }
+  if (endpoint_hits(b2, v, a1, a2, horizon, &t) && t < best) {
+    best = t;
+    type = L2_WITH_L1;
+  }
+  // Lines that cross now are pushed apart at the start of the next step.
+  if (type == NO_INTERSECTION || intersectLines(a1, a2, b1, b2)) {
+    return;
+  }
+  if (w->states[a].contacts >= CONTINUOUS_MAX_CONTACTS ||
+      w->states[b].contacts >= CONTINUOUS_MAX_CONTACTS) {
+    w->numCapped++;
+    return;
+  }
+  Contact c = {now + best, a, b, w->states[a].version, w->states[b].version,
+               type, 0};
+  heap_push(w, c);
+}
+
+static void predict_later(ContinuousWorld* w, unsigned int i, unsigned int j,
+                          double now, unsigned int skip) {
+  if (j > i) {
+    predict_pair(w, i, j, now, skip);
+  }
+}
+
+// Finds, after line i's velocity changed at time now, its new contacts,
+// leaving out any with line skip.
+static void repredict(ContinuousWorld* w, unsigned int i, double now,
+                      unsigned int skip) {
+  predict_wall(w, i, now);
+  for_candidates(w, i, now, skip, predict_pair);
+}
+
+static void record_crossing(ContinuousWorld* w, unsigned int i,
+                            unsigned int j, double now, unsigned int skip) {
+  (void) now;
+  (void) skip;
+  if (j > i && intersectLines(w->lines[i].p1, w->lines[i].p2,
+                              w->lines[j].p1, w->lines[j].p2)) {
+    Contact c = {0, i, j, 0, 0, ALREADY_INTERSECTED, 0};
+    heap_insert(w, c);
+  }
+}
+
+// Runs one step of the given length.
+static void run_step(ContinuousWorld* w, double duration) {
+  w->end = duration;
+  for (unsigned int i = 0; i < w->numLines; i++) {
+    w->states[i].since = 0;
+    w->states[i].contacts = 0;
+  }
+  grid_build(w, duration);
+
+  // Lines that cross are pushed apart first, in ID order as in a frame.
+  w->heapSize = 0;
+  for (unsigned int i = 0; i < w->numLines; i++) {
+    for_candidates(w, i, 0, WALL, record_crossing);
+  }
+  while (w->heapSize > 0) {
+    Contact c = heap_pop(w);
+    CollisionWorld_collisionSolver(NULL, &w->lines[c.a], &w->lines[c.b],
+                                   ALREADY_INTERSECTED);
+    w->numLineLineCollisions++;
+    for (int k = 0; k < 2; k++) {
+      unsigned int i = k == 0 ? c.a : c.b;
+      grid_remove(w, i);
+      grid_insert(w, i);
+    }
+  }
+
+  for (unsigned int i = 0; i < w->numLines; i++) {
+    predict_wall(w, i, 0);
+    for_candidates(w, i, 0, WALL, predict_later);
+  }
+
+  while (w->heapSize > 0) {
+    Contact c = heap_pop(w);
+    if (c.versionA != w->states[c.a].version ||
+        (c.b != WALL && c.versionB != w->states[c.b].version)) {
+      w->numStale++;
+      continue;
+    }
+    advance(w, c.a, c.time);
+    w->states[c.a].version++;
+    if (c.b == WALL) {
+      Line* l = &w->lines[c.a];
+      if (c.axis == 0) {
+        l->velocity.x = -l->velocity.x;
+      } else {
+        l->velocity.y = -l->velocity.y;
+      }
+      w->numLineWallCollisions++;
+      grid_remove(w, c.a);
+      grid_insert(w, c.a);
+      repredict(w, c.a, c.time, WALL);
+      continue;
+    }
+
+    advance(w, c.b, c.time);
+    w->states[c.b].version++;
+    // The solver keeps no state in the CollisionWorld.
+    CollisionWorld_collisionSolver(NULL, &w->lines[c.a], &w->lines[c.b],
+                                   c.type);
+    w->numLineLineCollisions++;
+    w->states[c.a].contacts++;
+    w->states[c.b].contacts++;
+    grid_remove(w, c.a);
+    grid_insert(w, c.a);
+    grid_remove(w, c.b);
+    grid_insert(w, c.b);
+    repredict(w, c.a, c.time, WALL);
+    repredict(w, c.b, c.time, c.a);
+  }
+
+  for (unsigned int i = 0; i < w->numLines; i++) {
+    advance(w, i, duration);
+  }
+  w->numSteps++;
+}
+
+void ContinuousWorld_run(ContinuousWorld* continuousWorld,
+                         unsigned int numFrames) {
+  ContinuousWorld* w = continuousWorld;
+  for (unsigned int done = 0; done < numFrames; done += w->framesPerStep) {
+    unsigned int frames = MIN(numFrames - done, (unsigned int) w->framesPerStep);
+    fasttime_t start = gettime();
+    run_step(w, frames * w->timeStep);
+    Histogram_record(&w->stepLatency,
+                     (uint64_t) (tdiff(start, gettime()) * 1e9));
+  }
+}
+
+void ContinuousWorld_copyLines(ContinuousWorld* continuousWorld,
+                               CollisionWorld* collisionWorld) {
+  for (unsigned int i = 0; i < continuousWorld->numLines; i++) {
+    Line* from = &continuousWorld->lines[i];
+    Line* to = CollisionWorld_getLineById(collisionWorld, from->id);
+    to->p1 = from->p1;
+    to->p2 = from->p2;
+    to->velocity = from->velocity;
+  }
+}
+
+unsigned int ContinuousWorld_getNumLineWallCollisions(
+    ContinuousWorld* continuousWorld) {
+  return continuousWorld->numLineWallCollisions;
+}
+
+unsigned int ContinuousWorld_getNumLineLineCollisions(
+    ContinuousWorld* continuousWorld) {
+  return continuousWorld->numLineLineCollisions;
+}
+
+unsigned int ContinuousWorld_getNumSteps(ContinuousWorld* continuousWorld) {
+  return continuousWorld->numSteps;
+}
+
+unsigned long ContinuousWorld_getNumPredictions(
+    ContinuousWorld* continuousWorld) {
+  return continuousWorld->numPredictions;
+}
+
+unsigned long ContinuousWorld_getNumStale(ContinuousWorld* continuousWorld) {
+  return continuousWorld->numStale;
+}
+
+unsigned long ContinuousWorld_getNumCapped(ContinuousWorld* continuousWorld) {
+  return continuousWorld->numCapped;
+}
+
+const Histogram* ContinuousWorld_getStepLatency(
+    ContinuousWorld* continuousWorld) {
+  return &continuousWorld->stepLatency;
+}
@@ -0,0 +1,69 @@
+#ifndef CONTINUOUSWORLD_H_
+#define CONTINUOUSWORLD_H_
+
+// The simulation stepped from contact to contact instead of frame by frame.
+//
+// Each step spans several frames' worth of time.  At its start, lines whose
+// segments cross are pushed apart as in a frame.  Then, for every pair of
+// lines whose paths over the step may meet, the time at which an endpoint of
+// one first reaches the other is predicted, and likewise the time each line
+// reaches a wall, and the contacts go into a priority queue by time.  The
+// earliest contact is taken out, its lines are moved to that time and
+// solved, and only those lines are predicted again from there.  Each line
+// carries a version, bumped whenever its velocity changes, so contacts
+// predicted from an older velocity are recognised and dropped when they come
+// out of the queue.  The candidates for a line are found in a uniform grid
+// over the box, in every cell its path over the rest of the step crosses.
+//
+// Contacts happen at the time they would, rather than at the end of the
+// frame in which lines were found to cross, so the counts and positions
+// differ from those of a CollisionWorld.  A line takes part in at most
+// CONTINUOUS_MAX_CONTACTS line-line contacts per step, which keeps lines
+// trapped between others from taking up the whole step.  Static lines and
+// adaptive stepping are not used.
+
+#include "./CollisionWorld.h"
+#include "./Histogram.h"
+
+#define CONTINUOUS_MAX_CONTACTS 16
+
+typedef struct ContinuousWorld ContinuousWorld;
+
+// Copies the lines of collisionWorld, which must not have run a frame yet,
+// to be simulated in steps of framesPerStep frames.  Returns NULL if
+// framesPerStep is not positive.
+ContinuousWorld* ContinuousWorld_new(CollisionWorld* collisionWorld,
+                                     int framesPerStep);
+
+void ContinuousWorld_delete(ContinuousWorld* continuousWorld);
+
+// Simulates the time of numFrames frames, in as many steps as that takes;
+// the last one may be shorter.  Records how long each step takes.
+void ContinuousWorld_run(ContinuousWorld* continuousWorld,
+                         unsigned int numFrames);
+
+// Copies the positions and velocities of the lines back into
+// collisionWorld, the one the ContinuousWorld was made from.
+void ContinuousWorld_copyLines(ContinuousWorld* continuousWorld,
+                               CollisionWorld* collisionWorld);
+
+unsigned int ContinuousWorld_getNumLineWallCollisions(
+    ContinuousWorld* continuousWorld);
+
+unsigned int ContinuousWorld_getNumLineLineCollisions(
+    ContinuousWorld* continuousWorld);
+
+// Get the number of steps run, of contacts predicted, of those dropped as
+// out of date, and of line-line contacts not predicted because a line had
+// reached CONTINUOUS_MAX_CONTACTS.
+unsigned int ContinuousWorld_getNumSteps(ContinuousWorld* continuousWorld);
+unsigned long ContinuousWorld_getNumPredictions(
+    ContinuousWorld* continuousWorld);
+unsigned long ContinuousWorld_getNumStale(ContinuousWorld* continuousWorld);
+unsigned long ContinuousWorld_getNumCapped(ContinuousWorld* continuousWorld);
+
+// Get the histogram of step latencies, in nanoseconds.
+const Histogram* ContinuousWorld_getStepLatency(
+    ContinuousWorld* continuousWorld);
+
+#endif  // CONTINUOUSWORLD_H_
@@ -0,0 +1,226 @@
+#include "./FrameWriter.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./Line.h"
+#include "./Raster.h"
+#include "./Snapshot.h"
+
+#define NUM_SLOTS (FRAMEWRITER_ENCODERS * FRAMEWRITER_QUEUE)
+
+// A snapshot on its way to a file.
+typedef struct {
+  Snapshot snapshot;
+  unsigned int image;
+} Slot;
+
+struct FrameWriter {
+  char* pattern;
+  unsigned int every;
+  unsigned int numFrames;  // frames offered
+  unsigned int numImages;  // snapshots taken
+
+  Slot slots[NUM_SLOTS];
+  // Slots waiting to be encoded, oldest first, and slots free to fill.
+  int pendingSlots[NUM_SLOTS];
+  int pendingHead;
+  int numPending;
+  int freeSlots[NUM_SLOTS];
+  int numFree;
+  bool closing;
+  bool failed;
+  pthread_mutex_t lock;
+  pthread_cond_t slotPending;
+  pthread_cond_t slotFree;
+
+  pthread_t encoders[FRAMEWRITER_ENCODERS];
+  int numEncoders;
+};
+
+static void encode(FrameWriter* fw, Raster* raster, Segment* red,
+                   Segment* gray, const Slot* slot) {
+  int numRed;
+  int numGray;
+  Snapshot_toSegments(&slot->snapshot, red, &numRed, gray, &numGray);
+  Raster_clear(raster, RASTER_BACKGROUND);
+  Raster_drawSegments(raster, red, numRed, RASTER_RED);
+  Raster_drawSegments(raster, gray, numGray, RASTER_GRAY);
+
+  char path[FILENAME_MAX];
+  snprintf(path, sizeof(path), fw->pattern, (int) slot->image);
+  if (!Raster_writePPM(raster, path)) {
+    pthread_mutex_lock(&fw->lock);
+    if (!fw->failed) {
+      perror(path);
+    }
+    fw->failed = true;
+    pthread_mutex_unlock(&fw->lock);
+  }
+}
+
+static void* encoder_main(void* arg) {
+  FrameWriter* fw = arg;
+  Raster* raster = Raster_new(WINDOW_WIDTH, WINDOW_HEIGHT);
+  Segment* red = NULL;
+  Segment* gray = NULL;
+  unsigned int capacity = 0;
+
+  pthread_mutex_lock(&fw->lock);
+  while (true) {
+    while (fw->numPending == 0 && !fw->closing) {
+      pthread_cond_wait(&fw->slotPending, &fw->lock);
+    }
+    if (fw->numPending == 0) {
+      break;
+    }
+    int s = fw->pendingSlots[fw->pendingHead];
+    fw->pendingHead = (fw->pendingHead + 1) % NUM_SLOTS;
+    fw->numPending--;
+    pthread_mutex_unlock(&fw->lock);
+
+    Slot* slot = &fw->slots[s];
+    if (slot->snapshot.numLines > capacity) {
+      capacity = slot->snapshot.numLines;
+      free(red);
+      free(gray);
+      red = malloc(capacity * sizeof(Segment));
+      gray = malloc(capacity * sizeof(Segment));
+    }
+    if (raster == NULL || red == NULL || gray == NULL) {
+      fprintf(stderr, "FrameWriter: out of memory\n");
+      exit(-1);
+    }
+    encode(fw, raster, red, gray, slot);
+
+    pthread_mutex_lock(&fw->lock);
+    fw->freeSlots[fw->numFree++] = s;
+    pthread_cond_signal(&fw->slotFree);
+  }
+  pthread_mutex_unlock(&fw->lock);
+
+  free(red);
+  free(gray);
+  if (raster) {
+    Raster_delete(raster);
+  }
+  return NULL;
+}
+
+// Whether pattern is safe to pass to printf with the image number: it must
+// hold exactly one conversion, of an int, with optional flags, width and
+// precision, and may hold any number of %%.
+static bool pattern_valid(const char* pattern) {
+  int conversions = 0;
+  for (const char* c = pattern; *c; c++) {
+    if (*c != '%') {
+      continue;
+    }
+    c++;
+    if (*c == '%') {
+      continue;
+    }
+    c += strspn(c, "-+ #0");
+    c += strspn(c, "0123456789");
+    if (*c == '.') {
+      c++;
+      c += strspn(c, "0123456789");
+    }
+    if (*c == '\0' || strchr("diouxX", *c) == NULL) {
+      return false;
+    }
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+FrameWriter* FrameWriter_new(const char* pattern, unsigned int every) {
+  if (!pattern_valid(pattern)) {
+    fprintf(stderr, "FrameWriter: %s must hold exactly one integer"
+            " conversion, such as %%05d\n", pattern);
+    return NULL;
+  }
+  FrameWriter* fw = malloc(sizeof(FrameWriter));
+  if (fw == NULL) {
+    return NULL;
+  }
+  fw->pattern = strdup(pattern);
+  fw->every = every > 0 ? every : 1;
+  fw->numFrames = 0;
+  fw->numImages = 0;
+  for (int i = 0; i < NUM_SLOTS; i++) {
+    Snapshot_init(&fw->slots[i].snapshot);
+    fw->freeSlots[i] = i;
+  }
+  fw->pendingHead = 0;
+  fw->numPending = 0;
+  fw->numFree = NUM_SLOTS;
+  fw->closing = false;
+  fw->failed = false;
+  pthread_mutex_init(&fw->lock, NULL);
+  pthread_cond_init(&fw->slotPending, NULL);
+  pthread_cond_init(&fw->slotFree, NULL);
+
+  for (fw->numEncoders = 0; fw->numEncoders < FRAMEWRITER_ENCODERS;
+       fw->numEncoders++) {
+    if (pthread_create(&fw->encoders[fw->numEncoders], NULL, encoder_main,
+                       fw) != 0) {
+      break;
+    }
+  }
+  if (fw->numEncoders == 0) {
+    FrameWriter_close(fw);
+    return NULL;
+  }
+  return fw;
+}
+
+bool FrameWriter_close(FrameWriter* fw) {
+  pthread_mutex_lock(&fw->lock);
+  fw->closing = true;
+  pthread_cond_broadcast(&fw->slotPending);
+  pthread_mutex_unlock(&fw->lock);
+  for (int i = 0; i < fw->numEncoders; i++) {
+    pthread_join(fw->encoders[i], NULL);
+  }
+
+  bool ok = !fw->failed;
+  for (int i = 0; i < NUM_SLOTS; i++) {
+    Snapshot_destroy(&fw->slots[i].snapshot);
+  }
+  pthread_mutex_destroy(&fw->lock);
+  pthread_cond_destroy(&fw->slotPending);
+  pthread_cond_destroy(&fw->slotFree);
+  free(fw->pattern);
+  free(fw);
+  return ok;
+}
+
+void FrameWriter_frame(FrameWriter* fw, CollisionWorld* collisionWorld) {
+  if (fw->numFrames++ % fw->every != 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&fw->lock);
+  while (fw->numFree == 0) {
+    pthread_cond_wait(&fw->slotFree, &fw->lock);
+  }
+  int s = fw->freeSlots[--fw->numFree];
+  pthread_mutex_unlock(&fw->lock);
+
+  // The slot belongs to this thread until it is queued.
+  Snapshot_capture(&fw->slots[s].snapshot, collisionWorld);
+  fw->slots[s].image = fw->numImages++;
+
+  pthread_mutex_lock(&fw->lock);
+  fw->pendingSlots[(fw->pendingHead + fw->numPending) % NUM_SLOTS] = s;
+  fw->numPending++;
+  pthread_cond_signal(&fw->slotPending);
+  pthread_mutex_unlock(&fw->lock);
+}
+
+unsigned int FrameWriter_numImages(const FrameWriter* fw) {
+  return fw->numImages;
+}
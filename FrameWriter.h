@@ -0,0 +1,39 @@
+#ifndef FRAMEWRITER_H_
+#define FRAMEWRITER_H_
+
+// Writes frames of the simulation as a sequence of PPM images, without an X
+// display.
+//
+// The simulation thread only takes a snapshot of every kth frame.  A pool of
+// encoder threads draws the snapshots with the software rasteriser and
+// writes them out.  At most FRAMEWRITER_QUEUE snapshots per encoder are in
+// flight; when all of them are, the simulation waits for an encoder to
+// finish one, so no frame is dropped.
+
+#include <stdbool.h>
+
+#include "./CollisionWorld.h"
+
+#define FRAMEWRITER_ENCODERS 4
+#define FRAMEWRITER_QUEUE 2
+
+typedef struct FrameWriter FrameWriter;
+
+// Writes every kth frame to a file named by the printf pattern, which takes
+// the number of the image, counting from 0; for example frames/%05d.ppm.
+// Returns NULL if the pattern does not hold exactly one integer conversion
+// (%% aside) or if the encoder threads cannot be started.
+FrameWriter* FrameWriter_new(const char* pattern, unsigned int every);
+
+// Waits for the frames in flight to be written and stops the encoders.
+// Returns whether every frame was written.
+bool FrameWriter_close(FrameWriter* frameWriter);
+
+// Offers the current frame of collisionWorld.
+void FrameWriter_frame(FrameWriter* frameWriter,
+                       CollisionWorld* collisionWorld);
+
+// The number of images handed to the encoders so far.
+unsigned int FrameWriter_numImages(const FrameWriter* frameWriter);
+
+#endif  // FRAMEWRITER_H_
@@ -22,17 +22,39 @@
 
 #include "./GraphicStuff.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
+#include "./AllocProfile.h"
 #include "./Line.h"
 #include "./LineDemo.h"
+#include "./Snapshot.h"
 
 static LineDemo *gLineDemo = NULL;
-XSegment *segments = NULL;
-XSegment *gray_segments = NULL;
-
+Segment *segments = NULL;
+Segment *gray_segments = NULL;
+static unsigned int segmentsCapacity = 0;
+
+// The simulation thread fills snapshots[fillIndex] after each frame and then
+// swaps it with snapshots[readyIndex], the latest complete frame.  The render
+// thread swaps that with snapshots[drawIndex] when it is ready for another
+// frame, so neither thread ever waits for the other to finish a frame.
+static Snapshot snapshots[3];
+static int fillIndex = 0;
+static int readyIndex = 1;
+static int drawIndex = 2;
+static bool snapshotFresh = false;
+static bool simulationDone = false;
+static pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshotPublished = PTHREAD_COND_INITIALIZER;
+
+// How long the render thread waits for a frame before it handles window
+// events and repaints the last one anyway, in milliseconds.
+#define RENDER_IDLE_MS 50
 
 Display *display;
 
@@ -47,68 +69,53 @@ int visibility;
 int windowwidth;
 int windowheight;
 
-static void drawLineSegments(Display *display, Drawable drawable) {
-  Line *line;
-  unsigned int nsegments;
-  window_dimension px1;
-  window_dimension py1;
-  window_dimension px2;
-  window_dimension py2;
+// The colors and the back buffer are created once, by graphicInit.
+static GC gray;
+static GC red;
+static GC background;
+static Pixmap backBuffer;
+
+// Copy the lines of the current frame into the snapshot being filled and
+// hand it to the render thread.
+static void publishSnapshot() {
+  Snapshot_capture(&snapshots[fillIndex], gLineDemo->collisionWorld);
+
+  pthread_mutex_lock(&snapshotLock);
+  int filled = fillIndex;
+  fillIndex = readyIndex;
+  readyIndex = filled;
+  snapshotFresh = true;
+  pthread_cond_signal(&snapshotPublished);
+  pthread_mutex_unlock(&snapshotLock);
+}
 
-  Colormap cmap;
-  XGCValues gcval;
-  XColor color;
-  XColor ignore;
-  int64_t fgcolor;
-  GC gray;
-  GC red;
-
-  cmap = DefaultColormap(display, screen);
-  XAllocNamedColor(display, cmap, "gray", &color, &ignore);
-  fgcolor = color.pixel;
-  gcval.foreground = fgcolor;
-  gray = XCreateGC(display, window, GCForeground, &gcval);
-
-  XAllocNamedColor(display, cmap, "dark red", &color, &ignore);
-  fgcolor = color.pixel;
-  gcval.foreground = fgcolor;
-  red = XCreateGC(display, window, GCForeground, &gcval);
-
-  nsegments = LineDemo_getNumOfLines(gLineDemo);
-  if (segments == NULL || gray_segments == NULL) {
-    segments = malloc(nsegments * sizeof(XSegment));
-    gray_segments = malloc(nsegments * sizeof(XSegment));
-  }
-  XClearWindow(display, window);
-  int red_segments_count = 0;
-  int gray_segments_count = 0;
-  for (unsigned int i = 0; i < nsegments; i++) {
-    line = LineDemo_getLine(gLineDemo, i);
-
-    // Convert box coordinates to window coordinates.
-    boxToWindow(&px1, &py1, line->p1.x, line->p1.y);
-    boxToWindow(&px2, &py2, line->p2.x, line->p2.y);
-    // Set line color.
-    switch (line->color) {
-      case RED:
-        // Convert doubles to short ints and store into segments.
-        segments[red_segments_count].x1 = (int16_t) px1;
-        segments[red_segments_count].y1 = (int16_t) py1;
-        segments[red_segments_count].x2 = (int16_t) px2;
-        segments[red_segments_count].y2 = (int16_t) py2;
-        red_segments_count++;
-        break;
-      case GRAY:
-        gray_segments[gray_segments_count].x1 = (int16_t) px1;
-        gray_segments[gray_segments_count].y1 = (int16_t) py1;
-        gray_segments[gray_segments_count].x2 = (int16_t) px2;
-        gray_segments[gray_segments_count].y2 = (int16_t) py2;
-        gray_segments_count++;
-        break;
-    }
+static void drawLineSegments(const Snapshot *snapshot) {
+  unsigned int nsegments = snapshot->numLines;
+  if (nsegments > segmentsCapacity) {
+    free(segments);
+    free(gray_segments);
+    segments = malloc(nsegments * sizeof(Segment));
+    gray_segments = malloc(nsegments * sizeof(Segment));
+    segmentsCapacity = nsegments;
   }
-  XDrawSegments(display, drawable, red, segments, red_segments_count);
-  XDrawSegments(display, drawable, gray, gray_segments, gray_segments_count);
+  int red_segments_count;
+  int gray_segments_count;
+  Snapshot_toSegments(snapshot, segments, &red_segments_count, gray_segments,
+                      &gray_segments_count);
+  // Draw off screen, then show the whole frame at once.
+  XFillRectangle(display, backBuffer, background, 0, 0, WINDOW_WIDTH,
+                 WINDOW_HEIGHT);
+  XDrawSegments(display, backBuffer, red, (XSegment *) segments,
+                red_segments_count);
+  XDrawSegments(display, backBuffer, gray, (XSegment *) gray_segments,
+                gray_segments_count);
+}
+
+static void showBackBuffer() {
+  XCopyArea(display, backBuffer, window, background, 0, 0, WINDOW_WIDTH,
+            WINDOW_HEIGHT, 0, 0);
+  // Waiting for the server here paces the render thread; the simulation
+  // thread carries on regardless.
   XSync(display, 0);
 }
 
@@ -187,16 +194,79 @@ static void checkEvent() {
   }
 }
 
-static void graphicMainLoop(bool imageOnlyFlag) {
+// Draw the latest snapshot whenever there is a new one, until the simulation
+// is done and its last frame has been drawn.
+static void *renderMain(void *arg) {
+  ALLOC_RENDER_THREAD();
   while (true) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += RENDER_IDLE_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&snapshotLock);
+    int waited = 0;
+    while (!snapshotFresh && !simulationDone && waited != ETIMEDOUT) {
+      waited = pthread_cond_timedwait(&snapshotPublished, &snapshotLock,
+                                      &deadline);
+    }
+    bool fresh = snapshotFresh;
+    bool done = simulationDone;
+    if (fresh) {
+      int ready = readyIndex;
+      readyIndex = drawIndex;
+      drawIndex = ready;
+      snapshotFresh = false;
+    }
+    pthread_mutex_unlock(&snapshotLock);
+
+    if (!fresh && done) {
+      return NULL;
+    }
     checkEvent();
-    drawLineSegments(display, window);
-    if (!imageOnlyFlag && !LineDemo_update(gLineDemo)) {
-      return;
+    if (fresh) {
+      drawLineSegments(&snapshots[drawIndex]);
     }
+    // Without a new frame, repaint the last one in case the window was
+    // exposed.
+    showBackBuffer();
   }
 }
 
+static void graphicMainLoop(bool imageOnlyFlag) {
+  pthread_t renderer;
+  pthread_create(&renderer, NULL, renderMain, NULL);
+
+  publishSnapshot();
+  if (!imageOnlyFlag) {
+    while (LineDemo_update(gLineDemo)) {
+      publishSnapshot();
+    }
+
+    pthread_mutex_lock(&snapshotLock);
+    simulationDone = true;
+    pthread_cond_signal(&snapshotPublished);
+    pthread_mutex_unlock(&snapshotLock);
+  }
+  // With imageOnlyFlag, the render thread shows the first image until the
+  // program is killed.
+  pthread_join(renderer, NULL);
+}
+
+static GC createColorGC(const char *name) {
+  XColor color;
+  XColor ignore;
+  XGCValues gcval;
+
+  XAllocNamedColor(display, DefaultColormap(display, screen), name, &color,
+                   &ignore);
+  gcval.foreground = color.pixel;
+  return XCreateGC(display, window, GCForeground, &gcval);
+}
+
 static void graphicInit(int *argc, char *argv[]) {
   // Initialization
   int64_t fgcolor;
@@ -228,25 +298,46 @@ static void graphicInit(int *argc, char *argv[]) {
   eventmask = SubstructureNotifyMask;
   XSelectInput(display, window, eventmask);
 
+  gray = createColorGC("gray");
+  red = createColorGC("dark red");
+  XGCValues gcval;
+  gcval.foreground = bgcolor;
+  gcval.graphics_exposures = False;
+  background = XCreateGC(display, window, GCForeground | GCGraphicsExposures,
+                         &gcval);
+  backBuffer = XCreatePixmap(display, window, WINDOW_WIDTH, WINDOW_HEIGHT,
+                             depth);
+  XFillRectangle(display, backBuffer, background, 0, 0, WINDOW_WIDTH,
+                 WINDOW_HEIGHT);
+
   XMapWindow(display, window);
 
   XClearWindow(display, window);
   XSync(display, 0);
 }
 
+static void graphicCleanup() {
+  XFreePixmap(display, backBuffer);
+  XFreeGC(display, background);
+  XFreeGC(display, red);
+  XFreeGC(display, gray);
+  XCloseDisplay(display);
+
+  for (int i = 0; i < 3; i++) {
+    Snapshot_destroy(&snapshots[i]);
+  }
+  free(segments);
+  free(gray_segments);
+}
+
 void graphicMain(int argc, char *argv[], LineDemo *lineDemo, bool imageOnlyFlag) {
   gLineDemo = lineDemo;
 
   // Initialization
   graphicInit(&argc, argv);
 
-  // Entering the rendering loop
+  // Simulate on this thread and render on another one
   graphicMainLoop(imageOnlyFlag);
 
-  if (segments != NULL) {
-    free(segments);
-  }
-  if (gray_segments != NULL) {
-    free(gray_segments);
-  }
+  graphicCleanup();
 }
@@ -0,0 +1,58 @@
+#include "./Histogram.h"
+
+#include <string.h>
+
+void Histogram_init(Histogram* h) {
+  memset(h, 0, sizeof(Histogram));
+}
+
+// Values below 2 * HISTOGRAM_SUB_COUNT get a bucket each; above that, a
+// value with its top bit at position HISTOGRAM_SUB_BITS + shift lands in
+// the bucket for (value >> shift) within the shift-th group.
+static inline int bucket_index(uint64_t value) {
+  if (value < 2 * HISTOGRAM_SUB_COUNT) {
+    return (int) value;
+  }
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+  if (shift > HISTOGRAM_MAX_SHIFT) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  return shift * HISTOGRAM_SUB_COUNT + (int) (value >> shift);
+}
+
+// The largest value that maps to bucket i.
+static inline uint64_t bucket_value(int i) {
+  if (i < 2 * HISTOGRAM_SUB_COUNT) {
+    return i;
+  }
+  int shift = i / HISTOGRAM_SUB_COUNT - 1;
+  uint64_t sub = i - shift * HISTOGRAM_SUB_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+inline void Histogram_record(Histogram* h, uint64_t value) {
+  h->counts[bucket_index(value)]++;
+  h->count++;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+uint64_t Histogram_percentile(const Histogram* h, double percentile) {
+  if (h->count == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t) (percentile / 100 * h->count + 0.5);
+  if (target < 1) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= target) {
+      uint64_t v = bucket_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
@@ -0,0 +1,29 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+
+// A log-linear (HDR-style) histogram of non-negative integer values.  Each
+// power of two is split into 2^HISTOGRAM_SUB_BITS buckets, so any recorded
+// value is reported with a relative error below 1%.  Values up to 2^40 are
+// tracked; larger values are clamped into the last bucket.
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_SHIFT (40 - HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_SHIFT + 2) * HISTOGRAM_SUB_COUNT)
+
+typedef struct Histogram {
+  uint64_t count;
+  uint64_t max;
+  uint64_t counts[HISTOGRAM_BUCKETS];
+} Histogram;
+
+void Histogram_init(Histogram* h);
+
+void Histogram_record(Histogram* h, uint64_t value);
+
+// Returns the smallest recorded value v (up to bucket precision) such that
+// at least percentile percent of the recorded values are <= v.
+uint64_t Histogram_percentile(const Histogram* h, double percentile);
+
+#endif  // HISTOGRAM_H_
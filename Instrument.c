@@ -0,0 +1,316 @@
+#include "./Instrument.h"
+
+#ifdef INSTRUMENT
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <cilk/cilk_api.h>
+
+#include "./AllocProfile.h"
+#include "./fasttime.h"
+#include "./PerfCounters.h"
+
+static const char* phase_names[NUM_PHASES] = {
+  "build_quadtree",
+  "detect_events",
+  "sort_events",
+  "solve",
+  "update_position",
+  "wall_collision"
+};
+
+static const char* counter_names[NUM_COUNTERS] = {
+  "aabb_tests",
+  "intersect_lines",
+  "events_l1_with_l2",
+  "events_l2_with_l1",
+  "events_already_intersected",
+  "estimated_tests",
+  "tasks_spawned",
+  "subtrees_coarsened",
+  "nodes_split",
+  "split_chunks",
+  "static_rebuilds",
+  "static_releases",
+  "wall_checks",
+  "orient_tests",
+  "orient_fallbacks",
+  "orient_exact",
+  "sleeps",
+  "sleep_frames",
+  "early_wakes",
+  "sleep_flushes",
+  "midphase_tests",
+  "midphase_rejects"
+};
+
+// Counters are kept per worker and padded so that workers never write to
+// the same cache line.
+typedef struct {
+  unsigned long counters[NUM_COUNTERS];
+  unsigned long levels[INSTRUMENT_MAX_LEVELS];
+} __attribute__((aligned(64))) WorkerCounters;
+
+static WorkerCounters* workers = NULL;
+static int num_workers = 0;
+
+static fasttime_t phase_start[NUM_PHASES];
+static double phase_total[NUM_PHASES];
+
+static double* frame_times = NULL;  // max_frames x NUM_PHASES
+static unsigned int max_frames = 0;
+static unsigned int frame = 0;
+
+#ifdef WORKSPAN
+// Work, span and burdened span, per phase in total and per frame in total.
+typedef struct {
+  double work;
+  double span;
+  double burdenedSpan;
+} WorkSpan;
+
+static WorkSpan phase_ws[NUM_PHASES];
+static WorkSpan* frame_ws = NULL;
+static bool phase_ws_reported[NUM_PHASES];
+
+static void add_workspan(Phase phase, double work, double span,
+                         double burdenedSpan) {
+  phase_ws[phase].work += work;
+  phase_ws[phase].span += span;
+  phase_ws[phase].burdenedSpan += burdenedSpan;
+  if (frame < max_frames) {
+    // Phases run one after another, so their spans add up.
+    frame_ws[frame].work += work;
+    frame_ws[frame].span += span;
+    frame_ws[frame].burdenedSpan += burdenedSpan;
+  }
+}
+#endif
+
+void Instrument_init(unsigned int maxFrames) {
+  num_workers = __cilkrts_get_nworkers();
+  if (num_workers < 1) {
+    num_workers = 1;
+  }
+  workers = calloc(num_workers, sizeof(WorkerCounters));
+  assert(workers);
+
+  max_frames = maxFrames;
+  frame_times = calloc((size_t) maxFrames * NUM_PHASES, sizeof(double));
+  assert(frame_times || maxFrames == 0);
+  memset(phase_total, 0, sizeof(phase_total));
+  frame = 0;
+
+#ifdef WORKSPAN
+  frame_ws = calloc(maxFrames, sizeof(WorkSpan));
+  assert(frame_ws || maxFrames == 0);
+  memset(phase_ws, 0, sizeof(phase_ws));
+#endif
+
+#ifdef PERF_COUNTERS
+  PerfCounters_init();
+#endif
+#ifdef ALLOC_PROFILE
+  AllocProfile_init(maxFrames);
+#endif
+}
+
+const char* Instrument_phaseName(Phase phase) {
+  return phase_names[phase];
+}
+
+inline void Instrument_begin(Phase phase) {
+#ifdef PERF_COUNTERS
+  PerfCounters_begin(phase);
+#endif
+#ifdef ALLOC_PROFILE
+  AllocProfile_begin(phase);
+#endif
+#ifdef WORKSPAN
+  phase_ws_reported[phase] = false;
+#endif
+  phase_start[phase] = gettime();
+}
+
+inline void Instrument_end(Phase phase) {
+  double t = tdiff(phase_start[phase], gettime());
+#ifdef PERF_COUNTERS
+  PerfCounters_end(phase);
+#endif
+#ifdef ALLOC_PROFILE
+  AllocProfile_end(phase);
+#endif
+  phase_total[phase] += t;
+  if (frame < max_frames) {
+    frame_times[frame * NUM_PHASES + phase] += t;
+  }
+#ifdef WORKSPAN
+  if (!phase_ws_reported[phase]) {
+    add_workspan(phase, t, t, t);
+  }
+#endif
+}
+
+void Instrument_workSpan(Phase phase, double work, double span,
+                         double burdenedSpan) {
+#ifdef WORKSPAN
+  phase_ws_reported[phase] = true;
+  add_workspan(phase, work, span, burdenedSpan);
+#endif
+}
+
+void Instrument_endFrame() {
+#ifdef ALLOC_PROFILE
+  AllocProfile_endFrame();
+#endif
+  frame++;
+}
+
+static inline WorkerCounters* current_worker() {
+#ifdef PERF_COUNTERS
+  PerfCounters_enterThread();
+#endif
+  int w = __cilkrts_get_worker_number();
+  if (w < 0 || w >= num_workers) {
+    w = 0;
+  }
+  return &workers[w];
+}
+
+inline void Instrument_count(Counter counter, unsigned long n) {
+  if (workers) {
+    current_worker()->counters[counter] += n;
+  }
+}
+
+inline void Instrument_level(int depth, unsigned long n) {
+  if (workers) {
+    if (depth >= INSTRUMENT_MAX_LEVELS) {
+      depth = INSTRUMENT_MAX_LEVELS - 1;
+    }
+    current_worker()->levels[depth] += n;
+  }
+}
+
+void Instrument_report(const char* path) {
+  if (path == NULL) {
+    path = "instrument.json";
+  }
+  FILE* out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    return;
+  }
+
+  unsigned long counters[NUM_COUNTERS] = {0};
+  unsigned long levels[INSTRUMENT_MAX_LEVELS] = {0};
+  for (int w = 0; w < num_workers; w++) {
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+      counters[c] += workers[w].counters[c];
+    }
+    for (int d = 0; d < INSTRUMENT_MAX_LEVELS; d++) {
+      levels[d] += workers[w].levels[d];
+    }
+  }
+
+  unsigned int recorded = frame < max_frames ? frame : max_frames;
+
+  fprintf(out, "{\n  \"frames\": %u,\n  \"workers\": %d,\n", frame, num_workers);
+  fprintf(out, "  \"phases\": {\n");
+  for (int p = 0; p < NUM_PHASES; p++) {
+    fprintf(out, "    \"%s\": {\n", phase_names[p]);
+    fprintf(out, "      \"total\": %.9f,\n", phase_total[p]);
+    fprintf(out, "      \"per_frame\": [");
+    for (unsigned int f = 0; f < recorded; f++) {
+      fprintf(out, "%s%.9f", f ? ", " : "", frame_times[f * NUM_PHASES + p]);
+    }
+    fprintf(out, "]\n    }%s\n", p + 1 < NUM_PHASES ? "," : "");
+  }
+  fprintf(out, "  },\n  \"counters\": {\n");
+  for (int c = 0; c < NUM_COUNTERS; c++) {
+    fprintf(out, "    \"%s\": %lu%s\n", counter_names[c], counters[c],
+            c + 1 < NUM_COUNTERS ? "," : "");
+  }
+  fprintf(out, "  },\n  \"lines_per_level\": [");
+  for (int d = 0; d < INSTRUMENT_MAX_LEVELS; d++) {
+    fprintf(out, "%s%lu", d ? ", " : "", levels[d]);
+  }
+  fprintf(out, "]");
+
+  // Load balance: pair tests done by each worker, and the busiest worker
+  // relative to the average.
+  unsigned long maxTests = 0;
+  fprintf(out, ",\n  \"tests_per_worker\": [");
+  for (int w = 0; w < num_workers; w++) {
+    unsigned long tests = workers[w].counters[COUNTER_AABB_TESTS];
+    if (tests > maxTests) {
+      maxTests = tests;
+    }
+    fprintf(out, "%s%lu", w ? ", " : "", tests);
+  }
+  fprintf(out, "],\n  \"imbalance\": %.3f", counters[COUNTER_AABB_TESTS]
+          ? (double) maxTests * num_workers / counters[COUNTER_AABB_TESTS] : 1.0);
+
+  // Share of orientation tests that the error bound could not settle.
+  fprintf(out, ",\n  \"orient_fallback_rate\": %g",
+          counters[COUNTER_ORIENT_TESTS]
+          ? (double) counters[COUNTER_ORIENT_FALLBACKS] /
+            counters[COUNTER_ORIENT_TESTS] : 0.0);
+  // Share of the pairs past the bounding box test that the midphase rejected.
+  fprintf(out, ",\n  \"midphase_reject_rate\": %g",
+          counters[COUNTER_MIDPHASE_TESTS]
+          ? (double) counters[COUNTER_MIDPHASE_REJECTS] /
+            counters[COUNTER_MIDPHASE_TESTS] : 0.0);
+#ifdef WORKSPAN
+  fprintf(out, ",\n  \"workspan\": {\n    \"burden\": %g,\n", WORKSPAN_BURDEN);
+  fprintf(out, "    \"phases\": {\n");
+  for (int p = 0; p < NUM_PHASES; p++) {
+    fprintf(out, "      \"%s\": {\"work\": %.9f, \"span\": %.9f, "
+            "\"burdened_span\": %.9f}%s\n", phase_names[p], phase_ws[p].work,
+            phase_ws[p].span, phase_ws[p].burdenedSpan,
+            p + 1 < NUM_PHASES ? "," : "");
+  }
+  WorkSpan sum = {0, 0, 0};
+  for (int p = 0; p < NUM_PHASES; p++) {
+    sum.work += phase_ws[p].work;
+    sum.span += phase_ws[p].span;
+    sum.burdenedSpan += phase_ws[p].burdenedSpan;
+  }
+  fprintf(out, "    },\n    \"work\": %.9f,\n    \"span\": %.9f,\n"
+          "    \"burdened_span\": %.9f,\n", sum.work, sum.span,
+          sum.burdenedSpan);
+  fprintf(out, "    \"parallelism\": %.3f,\n"
+          "    \"burdened_parallelism\": %.3f,\n",
+          sum.span > 0 ? sum.work / sum.span : 0,
+          sum.burdenedSpan > 0 ? sum.work / sum.burdenedSpan : 0);
+  const char* series[4] = {"work", "span", "parallelism",
+                           "burdened_parallelism"};
+  for (int k = 0; k < 4; k++) {
+    fprintf(out, "    \"per_frame_%s\": [", series[k]);
+    for (unsigned int f = 0; f < recorded; f++) {
+      const WorkSpan* ws = &frame_ws[f];
+      double v = k == 0 ? ws->work
+          : k == 1 ? ws->span
+          : k == 2 ? (ws->span > 0 ? ws->work / ws->span : 0)
+          : (ws->burdenedSpan > 0 ? ws->work / ws->burdenedSpan : 0);
+      fprintf(out, "%s%.9g", f ? ", " : "", v);
+    }
+    fprintf(out, "]%s\n", k < 3 ? "," : "");
+  }
+  fprintf(out, "  }");
+#endif
+#ifdef PERF_COUNTERS
+  fprintf(out, ",\n  \"perf\": ");
+  PerfCounters_report(out);
+#endif
+#ifdef ALLOC_PROFILE
+  fprintf(out, ",\n  \"allocations\": ");
+  AllocProfile_report(out);
+#endif
+  fprintf(out, "\n}\n");
+  fclose(out);
+}
+
+#endif  // INSTRUMENT
@@ -0,0 +1,116 @@
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+// Per-phase timers and event counters for CollisionWorld_updateLines.
+//
+// Everything here compiles away unless INSTRUMENT is defined (build with
+// "make INSTRUMENT=1").  When enabled, phase times are accumulated both in
+// total and per frame, counters are kept per Cilk worker to avoid sharing
+// cache lines in the parallel detection code, and the whole lot is written
+// out as JSON by Instrument_report.  The report also breaks the pair tests
+// down by worker, which shows how evenly the detection work was balanced.
+//
+// Building with WORKSPAN defined as well ("make WORKSPAN=1") adds a built-in
+// work/span analysis in the spirit of Cilkview: every phase reports its work
+// (total time of all strands) and span (time along the critical path), and
+// the report gives per-frame parallelism (work / span) and burdened
+// parallelism, which charges WORKSPAN_BURDEN seconds of scheduling overhead
+// to the span for each parallel construct on the critical path.  Measure
+// with CILK_NWORKERS=1 so strands are not slowed by each other.
+
+#include <stdio.h>
+
+#define INSTRUMENT_MAX_LEVELS 16
+
+// Estimated cost of a steal, charged once per cilk_for on the span.
+#define WORKSPAN_BURDEN 2e-6
+
+typedef enum {
+  PHASE_BUILD_QUADTREE,
+  PHASE_DETECT_EVENTS,
+  PHASE_SORT_EVENTS,
+  PHASE_SOLVE,
+  PHASE_UPDATE_POSITION,
+  PHASE_WALL_COLLISION,
+  NUM_PHASES
+} Phase;
+
+typedef enum {
+  COUNTER_AABB_TESTS,
+  COUNTER_INTERSECT_LINES,
+  COUNTER_EVENTS_L1_WITH_L2,
+  COUNTER_EVENTS_L2_WITH_L1,
+  COUNTER_EVENTS_ALREADY_INTERSECTED,
+  COUNTER_ESTIMATED_TESTS,
+  COUNTER_TASKS_SPAWNED,
+  COUNTER_SUBTREES_COARSENED,
+  COUNTER_NODES_SPLIT,
+  COUNTER_SPLIT_CHUNKS,
+  COUNTER_STATIC_REBUILDS,
+  COUNTER_STATIC_RELEASES,
+  COUNTER_WALL_CHECKS,
+  COUNTER_ORIENT_TESTS,
+  COUNTER_ORIENT_FALLBACKS,
+  COUNTER_ORIENT_EXACT,
+  COUNTER_SLEEPS,
+  COUNTER_SLEEP_FRAMES,
+  COUNTER_EARLY_WAKES,
+  COUNTER_SLEEP_FLUSHES,
+  COUNTER_MIDPHASE_TESTS,
+  COUNTER_MIDPHASE_REJECTS,
+  NUM_COUNTERS
+} Counter;
+
+#ifdef INSTRUMENT
+
+// Allocates storage for up to maxFrames frames of per-frame timings.  Frames
+// beyond that still contribute to the cumulative totals.
+void Instrument_init(unsigned int maxFrames);
+
+const char* Instrument_phaseName(Phase phase);
+
+void Instrument_begin(Phase phase);
+void Instrument_end(Phase phase);
+void Instrument_endFrame();
+
+void Instrument_count(Counter counter, unsigned long n);
+
+// Records n lines stored in a quadtree node at the given depth.
+void Instrument_level(int depth, unsigned long n);
+
+// Records the work, span and burdened span of one execution of phase.
+// Phases that do not call this are counted as serial: their work and
+// span are both equal to their elapsed time.
+void Instrument_workSpan(Phase phase, double work, double span,
+                         double burdenedSpan);
+
+// Writes the collected data as a JSON object to path, or to
+// "instrument.json" if path is NULL.
+void Instrument_report(const char* path);
+
+#define INSTRUMENT_INIT(maxFrames) Instrument_init(maxFrames)
+#define INSTRUMENT_BEGIN(phase) Instrument_begin(phase)
+#define INSTRUMENT_END(phase) Instrument_end(phase)
+#define INSTRUMENT_END_FRAME() Instrument_endFrame()
+#define INSTRUMENT_COUNT(counter) Instrument_count(counter, 1)
+#define INSTRUMENT_ADD(counter, n) Instrument_count(counter, n)
+#define INSTRUMENT_LEVEL(depth, n) Instrument_level(depth, n)
+#define INSTRUMENT_REPORT(path) Instrument_report(path)
+#define INSTRUMENT_WORKSPAN(phase, work, span, burdened) \
+  Instrument_workSpan(phase, work, span, burdened)
+
+#else
+
+#define INSTRUMENT_INIT(maxFrames) ((void) 0)
+#define INSTRUMENT_BEGIN(phase) ((void) 0)
+#define INSTRUMENT_END(phase) ((void) 0)
+#define INSTRUMENT_END_FRAME() ((void) 0)
+#define INSTRUMENT_COUNT(counter) ((void) 0)
+#define INSTRUMENT_ADD(counter, n) ((void) 0)
+#define INSTRUMENT_LEVEL(depth, n) ((void) 0)
+#define INSTRUMENT_REPORT(path) ((void) 0)
+#define INSTRUMENT_WORKSPAN(phase, work, span, burdened) ((void) 0)
+
+#endif  // INSTRUMENT
+
+#endif  // INSTRUMENT_H_
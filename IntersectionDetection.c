@@ -23,8 +23,11 @@
 #include "./IntersectionDetection.h"
 
 #include <assert.h>
+#include <math.h>
 
+#include "./Instrument.h"
 #include "./Line.h"
+#include "./Predicates.h"
 #include "./Vec.h"
 
 inline static bool rectanglesOverlap(Line* l1, Line* l2) {
@@ -32,19 +35,94 @@ inline static bool rectanglesOverlap(Line* l1, Line* l2) {
          l1->l_y <= l2->u_y && l1->u_y >= l2->l_y;
 }
 
-inline static bool side(Vec E, Vec F, Vec P) {
-  return (F.x - E.x) * (P.y - F.y) -
-         (F.y - E.y) * (P.x - F.x) >= 0;
+inline static double min(double a, double b) {
+  return a < b ? a : b;
+}
+
+inline static double max(double a, double b) {
+  return a > b ? a : b;
+}
+
+// Whether the signs of the four orientation determinants d1 to d4, as
+// returned by Predicates_orient2dFast with the products l1 to l4, are all
+// exact.  Each is held to the bound of the largest product, which is at
+// least as strict, so that one multiplication and one comparison cover all
+// four and the common case costs one branch.
+inline static bool settled4(double d1, double l1, double d2, double l2,
+                            double d3, double l3, double d4, double l4) {
+  return min(min(fabs(d1), fabs(d2)), min(fabs(d3), fabs(d4))) >=
+         PREDICATES_ORIENT_FILTER *
+         max(max(fabs(l1), fabs(l2)), max(fabs(l3), fabs(l4)));
+}
+
+// Distance by which the midphase needs its shapes apart, far above the
+// rounding of the coordinates the exact tests use, so that it never rejects
+// a pair they would not.
+#ifdef VEC_FLOAT
+#define MIDPHASE_SLACK 1e-6
+#else
+#define MIDPHASE_SLACK 1e-12
+#endif
+
+// Whether the intervals [lo1, hi1] and [lo2, hi2] are more than slack apart.
+// The axes are not unit vectors, so slack is scaled to each.
+inline static bool apart(double lo1, double hi1, double lo2, double hi2,
+                         double slack) {
+  return hi1 < lo2 - slack || hi2 < lo1 - slack;
+}
+
+// Separating-axis test of segment l1 against the parallelogram that l2
+// sweeps relative to it, with corners l2->p1, l2->p2 and those moved by
+// r = l2->delta - l1->delta.  Every intersection type needs the two to
+// meet, so if one of the three edge normals separates them there is none.
+// The parallelogram projects to proj(l2->p1) plus 0, proj(e), proj(r) and
+// their sum, where e = l2->p2 - l2->p1.
+inline static bool midphaseSeparated(Line* l1, Line* l2) {
+  INSTRUMENT_COUNT(COUNTER_MIDPHASE_TESTS);
+  double ax = l1->p2.x - l1->p1.x;
+  double ay = l1->p2.y - l1->p1.y;
+  double ex = l2->p2.x - l2->p1.x;
+  double ey = l2->p2.y - l2->p1.y;
+  double rx = l2->delta.x - l1->delta.x;
+  double ry = l2->delta.y - l1->delta.y;
+  double axes[3][2] = {{-ay, ax}, {-ey, ex}, {-ry, rx}};
+  for (int i = 0; i < 3; i++) {
+    double nx = axes[i][0];
+    double ny = axes[i][1];
+    double slack = MIDPHASE_SLACK * (fabs(nx) + fabs(ny));
+    double a1 = l1->p1.x * nx + l1->p1.y * ny;
+    double a2 = l1->p2.x * nx + l1->p2.y * ny;
+    double b = l2->p1.x * nx + l2->p1.y * ny;
+    double pe = ex * nx + ey * ny;
+    double pr = rx * nx + ry * ny;
+    if (apart(MIN(a1, a2), MAX(a1, a2), b + MIN(pe, 0) + MIN(pr, 0),
+              b + MAX(pe, 0) + MAX(pr, 0), slack)) {
+      INSTRUMENT_COUNT(COUNTER_MIDPHASE_REJECTS);
+      return true;
+    }
+  }
+  return false;
 }
 
 // Detect if lines l1 and l2 will intersect between now and the next time step.
+// Cheap tests that can only rule an intersection out run first: the
+// bounding boxes, then (unless built with NO_MIDPHASE) the separating axes.
 inline IntersectionType intersect(Line *l1, Line *l2, double time) {
   assert(compareLines(l1, l2) < 0);
 
+  INSTRUMENT_COUNT(COUNTER_AABB_TESTS);
   if (!rectanglesOverlap(l1, l2)) {
     return NO_INTERSECTION;
   }
+#ifndef NO_MIDPHASE
+  if (midphaseSeparated(l1, l2)) {
+    return NO_INTERSECTION;
+  }
+#endif
+  return classifyIntersection(l1, l2);
+}
 
+inline IntersectionType classifyIntersection(Line* l1, Line* l2) {
   Vec p1 = {.x = l2->p3.x - l1->delta.x, .y = l2->p3.y - l1->delta.y};
   Vec p2 = {.x = l2->p4.x - l1->delta.x, .y = l2->p4.y - l1->delta.y};
 
@@ -94,24 +172,63 @@ inline IntersectionType intersect(Line *l1, Line *l2, double time) {
   return L1_WITH_L2;
 }
 
+// pointInParallelogram with the sign of every orientation exact, for when
+// the filter cannot settle one of them.  Kept out of line, since it is
+// almost never needed.
+static bool __attribute__((noinline)) pointInParallelogramExact(
+    Vec point, Vec p1, Vec p2, Vec p3, Vec p4) {
+  double d1 = Predicates_orient2d(point, p2, p1);
+  double d2 = Predicates_orient2d(point, p4, p3);
+  double d3 = Predicates_orient2d(point, p3, p1);
+  double d4 = Predicates_orient2d(point, p4, p2);
+  return d1 * d2 < 0 && d3 * d4 < 0;
+}
+
 // Check if a point is in the parallelogram.
 inline bool pointInParallelogram(Vec point, Vec p1, Vec p2, Vec p3, Vec p4) {
-  double d1 = direction(p1, p2, point);
-  double d2 = direction(p3, p4, point);
-  double d3 = direction(p1, p3, point);
-  double d4 = direction(p2, p4, point);
+  // direction(p1, p2, point), direction(p3, p4, point),
+  // direction(p1, p3, point) and direction(p2, p4, point).
+  double l1, l2, l3, l4;
+  double d1 = Predicates_orient2dFast(point, p2, p1, &l1);
+  double d2 = Predicates_orient2dFast(point, p4, p3, &l2);
+  double d3 = Predicates_orient2dFast(point, p3, p1, &l3);
+  double d4 = Predicates_orient2dFast(point, p4, p2, &l4);
+  if (__builtin_expect(!settled4(d1, l1, d2, l2, d3, l3, d4, l4), 0)) {
+    return pointInParallelogramExact(point, p1, p2, p3, p4);
+  }
   return d1 * d2 < 0 && d3 * d4 < 0;
 }
 
+// intersectLines with the sign of every orientation exact, for when the
+// filter cannot settle one of them.
+static bool __attribute__((noinline)) intersectLinesExact(Vec p1, Vec p2,
+                                                          Vec p3, Vec p4) {
+  double d1 = Predicates_orient2d(p2, p3, p1);
+  double d2 = Predicates_orient2d(p2, p4, p1);
+  double d3 = Predicates_orient2d(p4, p1, p3);
+  double d4 = Predicates_orient2d(p4, p2, p3);
+  return (d1 >= 0) != (d2 >= 0) && (d3 >= 0) != (d4 >= 0);
+}
+
 // Check if two lines intersect.
 inline bool intersectLines(Vec p1, Vec p2, Vec p3, Vec p4) {
-  return side(p1, p2, p3) != side(p1, p2, p4) &&
-         side(p3, p4, p1) != side(p3, p4, p2);
+  INSTRUMENT_COUNT(COUNTER_INTERSECT_LINES);
+  // side(p1, p2, p3), side(p1, p2, p4), side(p3, p4, p1) and
+  // side(p3, p4, p2), each written so that a pair shares a difference.
+  double l1, l2, l3, l4;
+  double d1 = Predicates_orient2dFast(p2, p3, p1, &l1);
+  double d2 = Predicates_orient2dFast(p2, p4, p1, &l2);
+  double d3 = Predicates_orient2dFast(p4, p1, p3, &l3);
+  double d4 = Predicates_orient2dFast(p4, p2, p3, &l4);
+  if (__builtin_expect(!settled4(d1, l1, d2, l2, d3, l3, d4, l4), 0)) {
+    return intersectLinesExact(p1, p2, p3, p4);
+  }
+  return (d1 >= 0) != (d2 >= 0) && (d3 >= 0) != (d4 >= 0);
 }
 
 // Obtain the intersection point for two intersecting line segments.
 inline Vec getIntersectionPoint(Vec p1, Vec p2, Vec p3, Vec p4) {
-  double u;
+  vec_dimension u;
 
   u = ((p4.x - p3.x) * (p1.y - p3.y) -
        (p4.y - p3.y) * (p1.x - p3.x)) /
@@ -125,10 +242,10 @@ inline Vec getIntersectionPoint(Vec p1, Vec p2, Vec p3, Vec p4) {
   return p;
 }
 
-// Check the direction of two lines (pi, pj) and (pi, pk).
+// Check the direction of two lines (pi, pj) and (pi, pk).  The sign is
+// exact; it is that of the cross product of pk - pi and pj - pi.
 inline double direction(Vec pi, Vec pj, Vec pk) {
-  return crossProduct(pk.x - pi.x, pk.y - pi.y,
-                      pj.x - pi.x, pj.y - pi.y);
+  return Predicates_orient2d(pk, pj, pi);
 }
 
 // Check if a point pk is in the line segment (pi, pj).
@@ -141,7 +258,8 @@ inline bool onSegment(Vec pi, Vec pj, Vec pk) {
 }
 
 // Calculate the cross product.
-inline double crossProduct(double x1, double y1, double x2, double y2) {
+inline vec_dimension crossProduct(vec_dimension x1, vec_dimension y1,
+                                  vec_dimension x2, vec_dimension y2) {
   return x1 * y2 - x2 * y1;
 }
 
@@ -37,20 +37,27 @@ typedef enum {
 // Precondition: compareLines(l1, l2) < 0 must be true.
 IntersectionType intersect(Line *l1, Line *l2, double time);
 
+// The full classification behind intersect, without the early rejection
+// tests.  Precondition: compareLines(l1, l2) < 0 must be true, and the
+// boxes of both lines must be up to date.
+IntersectionType classifyIntersection(Line* l1, Line* l2);
+
 // Check if a point is in the parallelogram.
 bool pointInParallelogram(Vec point, Vec p1, Vec p2, Vec p3, Vec p4);
 
 // Check if two lines intersect.
 bool intersectLines(Vec p1, Vec p2, Vec p3, Vec p4);
 
-// Check the direction of two lines (pi, pj) and (pi, pk).
+// Check the direction of two lines (pi, pj) and (pi, pk).  Only the sign
+// of the result is exact.
 double direction(Vec pi, Vec pj, Vec pk);
 
 // Check if a point pk is in the line segment (pi, pj).
 bool onSegment(Vec pi, Vec pj, Vec pk);
 
 // Calculate the cross product.
-double crossProduct(double x1, double y1, double x2, double y2);
+vec_dimension crossProduct(vec_dimension x1, vec_dimension y1,
+                           vec_dimension x2, vec_dimension y2);
 
 // Obtain the intersection point for two intersecting line segments.
 Vec getIntersectionPoint(Vec p1, Vec p2, Vec p3, Vec p4);
@@ -23,7 +23,73 @@
 #include "./IntersectionEventList.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <cilk/cilk_api.h>
+
+#include "./AllocProfile.h"
+
+// Nodes taken from malloc at a time, and moved between a worker's cache and
+// the shared free list at a time.
+#define EVENT_POOL_BATCH 256
+#define EVENT_POOL_MAX_WORKERS 256
+
+// The free nodes of one worker, padded so that workers never write to the
+// same cache line.
+typedef struct {
+  IntersectionEventNode* free;
+} __attribute__((aligned(64))) NodeCache;
+
+static NodeCache caches[EVENT_POOL_MAX_WORKERS];
+
+// Guards the shared free list of nodes.
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static IntersectionEventNode* freeNodes = NULL;
+
+// Takes up to n nodes off the shared free list, which is first refilled
+// from malloc if it is empty.
+static IntersectionEventNode* take_nodes(int n) {
+  pthread_mutex_lock(&poolLock);
+  if (freeNodes == NULL) {
+    IntersectionEventNode* block = ALLOC_GROWTH(
+        malloc(EVENT_POOL_BATCH * sizeof(IntersectionEventNode)));
+    if (block) {
+      for (int i = 0; i < EVENT_POOL_BATCH - 1; i++) {
+        block[i].next = &block[i + 1];
+      }
+      block[EVENT_POOL_BATCH - 1].next = NULL;
+      freeNodes = block;
+    }
+  }
+  IntersectionEventNode* nodes = freeNodes;
+  IntersectionEventNode* last = NULL;
+  for (IntersectionEventNode* node = nodes; node && n > 0;
+       node = node->next, n--) {
+    last = node;
+  }
+  if (last) {
+    freeNodes = last->next;
+    last->next = NULL;
+  }
+  pthread_mutex_unlock(&poolLock);
+  return nodes;
+}
+
+static inline IntersectionEventNode* take_node() {
+  int w = __cilkrts_get_worker_number();
+  if (w < 0 || w >= EVENT_POOL_MAX_WORKERS) {
+    return take_nodes(1);
+  }
+  NodeCache* cache = &caches[w];
+  if (cache->free == NULL) {
+    cache->free = take_nodes(EVENT_POOL_BATCH);
+  }
+  IntersectionEventNode* node = cache->free;
+  if (node) {
+    cache->free = node->next;
+  }
+  return node;
+}
 
 inline int IntersectionEventNode_compareData(IntersectionEventNode* node1,
                                       IntersectionEventNode* node2) {
@@ -74,7 +140,7 @@ inline void IntersectionEventList_appendNode(
     IntersectionType intersectionType) {
   assert(compareLines(l1, l2) < 0);
 
-  IntersectionEventNode* newNode = malloc(sizeof(IntersectionEventNode));
+  IntersectionEventNode* newNode = take_node();
   if (newNode == NULL) {
     return;
   }
@@ -108,12 +174,11 @@ inline void IntersectionEventList_concat(IntersectionEventList* list1,
 
 inline void IntersectionEventList_deleteNodes(
     IntersectionEventList* intersectionEventList) {
-  IntersectionEventNode* curNode = intersectionEventList->head;
-  IntersectionEventNode* nextNode = NULL;
-  while (curNode != NULL) {
-    nextNode = curNode->next;
-    free(curNode);
-    curNode = nextNode;
+  if (intersectionEventList->head != NULL) {
+    pthread_mutex_lock(&poolLock);
+    intersectionEventList->tail->next = freeNodes;
+    freeNodes = intersectionEventList->head;
+    pthread_mutex_unlock(&poolLock);
   }
   intersectionEventList->head = NULL;
   intersectionEventList->tail = NULL;
@@ -135,3 +200,32 @@ void intersection_event_list_destroy(void* key, void* value){
   IntersectionEventList_deleteNodes((IntersectionEventList *)value);
 };
 
+void IntersectionEventCollector_init(IntersectionEventCollector* collector) {
+  int n = __cilkrts_get_nworkers();
+  collector->numWorkers = n < 1 ? 1 : n;
+  if (posix_memalign((void**) &collector->workers,
+                     __alignof__(WorkerEventList),
+                     collector->numWorkers * sizeof(WorkerEventList)) != 0) {
+    collector->workers = NULL;
+  }
+  assert(collector->workers);
+  for (int w = 0; w < collector->numWorkers; w++) {
+    collector->workers[w].list = IntersectionEventList_make();
+  }
+}
+
+void IntersectionEventCollector_destroy(IntersectionEventCollector* collector) {
+  for (int w = 0; w < collector->numWorkers; w++) {
+    IntersectionEventList_deleteNodes(&collector->workers[w].list);
+  }
+  free(collector->workers);
+}
+
+IntersectionEventList IntersectionEventCollector_take(
+    IntersectionEventCollector* collector) {
+  IntersectionEventList all = IntersectionEventList_make();
+  for (int w = 0; w < collector->numWorkers; w++) {
+    IntersectionEventList_concat(&all, &collector->workers[w].list);
+  }
+  return all;
+}
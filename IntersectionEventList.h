@@ -23,6 +23,7 @@
 #ifndef INTERSECTIONEVENTLIST_H_
 #define INTERSECTIONEVENTLIST_H_
 
+#include <cilk/cilk_api.h>
 #include <cilk/reducer.h>
 
 #include "./Line.h"
@@ -62,6 +63,12 @@ IntersectionEventList IntersectionEventList_make();
 
 // Appends a new node to the list with the data (l1, l2, intersectionType).
 // Precondition: compareLines(l1, l2) < 0 must be true.
+//
+// Nodes come from a pool shared by all lists, which takes them from malloc
+// in blocks and never gives them back: deleted nodes are reused, so once
+// the pool holds as many nodes as the busiest frame needed, lists are built
+// without heap calls.  Each Cilk worker takes nodes from the pool a batch
+// at a time, so appending does not take a lock.
 void IntersectionEventList_appendNode(
     IntersectionEventList* intersectionEventList, Line* l1, Line* l2,
     IntersectionType intersectionType);
@@ -69,7 +76,7 @@ void IntersectionEventList_appendNode(
 void IntersectionEventList_concat(IntersectionEventList* list1,
                                   IntersectionEventList* list2);
 
-// Deletes all the nodes in the list.
+// Deletes all the nodes in the list, returning them to the pool.
 void IntersectionEventList_deleteNodes(
     IntersectionEventList* intersectionEventList);
 
@@ -79,4 +86,39 @@ void intersection_event_list_identity(void* key, void* value);
 
 void intersection_event_list_destroy(void* key, void* value);
 
+// Events found in parallel, in one list per Cilk worker.  A worker only
+// ever appends to its own list, so unlike a reducer, which makes a new view
+// for every stolen strand, this needs nothing beyond the nodes.  The lists
+// are joined once the parallel work is over; the order of the joined list
+// depends on the schedule, so callers sort it.
+typedef struct {
+  IntersectionEventList list;
+} __attribute__((aligned(64))) WorkerEventList;
+
+typedef struct {
+  WorkerEventList* workers;
+  int numWorkers;
+} IntersectionEventCollector;
+
+// Sets up *collector with an empty list for every Cilk worker.
+void IntersectionEventCollector_init(IntersectionEventCollector* collector);
+
+// Deletes the nodes of every list, and the lists.
+void IntersectionEventCollector_destroy(IntersectionEventCollector* collector);
+
+// The list of the calling worker.
+static inline IntersectionEventList* IntersectionEventCollector_view(
+    IntersectionEventCollector* collector) {
+  int w = __cilkrts_get_worker_number();
+  if (w < 0 || w >= collector->numWorkers) {
+    w = 0;
+  }
+  return &collector->workers[w].list;
+}
+
+// Joins the lists of all workers into one and leaves them empty.  Call it
+// only once every strand appending to them has been synced.
+IntersectionEventList IntersectionEventCollector_take(
+    IntersectionEventCollector* collector);
+
 #endif  // INTERSECTIONEVENTLIST_H_
@@ -0,0 +1,440 @@
+/**
+ * KernelBench.c -- microbenchmarks for the collision detection kernels
+ *
+ * Times the narrow phase (intersect, intersectLines, pointInParallelogram,
+ * getIntersectionPoint), quadtree classification (QuadTree_getQuad,
+ * update_box) and CollisionWorld_collisionSolver in isolation over a
+ * synthetic set of line pairs.  The pair set has a controllable fraction of
+ * hits and mix of intersection types, and can be laid out either shuffled
+ * (unpredictable branches) or grouped by outcome (predictable branches).
+ * It also times batches of spatial queries over all the generated lines,
+ * answered from the quadtree and by brute force, and checks that the two
+ * agree.
+ **/
+
+#include "./fasttime.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./CollisionWorld.h"
+#include "./IntersectionDetection.h"
+#include "./Line.h"
+#include "./Quadtree.h"
+#include "./SpatialQuery.h"
+
+// Outcome classes a generated pair can fall into.
+typedef enum {
+  CLASS_AABB_MISS,
+  CLASS_NEAR_MISS,
+  CLASS_L1_WITH_L2,
+  CLASS_L2_WITH_L1,
+  CLASS_ALREADY_INTERSECTED,
+  NUM_CLASSES
+} PairClass;
+
+static const char* class_names[NUM_CLASSES] = {
+  "aabb miss", "near miss", "L1_WITH_L2", "L2_WITH_L1", "ALREADY_INTERSECTED"
+};
+
+typedef struct {
+  Line* l1;
+  Line* l2;
+  PairClass cls;
+} Pair;
+
+static const double timeStep = 0.5;
+static volatile double sink;
+
+static double uniform(double lo, double hi) {
+  return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+static void make_line(Line* l, double cx, double cy, double length,
+                      double vx, double vy, unsigned int id) {
+  double angle = uniform(0, 2 * 3.14159265358979);
+  double dx = length / 2 * cos(angle);
+  double dy = length / 2 * sin(angle);
+  memset(l, 0, sizeof(Line));
+  l->p1 = Vec_make(cx - dx, cy - dy);
+  l->p2 = Vec_make(cx + dx, cy + dy);
+  l->max_x_is_p1 = l->p1.x > l->p2.x;
+  l->max_y_is_p1 = l->p1.y > l->p2.y;
+  l->velocity = Vec_make(vx, vy);
+  l->color = RED;
+  l->id = id;
+  update_box(l, timeStep);
+}
+
+static PairClass classify(Line* l1, Line* l2) {
+  bool overlap = l1->l_x <= l2->u_x && l1->u_x >= l2->l_x &&
+                 l1->l_y <= l2->u_y && l1->u_y >= l2->l_y;
+  switch (intersect(l1, l2, timeStep)) {
+    case L1_WITH_L2:
+      return CLASS_L1_WITH_L2;
+    case L2_WITH_L1:
+      return CLASS_L2_WITH_L1;
+    case ALREADY_INTERSECTED:
+      return CLASS_ALREADY_INTERSECTED;
+    default:
+      return overlap ? CLASS_NEAR_MISS : CLASS_AABB_MISS;
+  }
+}
+
+// Fills pairs with n pairs whose classes follow the requested quotas, by
+// rejection sampling nearby line pairs.  Returns the number generated.
+static int generate(Line* lines, Pair* pairs, int n, const int* quota) {
+  int have[NUM_CLASSES] = {0};
+  int count = 0;
+  long attempts = 0;
+  const double length = 0.01;
+  while (count < n && attempts < 1000L * n) {
+    attempts++;
+    Line* l1 = &lines[2 * count];
+    Line* l2 = &lines[2 * count + 1];
+    double cx = uniform(BOX_XMIN + 0.05, BOX_XMAX - 0.05);
+    double cy = uniform(BOX_YMIN + 0.05, BOX_YMAX - 0.05);
+    double spread = uniform(0, 2 * length);
+    make_line(l1, cx, cy, uniform(0.2, 1) * length,
+              uniform(-1, 1) * length, uniform(-1, 1) * length, 2 * count);
+    make_line(l2, cx + uniform(-spread, spread), cy + uniform(-spread, spread),
+              uniform(0.2, 1) * length,
+              uniform(-1, 1) * length, uniform(-1, 1) * length,
+              2 * count + 1);
+    PairClass cls = classify(l1, l2);
+    if (have[cls] >= quota[cls]) {
+      continue;
+    }
+    have[cls]++;
+    pairs[count].l1 = l1;
+    pairs[count].l2 = l2;
+    pairs[count].cls = cls;
+    count++;
+  }
+  return count;
+}
+
+static void shuffle(Pair* pairs, int n) {
+  for (int i = n - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    Pair tmp = pairs[i];
+    pairs[i] = pairs[j];
+    pairs[j] = tmp;
+  }
+}
+
+static int compare_class(const void* a, const void* b) {
+  return ((const Pair*) a)->cls - ((const Pair*) b)->cls;
+}
+
+static void report(const char* name, double seconds, long ops) {
+  printf("%-24s %10.2f ns/op %10.2f Mops/s\n", name,
+         seconds * 1e9 / ops, ops / seconds * 1e-6);
+}
+
+static void bench_intersect(Pair* pairs, int n, int reps) {
+  int hits = 0;
+  fasttime_t start = gettime();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      hits += intersect(pairs[i].l1, pairs[i].l2, timeStep) != NO_INTERSECTION;
+    }
+  }
+  report("intersect", tdiff(start, gettime()), (long) n * reps);
+  sink = hits;
+}
+
+static void bench_intersectLines(Pair* pairs, int n, int reps) {
+  int hits = 0;
+  fasttime_t start = gettime();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      Line* l1 = pairs[i].l1;
+      Line* l2 = pairs[i].l2;
+      hits += intersectLines(l1->p1, l1->p2, l2->p1, l2->p2);
+    }
+  }
+  report("intersectLines", tdiff(start, gettime()), (long) n * reps);
+  sink = hits;
+}
+
+static void bench_pointInParallelogram(Pair* pairs, int n, int reps) {
+  int hits = 0;
+  fasttime_t start = gettime();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      Line* l1 = pairs[i].l1;
+      Line* l2 = pairs[i].l2;
+      Vec p1 = {.x = l2->p3.x - l1->delta.x, .y = l2->p3.y - l1->delta.y};
+      Vec p2 = {.x = l2->p4.x - l1->delta.x, .y = l2->p4.y - l1->delta.y};
+      hits += pointInParallelogram(l1->p1, l2->p1, l2->p2, p1, p2);
+    }
+  }
+  report("pointInParallelogram", tdiff(start, gettime()), (long) n * reps);
+  sink = hits;
+}
+
+static void bench_getIntersectionPoint(Pair* pairs, int n, int reps) {
+  double sum = 0;
+  fasttime_t start = gettime();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      Line* l1 = pairs[i].l1;
+      Line* l2 = pairs[i].l2;
+      Vec p = getIntersectionPoint(l1->p1, l1->p2, l2->p1, l2->p2);
+      sum += p.x + p.y;
+    }
+  }
+  report("getIntersectionPoint", tdiff(start, gettime()), (long) n * reps);
+  sink = sum;
+}
+
+static void bench_getQuad(Line* lines, int n, int reps) {
+  QuadTreeParams params = QUADTREE_DEFAULT_PARAMS;
+  QuadTree* q = QuadTree_make(BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX, &params);
+  int sum = 0;
+  fasttime_t start = gettime();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      sum += QuadTree_getQuad(q, &lines[i], timeStep);
+    }
+  }
+  report("QuadTree_getQuad", tdiff(start, gettime()), (long) n * reps);
+  sink = sum;
+  QuadTree_delete(q);
+}
+
+static void bench_update_box(Line* lines, int n, int reps) {
+  double sum = 0;
+  fasttime_t start = gettime();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      update_box(&lines[i], timeStep);
+    }
+    sum += lines[r % n].u_x;
+  }
+  report("update_box", tdiff(start, gettime()), (long) n * reps);
+  sink = sum;
+}
+
+// Only pairs that are actual events can be passed to the solver.  Line
+// velocities are restored before each repetition so every repetition
+// solves the same collisions.
+static void bench_collisionSolver(Line* lines, int numLines,
+                                  Pair* pairs, int n, int reps) {
+  Line* saved = malloc(numLines * sizeof(Line));
+  memcpy(saved, lines, numLines * sizeof(Line));
+  CollisionWorld* cw = CollisionWorld_new(1);
+  double seconds = 0;
+  long ops = 0;
+  for (int r = 0; r < reps; r++) {
+    memcpy(lines, saved, numLines * sizeof(Line));
+    fasttime_t start = gettime();
+    for (int i = 0; i < n; i++) {
+      if (pairs[i].cls >= CLASS_L1_WITH_L2) {
+        CollisionWorld_collisionSolver(
+            cw, pairs[i].l1, pairs[i].l2,
+            (IntersectionType) (pairs[i].cls - CLASS_L1_WITH_L2 + L1_WITH_L2));
+        ops++;
+      }
+    }
+    seconds += tdiff(start, gettime());
+  }
+  if (ops) {
+    report("collisionSolver", seconds, ops);
+  }
+  memcpy(lines, saved, numLines * sizeof(Line));
+  CollisionWorld_delete(cw);
+  free(saved);
+}
+
+// Whether two runs of the same batch found the same lines.
+static bool same_answers(const SpatialQueryBatch* a,
+                         const SpatialQueryBatch* b) {
+  for (int i = 0; i < a->count; i++) {
+    const SpatialQuery* x = &a->queries[i];
+    const SpatialQuery* y = &b->queries[i];
+    if (x->count != y->count || (x->count && x->distance != y->distance) ||
+        memcmp(x->ids, y->ids, x->count * sizeof(unsigned int)) != 0) {
+      printf("query %d (type %d) differs: %d lines vs %d\n", i, x->type,
+             x->count, y->count);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Times numQueries queries, a third each of ranges, rays and nearest
+// lines, against all the lines, first from the quadtree of a
+// CollisionWorld holding them and then by brute force.
+static void bench_queries(Line* lines, int numLines, int numQueries,
+                          int reps) {
+  CollisionWorld* cw = CollisionWorld_new(numLines);
+  for (int i = 0; i < numLines; i++) {
+    Line* l = malloc(sizeof(Line));
+    *l = lines[i];
+    CollisionWorld_addLine(cw, l);
+  }
+
+  SpatialQueryBatch* tree = SpatialQueryBatch_new();
+  SpatialQueryBatch* brute = SpatialQueryBatch_new();
+  for (int i = 0; i < numQueries; i++) {
+    Vec a = Vec_make(uniform(BOX_XMIN, BOX_XMAX), uniform(BOX_YMIN, BOX_YMAX));
+    double size = uniform(0, 0.02);
+    double angle = uniform(0, 2 * 3.14159265358979);
+    Vec b = Vec_make(a.x + size, a.y + size);
+    Vec d = Vec_make(0.1 * cos(angle), 0.1 * sin(angle));
+    switch (i % 3) {
+      case 0:
+        SpatialQueryBatch_addRange(tree, a, b);
+        SpatialQueryBatch_addRange(brute, a, b);
+        break;
+      case 1:
+        SpatialQueryBatch_addRay(tree, a, d);
+        SpatialQueryBatch_addRay(brute, a, d);
+        break;
+      default:
+        SpatialQueryBatch_addNearest(tree, a);
+        SpatialQueryBatch_addNearest(brute, a);
+        break;
+    }
+  }
+
+  // The first batch also builds the quadtree, which later ones reuse.
+  fasttime_t start = gettime();
+  CollisionWorld_runQueries(cw, tree);
+  report("queries (first batch)", tdiff(start, gettime()), numQueries);
+  start = gettime();
+  for (int r = 0; r < reps; r++) {
+    CollisionWorld_runQueries(cw, tree);
+  }
+  report("queries (quadtree)", tdiff(start, gettime()),
+         (long) numQueries * reps);
+  start = gettime();
+  SpatialQueryBatch_run(brute, NULL, 0, cw->lines, cw->numOfLines);
+  report("queries (brute force)", tdiff(start, gettime()), numQueries);
+  if (!same_answers(tree, brute)) {
+    printf("quadtree and brute force queries disagree\n");
+  }
+
+  SpatialQueryBatch_delete(tree);
+  SpatialQueryBatch_delete(brute);
+  CollisionWorld_delete(cw);
+}
+
+static void usage(const char* argv0) {
+  printf("Usage: %s [-n pairs] [-r reps] [-h hit ratio] [-m mix] [-s seed]"
+         " [-g] [-q queries]\n", argv0);
+  printf("  -n : number of line pairs (default 100000)\n");
+  printf("  -r : repetitions of each kernel (default 20)\n");
+  printf("  -h : fraction of pairs that are events (default 0.1)\n");
+  printf("  -a : fraction of misses that overlap in AABB (default 0.5)\n");
+  printf("  -m : L1_WITH_L2,L2_WITH_L1,ALREADY_INTERSECTED weights of hits"
+         " (default 1,1,1)\n");
+  printf("  -s : random seed (default 1)\n");
+  printf("  -g : group pairs by outcome instead of shuffling them\n");
+  printf("  -q : number of spatial queries, or 0 for none (default 1000)\n");
+  exit(-1);
+}
+
+int main(int argc, char* argv[]) {
+  int n = 100000;
+  int reps = 20;
+  double hitRatio = 0.1;
+  double nearRatio = 0.5;
+  double mix[3] = {1, 1, 1};
+  unsigned int seed = 1;
+  bool grouped = false;
+  int numQueries = 1000;
+  int optchar;
+
+  while ((optchar = getopt(argc, argv, "n:r:h:a:m:s:gq:")) != -1) {
+    switch (optchar) {
+      case 'n':
+        n = atoi(optarg);
+        break;
+      case 'r':
+        reps = atoi(optarg);
+        break;
+      case 'h':
+        hitRatio = atof(optarg);
+        break;
+      case 'a':
+        nearRatio = atof(optarg);
+        break;
+      case 'm':
+        if (sscanf(optarg, "%lf,%lf,%lf", &mix[0], &mix[1], &mix[2]) != 3) {
+          usage(argv[0]);
+        }
+        break;
+      case 's':
+        seed = atoi(optarg);
+        break;
+      case 'g':
+        grouped = true;
+        break;
+      case 'q':
+        numQueries = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (n <= 0 || reps <= 0 || hitRatio < 0 || hitRatio > 1 ||
+      numQueries < 0) {
+    usage(argv[0]);
+  }
+  srand(seed);
+
+  int quota[NUM_CLASSES];
+  int hits = (int) (n * hitRatio + 0.5);
+  double mixTotal = mix[0] + mix[1] + mix[2];
+  quota[CLASS_L1_WITH_L2] = (int) (hits * mix[0] / mixTotal + 0.5);
+  quota[CLASS_L2_WITH_L1] = (int) (hits * mix[1] / mixTotal + 0.5);
+  quota[CLASS_ALREADY_INTERSECTED] =
+      hits - quota[CLASS_L1_WITH_L2] - quota[CLASS_L2_WITH_L1];
+  quota[CLASS_NEAR_MISS] = (int) ((n - hits) * nearRatio + 0.5);
+  quota[CLASS_AABB_MISS] = n - hits - quota[CLASS_NEAR_MISS];
+
+  Line* lines = malloc(2 * n * sizeof(Line));
+  Pair* pairs = malloc(n * sizeof(Pair));
+  int generated = generate(lines, pairs, n, quota);
+  if (generated < n) {
+    fprintf(stderr, "warning: only %d of %d pairs could be generated with "
+            "this mix\n", generated, n);
+    n = generated;
+  }
+  if (grouped) {
+    qsort(pairs, n, sizeof(Pair), compare_class);
+  } else {
+    shuffle(pairs, n);
+  }
+
+  int have[NUM_CLASSES] = {0};
+  for (int i = 0; i < n; i++) {
+    have[pairs[i].cls]++;
+  }
+  printf("%d pairs (%s), %d repetitions\n", n,
+         grouped ? "grouped" : "shuffled", reps);
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    printf("  %-20s %d\n", class_names[c], have[c]);
+  }
+
+  bench_intersect(pairs, n, reps);
+  bench_intersectLines(pairs, n, reps);
+  bench_pointInParallelogram(pairs, n, reps);
+  bench_getIntersectionPoint(pairs, n, reps);
+  bench_getQuad(lines, 2 * n, reps);
+  bench_update_box(lines, 2 * n, reps);
+  bench_collisionSolver(lines, 2 * n, pairs, n, reps);
+  if (numQueries > 0) {
+    bench_queries(lines, 2 * n, numQueries, reps);
+  }
+
+  free(pairs);
+  free(lines);
+  return 0;
+}
@@ -24,6 +24,8 @@
 #ifndef LINE_H_
 #define LINE_H_
 
+#include <limits.h>
+
 #include "./GraphicStuff.h"
 #include "./Vec.h"
 
@@ -46,6 +48,9 @@
 typedef double window_dimension;
 typedef vec_dimension box_dimension;
 
+// The slot of a line that has been removed from its CollisionWorld.
+#define LINE_REMOVED UINT_MAX
+
 // The allowable colors for a line.
 typedef enum {
   RED = 0,
@@ -62,7 +67,7 @@ struct Line {
   Vec delta;
 
   bool max_x_is_p1, max_y_is_p1;
-  double u_x, l_x, u_y, l_y;
+  vec_dimension u_x, l_x, u_y, l_y;
 
   struct Line* next;
 
@@ -71,6 +76,23 @@ struct Line {
 
   Color color;  // The line's color.
 
+  // Whether the line had zero velocity when the static index was last built.
+  bool isStatic;
+
+  // Wall pass at which the line is next checked against the walls, or 0.
+  unsigned int wallDue;
+
+  // Whether the line is skipped by the per-frame work until frame wakeFrame,
+  // and the number of position updates applied to it so far.
+  bool asleep;
+  unsigned int wakeFrame;
+  unsigned int stepsDone;
+
+  // Index of the line in the CollisionWorld's lines, or LINE_REMOVED, and
+  // in its dynamicLines while it is there.
+  unsigned int slot;
+  unsigned int dynamicIndex;
+
   unsigned int id;  // Unique line ID.
 };
 typedef struct Line Line;
@@ -83,6 +105,49 @@ static inline int compareLines(Line *l1, Line *l2) {
   return l1->id < l2->id ? -1 : l1->id > l2->id;
 }
 
+// Moves l by one time step t.
+static inline void step_line(Line* l, double t) {
+  vec_dimension dx = l->velocity.x * t;
+  vec_dimension dy = l->velocity.y * t;
+  l->p1.x += dx;
+  l->p1.y += dy;
+  l->p2.x += dx;
+  l->p2.y += dy;
+}
+
+// Reverses the velocity of l away from the first of the walls at x = xmin,
+// x = xmax, y = ymin and y = ymax it has crossed while moving towards it, if
+// any, and returns whether it did.
+static inline bool bounce_off_bounds(Line* l, double xmin, double xmax,
+                                     double ymin, double ymax) {
+  // Right side
+  if ((l->p1.x > xmax || l->p2.x > xmax) && (l->velocity.x > 0)) {
+    l->velocity.x = -l->velocity.x;
+    return true;
+  }
+  // Left side
+  if ((l->p1.x < xmin || l->p2.x < xmin) && (l->velocity.x < 0)) {
+    l->velocity.x = -l->velocity.x;
+    return true;
+  }
+  // Top side
+  if ((l->p1.y > ymax || l->p2.y > ymax) && (l->velocity.y > 0)) {
+    l->velocity.y = -l->velocity.y;
+    return true;
+  }
+  // Bottom side
+  if ((l->p1.y < ymin || l->p2.y < ymin) && (l->velocity.y < 0)) {
+    l->velocity.y = -l->velocity.y;
+    return true;
+  }
+  return false;
+}
+
+// Bounces l off the walls of the box, as bounce_off_bounds.
+static inline bool bounce_off_walls(Line* l) {
+  return bounce_off_bounds(l, BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX);
+}
+
 static inline void update_box(Line* l, double t) {
   l->delta.x = l->velocity.x * t;
   l->delta.y = l->velocity.y * t;
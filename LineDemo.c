@@ -21,42 +21,80 @@
  * SOFTWARE.
  **/
 
+#include "./fasttime.h"
 #include "./LineDemo.h"
 
 #include <time.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "./GraphicStuff.h"
 #include "./Line.h"
 
-static char* LineDemo_input_file_path;
-
-void LineDemo_setInputFile(char* input_file_path) {
-  LineDemo_input_file_path = input_file_path;
-}
-
 LineDemo* LineDemo_new() {
   LineDemo* lineDemo = malloc(sizeof(LineDemo));
   if (lineDemo == NULL) {
     return NULL;
   }
 
+  lineDemo->inputFilePath = NULL;
   lineDemo->count = 0;
   lineDemo->numFrames = 0;
   lineDemo->collisionWorld = NULL;
+  Histogram_init(&lineDemo->frameLatency);
+  lineDemo->statsPage = NULL;
+  lineDemo->autotune = NULL;
+  lineDemo->frameWriter = NULL;
+  lineDemo->commandPipe = NULL;
   return lineDemo;
 }
 
 void LineDemo_delete(LineDemo* lineDemo) {
+  if (lineDemo->statsPage) {
+    StatsPage_close(lineDemo->statsPage);
+  }
+  if (lineDemo->autotune) {
+    Autotune_delete(lineDemo->autotune);
+  }
+  LineDemo_closeFrameWriter(lineDemo);
+  if (lineDemo->commandPipe) {
+    CommandPipe_close(lineDemo->commandPipe);
+  }
   CollisionWorld_delete(lineDemo->collisionWorld);
   free(lineDemo);
 }
 
+// The format of a line in an input file and of an add command:
+// (x1, y1), (x2, y2), vx, vy, isGray, in window coordinates.
+#define LINE_FORMAT "(%lf, %lf), (%lf, %lf), %lf, %lf, %d"
+
+// Makes a line from its description in window coordinates.
+static Line* make_line(LineDemo* lineDemo, window_dimension px1,
+                       window_dimension py1, window_dimension px2,
+                       window_dimension py2, window_dimension vx,
+                       window_dimension vy, int isGray) {
+  Line *line = malloc(sizeof(Line));
+
+  // convert window coordinates to box coordinates
+  windowToBox(&line->p1.x, &line->p1.y, px1, py1);
+  windowToBox(&line->p2.x, &line->p2.y, px2, py2);
+
+  line->max_x_is_p1 = (line->p1.x > line->p2.x);
+  line->max_y_is_p1 = (line->p1.y > line->p2.y);
+
+  // convert window velocity to box velocity
+  velocityWindowToBox(&line->velocity.x, &line->velocity.y, vx, vy);
+  update_box(line, lineDemo->collisionWorld->timeStep);
+
+  // store color
+  line->color = (Color) isGray;
+  return line;
+}
+
 // Read in lines from line.in and add them into collision world for simulation.
 void LineDemo_createLines(LineDemo* lineDemo) {
-  unsigned int lineId = 0;
   unsigned int numOfLines;
   window_dimension px1;
   window_dimension py1;
@@ -66,41 +104,53 @@ void LineDemo_createLines(LineDemo* lineDemo) {
   window_dimension vy;
   int isGray;
   FILE *fin;
-  fin = fopen(LineDemo_input_file_path, "r");
+  fin = fopen(lineDemo->inputFilePath, "r");
   assert(fin != NULL);
 
   fscanf(fin, "%d\n", &numOfLines);
   lineDemo->collisionWorld = CollisionWorld_new(numOfLines);
 
-  while (EOF
-      != fscanf(fin, "(%lf, %lf), (%lf, %lf), %lf, %lf, %d\n", &px1, &py1, &px2,
-                &py2, &vx, &vy, &isGray)) {
-    Line *line = malloc(sizeof(Line));
-
-    // convert window coordinates to box coordinates
-    windowToBox(&line->p1.x, &line->p1.y, px1, py1);
-    windowToBox(&line->p2.x, &line->p2.y, px2, py2);
-
-    line->max_x_is_p1 = (line->p1.x > line->p2.x);
-    line->max_y_is_p1 = (line->p1.y > line->p2.y);
-
-    // convert window velocity to box velocity
-    velocityWindowToBox(&line->velocity.x, &line->velocity.y, vx, vy);
-    update_box(line, lineDemo->collisionWorld->timeStep);
-
-    // store color
-    line->color = (Color) isGray;
-
-    // store line ID
-    line->id = lineId;
-    lineId++;
-
-    // transfer ownership of line to collisionWorld
-    CollisionWorld_addLine(lineDemo->collisionWorld, line);
+  while (EOF != fscanf(fin, LINE_FORMAT "\n", &px1, &py1, &px2, &py2, &vx,
+                       &vy, &isGray)) {
+    // transfer ownership of line to collisionWorld, which gives it an ID
+    CollisionWorld_addLine(lineDemo->collisionWorld,
+                           make_line(lineDemo, px1, py1, px2, py2, vx, vy,
+                                     isGray));
   }
   fclose(fin);
 }
 
+// Applies the commands that have arrived on the command pipe:
+//   add (x1, y1), (x2, y2), vx, vy, isGray
+//   remove id
+// Each add prints the ID the new line was given.
+static void apply_commands(LineDemo* lineDemo) {
+  CollisionWorld* cw = lineDemo->collisionWorld;
+  char* command;
+  while ((command = CommandPipe_next(lineDemo->commandPipe)) != NULL) {
+    window_dimension px1, py1, px2, py2, vx, vy;
+    int isGray;
+    unsigned int id;
+    if (sscanf(command, " add " LINE_FORMAT, &px1, &py1, &px2, &py2, &vx,
+               &vy, &isGray) == 7) {
+      id = CollisionWorld_addLine(cw, make_line(lineDemo, px1, py1, px2, py2,
+                                                vx, vy, isGray));
+      printf("added %u\n", id);
+      fflush(stdout);
+    } else if (sscanf(command, " remove %u", &id) == 1) {
+      if (!CollisionWorld_removeLine(cw, id)) {
+        fprintf(stderr, "No line %u to remove\n", id);
+      }
+    } else if (command[strspn(command, " \t\r")] != '\0') {
+      fprintf(stderr, "Ignoring command: %s\n", command);
+    }
+  }
+}
+
+void LineDemo_setInputFile(LineDemo* lineDemo, char* inputFilePath) {
+  lineDemo->inputFilePath = inputFilePath;
+}
+
 void LineDemo_setNumFrames(LineDemo* lineDemo, const unsigned int numFrames) {
   lineDemo->numFrames = numFrames;
 }
@@ -125,12 +175,117 @@ unsigned int LineDemo_getNumLineLineCollisions(LineDemo* lineDemo) {
   return CollisionWorld_getNumLineLineCollisions(lineDemo->collisionWorld);
 }
 
+const Histogram* LineDemo_getFrameLatency(LineDemo* lineDemo) {
+  return &lineDemo->frameLatency;
+}
+
+bool LineDemo_openStatsPage(LineDemo* lineDemo, const char* name) {
+  lineDemo->statsPage = StatsPage_open(name);
+  return lineDemo->statsPage != NULL;
+}
+
+bool LineDemo_openFrameWriter(LineDemo* lineDemo, const char* pattern,
+                              unsigned int every) {
+  lineDemo->frameWriter = FrameWriter_new(pattern, every);
+  if (lineDemo->frameWriter == NULL) {
+    return false;
+  }
+  FrameWriter_frame(lineDemo->frameWriter, lineDemo->collisionWorld);
+  return true;
+}
+
+bool LineDemo_openCommandPipe(LineDemo* lineDemo, const char* path) {
+  lineDemo->commandPipe = CommandPipe_open(path);
+  return lineDemo->commandPipe != NULL;
+}
+
+int LineDemo_closeFrameWriter(LineDemo* lineDemo) {
+  if (lineDemo->frameWriter == NULL) {
+    return 0;
+  }
+  int numImages = FrameWriter_numImages(lineDemo->frameWriter);
+  bool ok = FrameWriter_close(lineDemo->frameWriter);
+  lineDemo->frameWriter = NULL;
+  return ok ? numImages : -1;
+}
+
+void LineDemo_setQuadTreeParams(LineDemo* lineDemo,
+                                const QuadTreeParams* params) {
+  CollisionWorld_setQuadTreeParams(lineDemo->collisionWorld, params);
+}
+
+const QuadTreeParams* LineDemo_getQuadTreeParams(LineDemo* lineDemo) {
+  return CollisionWorld_getQuadTreeParams(lineDemo->collisionWorld);
+}
+
+void LineDemo_enableAutotune(LineDemo* lineDemo) {
+  lineDemo->autotune = Autotune_new(lineDemo->inputFilePath,
+                                    LineDemo_getQuadTreeParams(lineDemo));
+  LineDemo_setQuadTreeParams(lineDemo, Autotune_params(lineDemo->autotune));
+}
+
+void LineDemo_setAdaptiveStepping(LineDemo* lineDemo, bool enabled) {
+  CollisionWorld_setAdaptiveStepping(lineDemo->collisionWorld, enabled);
+}
+
+void LineDemo_setValidation(LineDemo* lineDemo, unsigned int k) {
+  CollisionWorld_setValidation(lineDemo->collisionWorld, k);
+}
+
+const Oracle* LineDemo_getOracle(LineDemo* lineDemo) {
+  return CollisionWorld_getOracle(lineDemo->collisionWorld);
+}
+
+bool LineDemo_writePositions(LineDemo* lineDemo, const char* path) {
+  FILE* out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    return false;
+  }
+  unsigned int n = LineDemo_getNumOfLines(lineDemo);
+  for (unsigned int i = 0; i < n; i++) {
+    Line* l = LineDemo_getLine(lineDemo, i);
+    window_dimension x1, y1, x2, y2;
+    boxToWindow(&x1, &y1, l->p1.x, l->p1.y);
+    boxToWindow(&x2, &y2, l->p2.x, l->p2.y);
+    fprintf(out, "%u %.17g %.17g %.17g %.17g\n", l->id, x1, y1, x2, y2);
+  }
+  fclose(out);
+  return true;
+}
+
 // The main simulation loop
 bool LineDemo_update(LineDemo* lineDemo) {
+  if (lineDemo->commandPipe) {
+    apply_commands(lineDemo);
+  }
   lineDemo->count++;
+  const fasttime_t start = gettime();
   CollisionWorld_updateLines(lineDemo->collisionWorld);
-  if (lineDemo->count > lineDemo->numFrames) {
+  const fasttime_t end = gettime();
+  Histogram_record(&lineDemo->frameLatency,
+                   (uint64_t) (tdiff(start, end) * 1e9));
+  if (lineDemo->autotune) {
+    Autotune_frame(lineDemo->autotune, tdiff(start, end));
+    LineDemo_setQuadTreeParams(lineDemo, Autotune_params(lineDemo->autotune));
+  }
+  bool last = lineDemo->count > lineDemo->numFrames;
+  if (lineDemo->statsPage && last) {
+    StatsPage_flush(lineDemo->statsPage, lineDemo->count,
+                    LineDemo_getNumLineWallCollisions(lineDemo),
+                    LineDemo_getNumLineLineCollisions(lineDemo),
+                    &lineDemo->frameLatency);
+  } else if (lineDemo->statsPage) {
+    StatsPage_publish(lineDemo->statsPage, lineDemo->count,
+                      LineDemo_getNumLineWallCollisions(lineDemo),
+                      LineDemo_getNumLineLineCollisions(lineDemo),
+                      &lineDemo->frameLatency);
+  }
+  if (last) {
     return false;
   }
+  if (lineDemo->frameWriter) {
+    FrameWriter_frame(lineDemo->frameWriter, lineDemo->collisionWorld);
+  }
   return true;
 }
@@ -25,9 +25,17 @@
 #define LINEDEMO_H_
 
 #include "./Line.h"
+#include "./Autotune.h"
 #include "./CollisionWorld.h"
+#include "./CommandPipe.h"
+#include "./FrameWriter.h"
+#include "./Histogram.h"
+#include "./StatsPage.h"
 
 struct LineDemo {
+  // File the lines are read from
+  char* inputFilePath;
+
   // Iteration counter
   unsigned int count;
 
@@ -36,12 +44,30 @@ struct LineDemo {
 
   // Objects for line simulation
   CollisionWorld* collisionWorld;
+
+  // Wall-clock latency of each frame, in nanoseconds
+  Histogram frameLatency;
+
+  // Live statistics page, or NULL if not publishing
+  StatsPage* statsPage;
+
+  // Quadtree parameter tuner, or NULL if not autotuning
+  Autotune* autotune;
+
+  // Image sequence writer, or NULL if not writing frames
+  FrameWriter* frameWriter;
+
+  // Source of commands to add and remove lines between frames, or NULL
+  CommandPipe* commandPipe;
 };
 typedef struct LineDemo LineDemo;
 
 LineDemo* LineDemo_new();
 void LineDemo_delete(LineDemo* lineDemo);
 
+// Set the file that LineDemo_initLine reads the lines from.
+void LineDemo_setInputFile(LineDemo* lineDemo, char* inputFilePath);
+
 // Add lines for line simulation at beginning.
 void LineDemo_createLines(LineDemo* lineDemo);
 
@@ -63,9 +89,48 @@ unsigned int LineDemo_getNumLineWallCollisions(LineDemo* lineDemo);
 // Get number of line-line collisions.
 unsigned int LineDemo_getNumLineLineCollisions(LineDemo* lineDemo);
 
+// Write the final position of every line, in window coordinates, to path.
+bool LineDemo_writePositions(LineDemo* lineDemo, const char* path);
+
 // Line simulation update function.
 bool LineDemo_update(LineDemo* lineDemo);
 
-void LineDemo_setInputFile(char* input_file_path);
+// Get the histogram of frame latencies, in nanoseconds.
+const Histogram* LineDemo_getFrameLatency(LineDemo* lineDemo);
+
+// Publish live statistics to the shared memory object name while running.
+bool LineDemo_openStatsPage(LineDemo* lineDemo, const char* name);
+
+// Write every kth frame, starting with the current one, as an image named
+// by the printf pattern.
+bool LineDemo_openFrameWriter(LineDemo* lineDemo, const char* pattern,
+                              unsigned int every);
+
+// Wait for the frames being written and stop writing frames.  Returns the
+// number of images written, or -1 if any could not be written.
+int LineDemo_closeFrameWriter(LineDemo* lineDemo);
+
+// Before each frame, apply the add and remove commands that have arrived
+// from the file or named pipe at path ("-" for standard input).
+bool LineDemo_openCommandPipe(LineDemo* lineDemo, const char* path);
+
+// Set the quadtree parameters.
+void LineDemo_setQuadTreeParams(LineDemo* lineDemo,
+                                const QuadTreeParams* params);
+
+// Get the quadtree parameters in use.
+const QuadTreeParams* LineDemo_getQuadTreeParams(LineDemo* lineDemo);
+
+// Tune the quadtree parameters while running, starting from the current ones.
+void LineDemo_enableAutotune(LineDemo* lineDemo);
+
+// Step lines far from everything else several frames at a time.
+void LineDemo_setAdaptiveStepping(LineDemo* lineDemo, bool enabled);
+
+// Check every kth frame against a brute-force reference, or none if k is 0.
+void LineDemo_setValidation(LineDemo* lineDemo, unsigned int k);
+
+// Get the reference the frames are checked against, or NULL if none are.
+const Oracle* LineDemo_getOracle(LineDemo* lineDemo);
 
 #endif  // LINEDEMO_H_
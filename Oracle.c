@@ -0,0 +1,315 @@
+#include "./Oracle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+
+#include "./CollisionWorld.h"
+#include "./IntersectionDetection.h"
+
+Oracle* Oracle_new() {
+  Oracle* oracle = malloc(sizeof(Oracle));
+  if (oracle == NULL) {
+    return NULL;
+  }
+  oracle->lines = NULL;
+  oracle->before = NULL;
+  oracle->numLines = 0;
+  oracle->capacity = 0;
+  oracle->timeStep = 0;
+  oracle->events = IntersectionEventList_make();
+  oracle->numWallCollisions = 0;
+  oracle->bounced = NULL;
+  oracle->frame = 0;
+  oracle->active = false;
+  oracle->numFrames = 0;
+  oracle->diverged = false;
+  oracle->report = stderr;
+  return oracle;
+}
+
+void Oracle_delete(Oracle* oracle) {
+  IntersectionEventList_deleteNodes(&oracle->events);
+  free(oracle->lines);
+  free(oracle->before);
+  free(oracle->bounced);
+  free(oracle);
+}
+
+static const char* type_name(IntersectionType type) {
+  switch (type) {
+    case NO_INTERSECTION:
+      return "NO_INTERSECTION";
+    case L1_WITH_L2:
+      return "L1_WITH_L2";
+    case L2_WITH_L1:
+      return "L2_WITH_L1";
+    case ALREADY_INTERSECTED:
+      return "ALREADY_INTERSECTED";
+  }
+  return "?";
+}
+
+static int compare_copies(const void* a, const void* b) {
+  return compareLines((Line*) a, (Line*) b);
+}
+
+// The copy of the line with ID id among the n sorted copies, or NULL.
+static Line* find_copy(Line* copies, unsigned int n, unsigned int id) {
+  Line key;
+  key.id = id;
+  return bsearch(&key, copies, n, sizeof(Line), compare_copies);
+}
+
+static inline bool boxes_overlap(Line* l1, Line* l2) {
+  return l1->l_x <= l2->u_x && l1->u_x >= l2->l_x &&
+         l1->l_y <= l2->u_y && l1->u_y >= l2->l_y;
+}
+
+void Oracle_beginFrame(Oracle* oracle, Line** lines, unsigned int n,
+                       double timeStep, unsigned int frame) {
+  if (oracle->diverged) {
+    return;
+  }
+  if (n > oracle->capacity) {
+    oracle->lines = realloc(oracle->lines, n * sizeof(Line));
+    oracle->before = realloc(oracle->before, n * sizeof(Line));
+    oracle->bounced = realloc(oracle->bounced, n * sizeof(bool));
+    assert(oracle->lines && oracle->before && oracle->bounced);
+    oracle->capacity = n;
+  }
+  for (int i = 0; i < n; i++) {
+    oracle->lines[i] = *lines[i];
+  }
+  qsort(oracle->lines, n, sizeof(Line), compare_copies);
+  for (int i = 0; i < n; i++) {
+    update_box(&oracle->lines[i], timeStep);
+  }
+  memcpy(oracle->before, oracle->lines, n * sizeof(Line));
+  oracle->numLines = n;
+  oracle->timeStep = timeStep;
+  oracle->frame = frame;
+  oracle->active = true;
+
+  // Every pair, in ID order.  The reducer keeps the events in the order of
+  // the serial loop, which is the order the engine sorts its events into.
+  IntersectionEventList_deleteNodes(&oracle->events);
+  IntersectionEventListReducer ielr = CILK_C_INIT_REDUCER(
+    IntersectionEventList,
+    intersection_event_list_reduce,
+    intersection_event_list_identity,
+    intersection_event_list_destroy,
+    IntersectionEventList_make()
+  );
+  CILK_C_REGISTER_REDUCER(ielr);
+  Line* copies = oracle->lines;
+  cilk_for (int i = 0; i < n; i++) {
+    for (int j = i + 1; j < n; j++) {
+      if (!boxes_overlap(&copies[i], &copies[j])) {
+        continue;
+      }
+      IntersectionType type = classifyIntersection(&copies[i], &copies[j]);
+      if (type != NO_INTERSECTION) {
+        IntersectionEventList_appendNode(&REDUCER_VIEW(ielr), &copies[i],
+                                         &copies[j], type);
+      }
+    }
+  }
+  oracle->events = REDUCER_VIEW(ielr);
+  CILK_C_UNREGISTER_REDUCER(ielr);
+
+  // The solver keeps no state in the CollisionWorld.
+  for (IntersectionEventNode* node = oracle->events.head; node;
+       node = node->next) {
+    CollisionWorld_collisionSolver(NULL, node->l1, node->l2,
+                                   node->intersectionType);
+  }
+  oracle->numWallCollisions = 0;
+  for (int i = 0; i < n; i++) {
+    step_line(&copies[i], timeStep);
+    oracle->bounced[i] = bounce_off_walls(&copies[i]);
+    if (oracle->bounced[i]) {
+      oracle->numWallCollisions++;
+    }
+  }
+}
+
+// Marks the frame as diverged and starts the report.
+static FILE* begin_report(Oracle* oracle, const char* what) {
+  oracle->diverged = true;
+  oracle->active = false;
+  fprintf(oracle->report, "Validation: frame %u diverges from the brute-force"
+          " reference in %s\n", oracle->frame, what);
+  return oracle->report;
+}
+
+static void print_state(FILE* out, const char* label, const Line* l) {
+  fprintf(out, "    %-10s p1 (%.17g, %.17g) p2 (%.17g, %.17g)"
+          " velocity (%.17g, %.17g)\n", label, l->p1.x, l->p1.y, l->p2.x,
+          l->p2.y, l->velocity.x, l->velocity.y);
+}
+
+// Prints the line with ID id as it was before the frame, with how the
+// engine was treating it.
+static void print_line(FILE* out, Oracle* oracle, unsigned int id) {
+  Line* l = find_copy(oracle->before, oracle->numLines, id);
+  if (l == NULL) {
+    fprintf(out, "  line %u: not in the box\n", id);
+    return;
+  }
+  if (l->isStatic) {
+    fprintf(out, "  line %u, static:\n", id);
+  } else if (l->asleep) {
+    fprintf(out, "  line %u, asleep until frame %u:\n", id, l->wakeFrame + 1);
+  } else {
+    fprintf(out, "  line %u, moving:\n", id);
+  }
+  print_state(out, "before", l);
+}
+
+// Prints the reference events of the frame that involve line id, and
+// whether it hit a wall.
+static void print_events_of(FILE* out, Oracle* oracle, unsigned int id) {
+  Line* l = find_copy(oracle->lines, oracle->numLines, id);
+  if (l && oracle->bounced[l - oracle->lines]) {
+    fprintf(out, "  the reference bounces line %u off a wall\n", id);
+  }
+  int n = 0;
+  for (IntersectionEventNode* node = oracle->events.head; node;
+       node = node->next) {
+    if (node->l1->id == id || node->l2->id == id) {
+      fprintf(out, "  reference event: lines %u and %u, %s\n", node->l1->id,
+              node->l2->id, type_name(node->intersectionType));
+      n++;
+    }
+  }
+  if (n == 0) {
+    fprintf(out, "  no reference events involve line %u\n", id);
+  }
+}
+
+static void report_event(Oracle* oracle, unsigned int id1, unsigned int id2,
+                         IntersectionType found, IntersectionType expected,
+                         int numFound) {
+  FILE* out = begin_report(oracle, "its line-line events");
+  fprintf(out, "  lines %u and %u: engine %s, reference %s\n", id1, id2,
+          type_name(found), type_name(expected));
+  fprintf(out, "  events this frame: engine %d, reference %d\n", numFound,
+          oracle->events.count);
+  print_line(out, oracle, id1);
+  print_line(out, oracle, id2);
+
+  Line* l1 = find_copy(oracle->before, oracle->numLines, id1);
+  Line* l2 = find_copy(oracle->before, oracle->numLines, id2);
+  if (l1 && l2) {
+    Line a = *l1;
+    Line b = *l2;
+    IntersectionType fast = intersect(&a, &b, oracle->timeStep);
+    fprintf(out, "  intersect() on the lines before the frame: %s\n",
+            type_name(fast));
+    if (fast == expected) {
+      fprintf(out, "  The narrow phase agrees with the reference, so the pair"
+              " was tested from other\n  positions or not at all: look at the"
+              " quadtree, the static index and sleeping.\n");
+    } else {
+      fprintf(out, "  The narrow phase disagrees with the full classification:"
+              " look at the early\n  rejection tests in intersect().\n");
+    }
+  }
+}
+
+bool Oracle_checkEvents(Oracle* oracle, const IntersectionEventList* events) {
+  if (!oracle->active) {
+    return !oracle->diverged;
+  }
+  IntersectionEventNode* expected = oracle->events.head;
+  IntersectionEventNode* found = events->head;
+  IntersectionEventNode* previous = NULL;
+  while (expected || found) {
+    int order = expected == NULL ? 1 : found == NULL ? -1 :
+        IntersectionEventNode_compareData(expected, found);
+    if (order == 0 && expected->intersectionType == found->intersectionType) {
+      previous = found;
+      expected = expected->next;
+      found = found->next;
+      continue;
+    }
+
+    if (order > 0 && previous &&
+        IntersectionEventNode_compareData(previous, found) == 0) {
+      FILE* out = begin_report(oracle, "its line-line events");
+      fprintf(out, "  lines %u and %u: the engine reports the pair twice\n",
+              found->l1->id, found->l2->id);
+      print_line(out, oracle, found->l1->id);
+      print_line(out, oracle, found->l2->id);
+    } else if (order < 0) {
+      report_event(oracle, expected->l1->id, expected->l2->id,
+                   NO_INTERSECTION, expected->intersectionType, events->count);
+    } else if (order > 0) {
+      report_event(oracle, found->l1->id, found->l2->id,
+                   found->intersectionType, NO_INTERSECTION, events->count);
+    } else {
+      report_event(oracle, found->l1->id, found->l2->id,
+                   found->intersectionType, expected->intersectionType,
+                   events->count);
+    }
+    return false;
+  }
+  return true;
+}
+
+static inline bool same_state(const Line* a, const Line* b) {
+  return a->p1.x == b->p1.x && a->p1.y == b->p1.y &&
+         a->p2.x == b->p2.x && a->p2.y == b->p2.y &&
+         a->velocity.x == b->velocity.x && a->velocity.y == b->velocity.y;
+}
+
+bool Oracle_endFrame(Oracle* oracle, Line** lines, unsigned int n,
+                     unsigned int numWallCollisions) {
+  if (!oracle->active) {
+    return !oracle->diverged;
+  }
+  if (n != oracle->numLines) {
+    FILE* out = begin_report(oracle, "its number of lines");
+    fprintf(out, "  engine %u, reference %u\n", n, oracle->numLines);
+    return false;
+  }
+
+  // Report the differing line with the lowest ID, whatever the engine's
+  // order of lines.
+  Line* first = NULL;
+  Line* reference = NULL;
+  for (int i = 0; i < n; i++) {
+    Line* copy = find_copy(oracle->lines, n, lines[i]->id);
+    if (copy == NULL) {
+      FILE* out = begin_report(oracle, "its set of lines");
+      fprintf(out, "  line %u is not in the reference\n", lines[i]->id);
+      return false;
+    }
+    if (!same_state(lines[i], copy) &&
+        (first == NULL || lines[i]->id < first->id)) {
+      first = lines[i];
+      reference = copy;
+    }
+  }
+  if (first) {
+    FILE* out = begin_report(oracle, "the line states after the frame");
+    print_line(out, oracle, first->id);
+    print_state(out, "engine", first);
+    print_state(out, "reference", reference);
+    print_events_of(out, oracle, first->id);
+    return false;
+  }
+
+  if (numWallCollisions != oracle->numWallCollisions) {
+    FILE* out = begin_report(oracle, "its line-wall collisions");
+    fprintf(out, "  engine %u, reference %u\n", numWallCollisions,
+            oracle->numWallCollisions);
+    return false;
+  }
+  oracle->active = false;
+  oracle->numFrames++;
+  return true;
+}
@@ -0,0 +1,67 @@
+#ifndef ORACLE_H_
+#define ORACLE_H_
+
+// A brute-force reference for checking the collision engine frame by frame.
+//
+// Before a frame, Oracle_beginFrame copies every line and runs the frame on
+// the copies the slow, obvious way: every pair of lines goes through the
+// bounding box test and the full classification, as intersect() did before
+// any early rejection was added, the events are solved in order, every line
+// is moved and every line is checked against the walls.  The engine's
+// events and the lines it leaves behind are then compared against these,
+// and the first difference is written to stderr with the state of the
+// lines involved.  After that nothing more is checked, as everything that
+// follows would differ as well.
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "./IntersectionEventList.h"
+#include "./Line.h"
+
+typedef struct Oracle {
+  // Copies of the lines sorted by ID, as they are after the reference frame
+  // and as they were before it, with their boxes for the frame.
+  Line* lines;
+  Line* before;
+  unsigned int numLines;
+  unsigned int capacity;
+  double timeStep;
+
+  // Events among lines, wall collisions found by the reference frame, and
+  // whether each line hit a wall.
+  IntersectionEventList events;
+  unsigned int numWallCollisions;
+  bool* bounced;
+
+  // Frame being checked, counted from 1, whether a frame is under way, the
+  // number of frames found to agree, and whether any frame diverged.
+  unsigned int frame;
+  bool active;
+  unsigned int numFrames;
+  bool diverged;
+
+  FILE* report;
+} Oracle;
+
+Oracle* Oracle_new();
+
+void Oracle_delete(Oracle* oracle);
+
+// Runs the reference frame number frame from the n lines as they are now.
+// The lines must be up to date, and are not changed.
+void Oracle_beginFrame(Oracle* oracle, Line** lines, unsigned int n,
+                       double timeStep, unsigned int frame);
+
+// Compares the events the engine found this frame, sorted by
+// IntersectionEventNode_compareData, against the reference.  Returns false,
+// having reported it, at the first difference.
+bool Oracle_checkEvents(Oracle* oracle, const IntersectionEventList* events);
+
+// Compares the n lines after the engine's frame, brought up to date, and
+// the number of wall collisions it counted, against the reference, and ends
+// the frame.  Returns false, having reported it, at the first difference.
+bool Oracle_endFrame(Oracle* oracle, Line** lines, unsigned int n,
+                     unsigned int numWallCollisions);
+
+#endif  // ORACLE_H_
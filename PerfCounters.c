@@ -0,0 +1,258 @@
+#include "./PerfCounters.h"
+
+#ifdef PERF_COUNTERS
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#define PERF_MAX_THREADS 256
+
+static const char* event_names[NUM_PERF_EVENTS] = {
+  "cycles",
+  "instructions",
+  "l1d_read_misses",
+  "llc_misses",
+  "branch_misses",
+  "stalled_cycles_backend"
+};
+
+// One read() of a group: the times the group was enabled and actually on
+// the PMU, and the raw counts by group slot.
+typedef struct {
+  uint64_t enabled;
+  uint64_t running;
+  uint64_t values[NUM_PERF_EVENTS];
+} PerfSample;
+
+// The counters of one thread, opened as a single group led by the cycle
+// counter so that one read() returns all of them.  A thread fills in its
+// slot and then sets ready; the main thread reads only ready slots.
+typedef struct {
+  pid_t tid;
+  int leader;
+  int nr;                         // events in the group
+  int event[NUM_PERF_EVENTS];     // group slot -> PerfEvent
+  bool ready;
+  bool started;                   // start holds a good sample
+  PerfSample start;
+  uint64_t total[NUM_PHASES][NUM_PERF_EVENTS];
+  unsigned long skipped;          // phases not charged for a bad sample
+} PerfThread;
+
+static PerfThread threads[PERF_MAX_THREADS];
+static int num_threads = 0;
+static bool enabled = false;
+static bool available = false;
+
+static __thread bool entered = false;
+
+static void event_attr(PerfEvent e, struct perf_event_attr* attr) {
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->type = PERF_TYPE_HARDWARE;
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+      | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  switch (e) {
+    case PERF_CYCLES:
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PERF_INSTRUCTIONS:
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PERF_L1D_READ_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_L1D
+          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PERF_LLC_MISSES:
+      attr->config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case PERF_BRANCH_MISSES:
+      attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PERF_STALLED_CYCLES_BACKEND:
+      attr->config = PERF_COUNT_HW_STALLED_CYCLES_BACKEND;
+      break;
+    default:
+      break;
+  }
+}
+
+static int perf_event_open(struct perf_event_attr* attr, pid_t tid,
+                           int group_fd) {
+  return syscall(__NR_perf_event_open, attr, tid, -1, group_fd, 0);
+}
+
+// Opens as many of the events as the PMU supports on the calling thread.
+static bool open_thread(PerfThread* t) {
+  struct perf_event_attr attr;
+  t->tid = syscall(SYS_gettid);
+
+  event_attr(PERF_CYCLES, &attr);
+  t->leader = perf_event_open(&attr, 0, -1);
+  if (t->leader < 0) {
+    return false;
+  }
+  t->event[t->nr++] = PERF_CYCLES;
+
+  for (int e = PERF_CYCLES + 1; e < NUM_PERF_EVENTS; e++) {
+    event_attr(e, &attr);
+    if (perf_event_open(&attr, 0, t->leader) >= 0) {
+      t->event[t->nr++] = e;
+    }
+  }
+  ioctl(t->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(t->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+// Returns false if the group could not be read in full.
+static inline bool read_thread(const PerfThread* t, PerfSample* s) {
+  uint64_t buf[3 + NUM_PERF_EVENTS];
+  ssize_t size = (3 + t->nr) * sizeof(uint64_t);
+  if (read(t->leader, buf, sizeof(buf)) < size || buf[0] != (uint64_t) t->nr) {
+    return false;
+  }
+  s->enabled = buf[1];
+  s->running = buf[2];
+  for (int i = 0; i < t->nr; i++) {
+    s->values[i] = buf[3 + i];
+  }
+  return true;
+}
+
+bool PerfCounters_init() {
+  enabled = true;
+  PerfCounters_enterThread();
+  available = threads[0].ready;
+  if (!available) {
+    fprintf(stderr, "perf: hardware counters unavailable; using timers only\n");
+  }
+  return available;
+}
+
+void PerfCounters_enterThread() {
+  if (entered || !enabled) {
+    return;
+  }
+  entered = true;
+  int i = __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+  if (i >= PERF_MAX_THREADS) {
+    return;
+  }
+  if (open_thread(&threads[i])) {
+    __atomic_store_n(&threads[i].ready, true, __ATOMIC_RELEASE);
+  }
+}
+
+static inline int claimed_threads() {
+  int n = __atomic_load_n(&num_threads, __ATOMIC_RELAXED);
+  return n < PERF_MAX_THREADS ? n : PERF_MAX_THREADS;
+}
+
+void PerfCounters_begin(Phase phase) {
+  PerfCounters_enterThread();
+  int n = claimed_threads();
+  for (int i = 0; i < n; i++) {
+    PerfThread* t = &threads[i];
+    if (__atomic_load_n(&t->ready, __ATOMIC_ACQUIRE)) {
+      t->started = read_thread(t, &t->start);
+      if (!t->started) {
+        t->skipped++;
+      }
+    }
+  }
+}
+
+void PerfCounters_end(Phase phase) {
+  PerfSample now;
+  int n = claimed_threads();
+  for (int i = 0; i < n; i++) {
+    PerfThread* t = &threads[i];
+    if (!__atomic_load_n(&t->ready, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    // A thread that opened its counters during the phase has no start yet;
+    // that is not a bad sample.
+    bool wasStarted = t->started;
+    t->started = false;
+    if (!wasStarted) {
+      continue;
+    }
+    if (!read_thread(t, &now) || now.enabled < t->start.enabled ||
+        now.running < t->start.running) {
+      t->skipped++;
+      continue;
+    }
+    // The kernel multiplexes groups that do not fit on the PMU, so scale
+    // the counts up by the share of the phase the group was counting.
+    uint64_t enabledTime = now.enabled - t->start.enabled;
+    uint64_t runningTime = now.running - t->start.running;
+    if (runningTime == 0) {
+      if (enabledTime > 0) {
+        t->skipped++;
+      }
+      continue;
+    }
+    double scale = (double) enabledTime / runningTime;
+    for (int j = 0; j < t->nr; j++) {
+      if (now.values[j] >= t->start.values[j]) {
+        t->total[phase][t->event[j]] +=
+            (uint64_t) ((now.values[j] - t->start.values[j]) * scale + 0.5);
+      }
+    }
+  }
+}
+
+static bool has_event(const PerfThread* t, int e) {
+  for (int j = 0; j < t->nr; j++) {
+    if (t->event[j] == e) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters_report(FILE* out) {
+  fprintf(out, "{\n    \"available\": %s,\n    \"threads\": [",
+          available ? "true" : "false");
+  int n = claimed_threads();
+  bool firstThread = true;
+  for (int i = 0; i < n; i++) {
+    const PerfThread* t = &threads[i];
+    if (!__atomic_load_n(&t->ready, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    fprintf(out, "%s\n      {\n        \"tid\": %d,\n        "
+            "\"skipped_samples\": %lu,\n        \"phases\": {",
+            firstThread ? "" : ",", (int) t->tid, t->skipped);
+    firstThread = false;
+    for (int p = 0; p < NUM_PHASES; p++) {
+      fprintf(out, "%s\n          \"%s\": {", p ? "," : "",
+              Instrument_phaseName(p));
+      bool first = true;
+      for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (!has_event(t, e)) {
+          continue;
+        }
+        fprintf(out, "%s\"%s\": %llu", first ? "" : ", ", event_names[e],
+                (unsigned long long) t->total[p][e]);
+        first = false;
+      }
+      fprintf(out, "}");
+    }
+    fprintf(out, "\n        }\n      }");
+  }
+  fprintf(out, "\n    ]\n  }");
+}
+
+#endif  // PERF_COUNTERS
@@ -0,0 +1,52 @@
+#ifndef PERFCOUNTERS_H_
+#define PERFCOUNTERS_H_
+
+// Hardware performance counters per simulation phase and per thread.
+//
+// Built in only with PERF_COUNTERS defined ("make perf"), on top of the
+// INSTRUMENT phase timers: every Instrument_begin/Instrument_end pair also
+// reads the counters of every thread that has opened them and charges the
+// difference to that phase and thread.  The main thread opens its counters
+// in PerfCounters_init, and each Cilk worker opens its own the first time it
+// runs instrumented code (Instrument_count or Instrument_level) in a phase,
+// so every worker that does counted work is covered however the runtime
+// starts them.  Counts are scaled by the time the group was enabled over the
+// time it was actually counting, to make up for the kernel multiplexing
+// groups that do not fit on the PMU.  A phase whose counters cannot be read
+// in full is not charged and is counted under "skipped_samples" instead.
+// If perf_event_open is not permitted or the PMU is missing, the profiler
+// reports itself unavailable and only the timers are collected.
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "./Instrument.h"
+
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_READ_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_STALLED_CYCLES_BACKEND,
+  NUM_PERF_EVENTS
+} PerfEvent;
+
+#ifdef PERF_COUNTERS
+
+// Opens counters on the calling thread.  Returns false if they could not be
+// opened.
+bool PerfCounters_init();
+
+// Opens counters on the calling thread unless it already has them.
+void PerfCounters_enterThread();
+
+void PerfCounters_begin(Phase phase);
+void PerfCounters_end(Phase phase);
+
+// Writes the collected counts as a JSON value to out.
+void PerfCounters_report(FILE* out);
+
+#endif  // PERF_COUNTERS
+
+#endif  // PERFCOUNTERS_H_
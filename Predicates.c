@@ -0,0 +1,209 @@
+#include "./Predicates.h"
+
+#include <math.h>
+
+// eps = 2^-53, the largest relative rounding error of a double operation,
+// and 2^27 + 1, which splits a double into two 26-bit halves.
+#define EPSILON 1.1102230246251565e-16
+#define SPLITTER 134217729.0
+
+static const double resulterrbound = (3.0 + 8.0 * EPSILON) * EPSILON;
+static const double ccwerrboundB = (2.0 + 12.0 * EPSILON) * EPSILON;
+static const double ccwerrboundC = (9.0 + 64.0 * EPSILON) * EPSILON * EPSILON;
+
+// The error-free transformations of Shewchuk's paper: each computes the
+// rounded result x of an operation and the rounding error y, so that the
+// exact result is x + y.
+
+static inline void fast_two_sum(double a, double b, double* x, double* y) {
+  *x = a + b;
+  double bvirt = *x - a;
+  *y = b - bvirt;
+}
+
+static inline void two_sum(double a, double b, double* x, double* y) {
+  *x = a + b;
+  double bvirt = *x - a;
+  double avirt = *x - bvirt;
+  double bround = b - bvirt;
+  double around = a - avirt;
+  *y = around + bround;
+}
+
+static inline void two_diff_tail(double a, double b, double x, double* y) {
+  double bvirt = a - x;
+  double avirt = x + bvirt;
+  double bround = bvirt - b;
+  double around = a - avirt;
+  *y = around + bround;
+}
+
+static inline void two_diff(double a, double b, double* x, double* y) {
+  *x = a - b;
+  two_diff_tail(a, b, *x, y);
+}
+
+static inline void split(double a, double* hi, double* lo) {
+  double c = SPLITTER * a;
+  double abig = c - a;
+  *hi = c - abig;
+  *lo = a - *hi;
+}
+
+static inline void two_product(double a, double b, double* x, double* y) {
+  *x = a * b;
+  double ahi, alo, bhi, blo;
+  split(a, &ahi, &alo);
+  split(b, &bhi, &blo);
+  double err1 = *x - ahi * bhi;
+  double err2 = err1 - alo * bhi;
+  double err3 = err2 - ahi * blo;
+  *y = alo * blo - err3;
+}
+
+// (a1 + a0) - (b1 + b0) as the four-component expansion x.
+static inline void two_two_diff(double a1, double a0, double b1, double b0,
+                                double* x) {
+  double i, j, k;
+  two_diff(a0, b0, &i, &x[0]);
+  two_sum(a1, i, &j, &k);
+  two_diff(k, b1, &i, &x[1]);
+  two_sum(j, i, &x[3], &x[2]);
+}
+
+static inline double estimate(int n, const double* e) {
+  double q = e[0];
+  for (int i = 1; i < n; i++) {
+    q += e[i];
+  }
+  return q;
+}
+
+// Sums the nonoverlapping expansions e and f into h, leaving out zero
+// components, and returns the length of h.
+static int fast_expansion_sum_zeroelim(int elen, const double* e, int flen,
+                                       const double* f, double* h) {
+  double q, qnew, hh;
+  int eindex = 0;
+  int findex = 0;
+  int hindex = 0;
+  double enow = e[0];
+  double fnow = f[0];
+  if ((fnow > enow) == (fnow > -enow)) {
+    q = enow;
+    enow = ++eindex < elen ? e[eindex] : 0;
+  } else {
+    q = fnow;
+    fnow = ++findex < flen ? f[findex] : 0;
+  }
+  if (eindex < elen && findex < flen) {
+    if ((fnow > enow) == (fnow > -enow)) {
+      fast_two_sum(enow, q, &qnew, &hh);
+      enow = ++eindex < elen ? e[eindex] : 0;
+    } else {
+      fast_two_sum(fnow, q, &qnew, &hh);
+      fnow = ++findex < flen ? f[findex] : 0;
+    }
+    q = qnew;
+    if (hh != 0) {
+      h[hindex++] = hh;
+    }
+    while (eindex < elen && findex < flen) {
+      if ((fnow > enow) == (fnow > -enow)) {
+        two_sum(q, enow, &qnew, &hh);
+        enow = ++eindex < elen ? e[eindex] : 0;
+      } else {
+        two_sum(q, fnow, &qnew, &hh);
+        fnow = ++findex < flen ? f[findex] : 0;
+      }
+      q = qnew;
+      if (hh != 0) {
+        h[hindex++] = hh;
+      }
+    }
+  }
+  while (eindex < elen) {
+    two_sum(q, enow, &qnew, &hh);
+    enow = ++eindex < elen ? e[eindex] : 0;
+    q = qnew;
+    if (hh != 0) {
+      h[hindex++] = hh;
+    }
+  }
+  while (findex < flen) {
+    two_sum(q, fnow, &qnew, &hh);
+    fnow = ++findex < flen ? f[findex] : 0;
+    q = qnew;
+    if (hh != 0) {
+      h[hindex++] = hh;
+    }
+  }
+  if (q != 0 || hindex == 0) {
+    h[hindex++] = q;
+  }
+  return hindex;
+}
+
+static double orient2d_adapt(double ax, double ay, double bx, double by,
+                             double cx, double cy, double detsum) {
+  double acx = ax - cx;
+  double bcx = bx - cx;
+  double acy = ay - cy;
+  double bcy = by - cy;
+
+  // The products exactly, then the determinant of the rounded differences.
+  double detleft, detlefttail, detright, detrighttail;
+  two_product(acx, bcy, &detleft, &detlefttail);
+  two_product(acy, bcx, &detright, &detrighttail);
+  double b[4];
+  two_two_diff(detleft, detlefttail, detright, detrighttail, b);
+  double det = estimate(4, b);
+  double errbound = ccwerrboundB * detsum;
+  if (det >= errbound || -det >= errbound) {
+    return det;
+  }
+
+  // Then with a first-order correction for the rounding of the differences.
+  double acxtail, bcxtail, acytail, bcytail;
+  two_diff_tail(ax, cx, acx, &acxtail);
+  two_diff_tail(bx, cx, bcx, &bcxtail);
+  two_diff_tail(ay, cy, acy, &acytail);
+  two_diff_tail(by, cy, bcy, &bcytail);
+  if (acxtail == 0 && acytail == 0 && bcxtail == 0 && bcytail == 0) {
+    return det;
+  }
+  errbound = ccwerrboundC * detsum + resulterrbound * fabs(det);
+  det += (acx * bcytail + bcy * acxtail) - (acy * bcxtail + bcx * acytail);
+  if (det >= errbound || -det >= errbound) {
+    return det;
+  }
+
+  // Then exactly.
+  INSTRUMENT_COUNT(COUNTER_ORIENT_EXACT);
+  double s1, s0, t1, t0;
+  double u[4], c1[8], c2[12], d[16];
+  two_product(acxtail, bcy, &s1, &s0);
+  two_product(acytail, bcx, &t1, &t0);
+  two_two_diff(s1, s0, t1, t0, u);
+  int c1len = fast_expansion_sum_zeroelim(4, b, 4, u, c1);
+
+  two_product(acx, bcytail, &s1, &s0);
+  two_product(acy, bcxtail, &t1, &t0);
+  two_two_diff(s1, s0, t1, t0, u);
+  int c2len = fast_expansion_sum_zeroelim(c1len, c1, 4, u, c2);
+
+  two_product(acxtail, bcytail, &s1, &s0);
+  two_product(acytail, bcxtail, &t1, &t0);
+  two_two_diff(s1, s0, t1, t0, u);
+  int dlen = fast_expansion_sum_zeroelim(c2len, c2, 4, u, d);
+
+  return d[dlen - 1];
+}
+
+double Predicates_orient2dExact(Vec a, Vec b, Vec c) {
+  INSTRUMENT_COUNT(COUNTER_ORIENT_FALLBACKS);
+  double detleft = ((double) a.x - c.x) * ((double) b.y - c.y);
+  double detright = ((double) a.y - c.y) * ((double) b.x - c.x);
+  return orient2d_adapt(a.x, a.y, b.x, b.y, c.x, c.y,
+                        fabs(detleft) + fabs(detright));
+}
@@ -0,0 +1,64 @@
+#ifndef PREDICATES_H_
+#define PREDICATES_H_
+
+// Robust orientation test.
+//
+// Predicates_orient2d returns a value whose sign is exactly that of the
+// orientation determinant of its points, however close to collinear they
+// are.  The determinant is evaluated in floating point and its error bounded
+// first; only when the bound does not settle the sign does it fall back to
+// Shewchuk's adaptive exact arithmetic ("Adaptive Precision Floating-Point
+// Arithmetic and Fast Robust Geometric Predicates", 1997).  The arithmetic
+// must be IEEE double with round-to-nearest and no fused multiply-adds, so
+// Predicates.o is built with -ffp-contract=off.
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "./Instrument.h"
+#include "./Vec.h"
+
+// (3 + 16 eps) eps, with eps = 2^-53.
+#define PREDICATES_ORIENT_ERRBOUND 3.3306690738754716e-16
+
+// The bound relative to the first product alone.  The second product is at
+// most |detleft| + |det| (1 + eps), so |det| >= 4 errbound |detleft| implies
+// |det| >= errbound (|detleft| + |detright|) with room to spare for the
+// rounding of the bound itself.
+#define PREDICATES_ORIENT_FILTER (4 * PREDICATES_ORIENT_ERRBOUND)
+
+// The orientation determinant of a, b and c evaluated in floating point.
+// Stores in *detleft the first of its two products, which
+// Predicates_orient2dSettled needs to decide whether the sign is right.
+static inline double Predicates_orient2dFast(Vec a, Vec b, Vec c,
+                                             double* detleft) {
+  INSTRUMENT_COUNT(COUNTER_ORIENT_TESTS);
+  *detleft = ((double) a.x - c.x) * ((double) b.y - c.y);
+  double detright = ((double) a.y - c.y) * ((double) b.x - c.x);
+  return *detleft - detright;
+}
+
+// Whether the sign of det, as returned by Predicates_orient2dFast, is
+// exact.  The products are rounded, so det may have the wrong sign only if
+// it is within the error bound; otherwise, which includes every case where
+// the products differ in sign or one is zero, det is right.
+static inline bool Predicates_orient2dSettled(double det, double detleft) {
+  return fabs(det) >= PREDICATES_ORIENT_FILTER * fabs(detleft);
+}
+
+// The orientation determinant with its sign computed exactly, for when
+// Predicates_orient2dSettled fails.  It stops at the first approximation
+// whose sign it can prove.
+double Predicates_orient2dExact(Vec a, Vec b, Vec c);
+
+// Positive if a, b and c are in counterclockwise order, negative if they
+// are in clockwise order, and zero if they are collinear.  The magnitude
+// approximates twice the area of the triangle.
+static inline double Predicates_orient2d(Vec a, Vec b, Vec c) {
+  double detleft;
+  double det = Predicates_orient2dFast(a, b, c, &detleft);
+  return Predicates_orient2dSettled(det, detleft) ?
+         det : Predicates_orient2dExact(a, b, c);
+}
+
+#endif  // PREDICATES_H_
@@ -1,11 +1,16 @@
+#ifdef WORKSPAN
+#include "./fasttime.h"
+#endif
 #include "./Quadtree.h"
 
+#include <math.h>
 #include <string.h>
 #include <assert.h>
 #include <cilk/cilk.h>
 #include <cilk/reducer.h>
 // #include <cilk/cilk_stub.h>
 
+#include "./Instrument.h"
 #include "./Line.h"
 #include "./Vec.h"
 #include "./IntersectionEventList.h"
@@ -36,16 +41,45 @@ inline void LineList_concat(LineList* l, LineList* r) {
   }
 }
 
-inline QuadTree* QuadTree_make(double x1, double x2, double y1, double y2) {
+bool QuadTreeParams_valid(const QuadTreeParams* params) {
+  return params->maxLines >= 1 && params->spawnGrain >= 0 &&
+      params->maxDepth >= 1 && params->maxDepth <= MAX_DEPTH_LIMIT;
+}
+
+void LineList_removeLine(LineList* ll, Line* l) {
+  assert(ll);
+  assert(l);
+  Line* prev = NULL;
+  for (Line* curr = ll->head; curr; prev = curr, curr = curr->next) {
+    if (curr == l) {
+      if (prev) {
+        prev->next = l->next;
+      } else {
+        ll->head = l->next;
+      }
+      if (ll->tail == l) {
+        ll->tail = prev;
+      }
+      ll->count--;
+      return;
+    }
+  }
+  assert(false);
+}
+
+inline QuadTree* QuadTree_make(double x1, double x2, double y1, double y2,
+                               const QuadTreeParams* params) {
   QuadTree* q = malloc(sizeof(QuadTree));
   q->quads = calloc(5, sizeof(QuadTree*)); // 5th pointer points to itself to reduce branching
   q->lines = calloc(1, sizeof(LineList));
+  q->params = params;
   q->x1 = x1;
   q->x2 = x2;
   q->y1 = y1;
   q->y2 = y2;
   q->x0 = (q->x1 + q->x2) / 2;
   q->y0 = (q->y1 + q->y2) / 2;
+  q->depth = 0;
   q->children = false;
   q->leaf = false;
   q->quads[PARENT_QUAD] = q; // self pointer
@@ -84,10 +118,12 @@ inline void QuadTree_build(QuadTree* q, int depth) {
 
   if (depth > 0) {
     q->children = true;
-    q->quads[0] = QuadTree_make(q->x1, q->x0, q->y1, q->y0);
-    q->quads[1] = QuadTree_make(q->x0, q->x2, q->y1, q->y0);
-    q->quads[2] = QuadTree_make(q->x1, q->x0, q->y0, q->y2);
-    q->quads[3] = QuadTree_make(q->x0, q->x2, q->y0, q->y2);
+    q->quads[0] = QuadTree_make(q->x1, q->x0, q->y1, q->y0, q->params);
+    q->quads[1] = QuadTree_make(q->x0, q->x2, q->y1, q->y0, q->params);
+    q->quads[2] = QuadTree_make(q->x1, q->x0, q->y0, q->y2, q->params);
+    q->quads[3] = QuadTree_make(q->x0, q->x2, q->y0, q->y2, q->params);
+    q->quads[0]->depth = q->quads[1]->depth = q->depth + 1;
+    q->quads[2]->depth = q->quads[3]->depth = q->depth + 1;
     QuadTree_build(q->quads[0], depth - 1);
     QuadTree_build(q->quads[1], depth - 1);
     QuadTree_build(q->quads[2], depth - 1);
@@ -119,17 +155,58 @@ inline int QuadTree_getQuad(QuadTree* q, Line* l, double t) {
   return q_a == q_b ? q_a : PARENT_QUAD;
 }
 
+#ifdef WORKSPAN
+void QuadTree_joinWorkSpan(QuadTree* q, int spawned) {
+  double span = 0;
+  double burdenedSpan = 0;
+  double spawnedSpan = 0;
+  double spawnedBurdenedSpan = 0;
+  for (int i = 0; i < 4; i++) {
+    QuadTree* c = q->quads[i];
+    q->work += c->work;
+    if (spawned & (1 << i)) {
+      spawnedSpan = MAX(spawnedSpan, c->span);
+      spawnedBurdenedSpan = MAX(spawnedBurdenedSpan,
+                                c->burdenedSpan + WORKSPAN_BURDEN);
+    } else {
+      span += c->span;
+      burdenedSpan += c->burdenedSpan;
+    }
+  }
+  q->span += MAX(span, spawnedSpan);
+  q->burdenedSpan += MAX(burdenedSpan, spawnedBurdenedSpan);
+}
+#endif
+
+inline void QuadTree_estimateWork(QuadTree* q) {
+  long own = q->lines->count;
+  q->subtreeLines = own;
+  q->subtreeTests = own * (own - 1) / 2;
+  if (!q->leaf) {
+    for (int i = 0; i < 4; i++) {
+      QuadTree* c = q->quads[i];
+      q->subtreeLines += c->subtreeLines;
+      q->subtreeTests += c->subtreeTests + own * c->subtreeLines;
+    }
+  }
+}
+
 void QuadTree_addLines(QuadTree* q, double t) {
   assert(q);
+#ifdef WORKSPAN
+  fasttime_t start = gettime();
+#endif
 
-  // Check if node can fit all the lines
-  if (q->lines->count <= N) {
+  // Check if node can fit all the lines, or cannot be split any further
+  if (q->lines->count <= q->params->maxLines || !q->children) {
     q->leaf = true;
+#ifdef WORKSPAN
+    q->work = q->span = q->burdenedSpan = tdiff(start, gettime());
+#endif
+    QuadTree_estimateWork(q);
     return;
   }
 
-  assert(q->children);
-
   // Put lines in appropriate line lists
   Line* curr = q->lines->head;
   Line* next;
@@ -142,60 +219,280 @@ void QuadTree_addLines(QuadTree* q, double t) {
     LineList_addLine(q->quads[type]->lines, curr);
     curr = next;
   }
+#ifdef WORKSPAN
+  q->work = q->span = q->burdenedSpan = tdiff(start, gettime());
+#endif
 
   QuadTree_addLines(q->quads[0], t);
   QuadTree_addLines(q->quads[1], t);
   QuadTree_addLines(q->quads[2], t);
   QuadTree_addLines(q->quads[3], t);
+#ifdef WORKSPAN
+  QuadTree_joinWorkSpan(q, 0);
+#endif
+  QuadTree_estimateWork(q);
 }
 
-inline static void processIntersections(Line* l1, Line* l2, double t, IntersectionEventListReducer* iel) {
+void QuadTree_sortLines(QuadTree* q, Line** lines, int n, double t) {
+  assert(q);
+
+#ifdef WORKSPAN
+  fasttime_t start = gettime();
+#endif
+
+  // Put lines in appropriate line lists
+  Line* curr;
+  int type;
+  QuadTree_reset(q);
+  for (int i = 0; i < n; i++) {
+    curr = lines[i];
+    update_box(curr, t);
+    type = QuadTree_getQuad(q, curr, t);
+    assert(0 <= type && type <= 4);
+    LineList_addLine(q->quads[type]->lines, curr);
+  }
+#ifdef WORKSPAN
+  q->work = q->span = q->burdenedSpan = tdiff(start, gettime());
+#endif
+
+  cilk_for (int i = 0; i < 4; i++) {
+    QuadTree_addLines(q->quads[i], t);
+  }
+#ifdef WORKSPAN
+  QuadTree_joinWorkSpan(q, 0xF);
+#endif
+  QuadTree_estimateWork(q);
+}
+
+inline static void processIntersections(Line* l1,
+                                        Line* l2,
+                                        double t,
+                                        IntersectionEventCollector* iel) {
   for (; l2; l2 = l2->next) {
     if (compareLines(l1, l2) < 0) {
       IntersectionType type = intersect(l1, l2, t);
       if (type != NO_INTERSECTION) {
-        IntersectionEventList_appendNode(&REDUCER_VIEW(*iel), l1, l2, type);
+        INSTRUMENT_COUNT(COUNTER_EVENTS_L1_WITH_L2 + type - L1_WITH_L2);
+        IntersectionEventList_appendNode(IntersectionEventCollector_view(iel),
+                                         l1, l2, type);
       }
     } else {
       IntersectionType type = intersect(l2, l1, t);
       if (type != NO_INTERSECTION) {
-        IntersectionEventList_appendNode(&REDUCER_VIEW(*iel), l2, l1, type);
+        INSTRUMENT_COUNT(COUNTER_EVENTS_L1_WITH_L2 + type - L1_WITH_L2);
+        IntersectionEventList_appendNode(IntersectionEventCollector_view(iel),
+                                         l2, l1, type);
+      }
+    }
+  }
+}
+
+// Tests the own lines of q against each other and against lines, as a
+// cilk_for over chunks of roughly equal estimated work.
+static void detectEvents_split(QuadTree* q, LineList* lines, long tests,
+                               double t, IntersectionEventCollector* iel) {
+  Line* heads[SPLIT_MAX_CHUNKS];
+  int sizes[SPLIT_MAX_CHUNKS];
+  long chunks = MIN(SPLIT_MAX_CHUNKS, tests / q->params->spawnGrain);
+  long target = tests / chunks;
+  long inherited = lines ? lines->count : 0;
+  long after = q->lines->count;
+  long work = 0;
+  int n = 0;
+
+  // Line l1 is tested against the lines after it and the inherited ones.
+  for (Line* l1 = q->lines->head; l1; l1 = l1->next) {
+    if (n == 0 || (work >= target && n < chunks)) {
+      heads[n] = l1;
+      sizes[n++] = 0;
+      work = 0;
+    }
+    sizes[n - 1]++;
+    work += --after + inherited;
+  }
+  INSTRUMENT_COUNT(COUNTER_NODES_SPLIT);
+  INSTRUMENT_ADD(COUNTER_SPLIT_CHUNKS, n);
+
+  Line* inheritedHead = lines ? lines->head : NULL;
+#ifdef WORKSPAN
+  double chunkTimes[SPLIT_MAX_CHUNKS];
+#endif
+  cilk_for (int i = 0; i < n; i++) {
+#ifdef WORKSPAN
+    fasttime_t start = gettime();
+#endif
+    Line* l1 = heads[i];
+    for (int j = 0; j < sizes[i]; j++, l1 = l1->next) {
+      processIntersections(l1, l1->next, t, iel);
+      processIntersections(l1, inheritedHead, t, iel);
+    }
+#ifdef WORKSPAN
+    chunkTimes[i] = tdiff(start, gettime());
+#endif
+  }
+#ifdef WORKSPAN
+  q->work = q->span = 0;
+  for (int i = 0; i < n; i++) {
+    q->work += chunkTimes[i];
+    q->span = MAX(q->span, chunkTimes[i]);
+  }
+  q->burdenedSpan = q->span + WORKSPAN_BURDEN;
+#endif
+}
+
+// Searches the children of q, given the lines passed down to them.  Only
+// children whose estimated work reaches the spawn grain become parallel
+// tasks; the rest run serially alongside them.
+static void detectEvents_children(QuadTree* q, double t,
+                                  IntersectionEventCollector* iel) {
+  long grain = q->params->spawnGrain;
+  long inherited = q->lines->count;
+  int spawned = 0;
+  for (int i = 0; i < 4; i++) {
+    QuadTree* c = q->quads[i];
+    if (c->subtreeTests + inherited * c->subtreeLines >= grain) {
+      spawned |= 1 << i;
+    }
+  }
+
+  if (spawned == 0) {
+    INSTRUMENT_COUNT(COUNTER_SUBTREES_COARSENED);
+    QuadTree_detectEvents(q->quads[0], q->lines, t, iel);
+    QuadTree_detectEvents(q->quads[1], q->lines, t, iel);
+    QuadTree_detectEvents(q->quads[2], q->lines, t, iel);
+    QuadTree_detectEvents(q->quads[3], q->lines, t, iel);
+  } else {
+    for (int i = 0; i < 4; i++) {
+      if (spawned & (1 << i)) {
+        INSTRUMENT_COUNT(COUNTER_TASKS_SPAWNED);
+        cilk_spawn QuadTree_detectEvents(q->quads[i], q->lines, t, iel);
+      }
+    }
+    for (int i = 0; i < 4; i++) {
+      if (!(spawned & (1 << i))) {
+        QuadTree_detectEvents(q->quads[i], q->lines, t, iel);
       }
     }
+    cilk_sync;
   }
+#ifdef WORKSPAN
+  QuadTree_joinWorkSpan(q, spawned);
+#endif
 }
 
 void QuadTree_detectEvents(QuadTree* q,
                            LineList* lines,
                            double t,
-                           IntersectionEventListReducer* iel) {
+                           IntersectionEventCollector* iel) {
   if (!q) {
     return;
   }
 
   assert(q->lines);
-  for (Line* l1 = q->lines->head; l1; l1 = l1->next) {
-    processIntersections(l1, l1->next, t, iel);
-  }
-
-  if (lines && lines->count) {
+  INSTRUMENT_LEVEL(q->depth, q->lines->count);
+  long own = q->lines->count;
+  long inherited = lines ? lines->count : 0;
+  long tests = own * (own - 1) / 2 + own * inherited;
+  if (tests >= 2L * q->params->spawnGrain && q->params->spawnGrain > 0) {
+    detectEvents_split(q, lines, tests, t, iel);
+    if (inherited) {
+      LineList_concat(q->lines, lines);
+    }
+  } else {
+#ifdef WORKSPAN
+    fasttime_t start = gettime();
+#endif
     for (Line* l1 = q->lines->head; l1; l1 = l1->next) {
-      processIntersections(l1, lines->head, t, iel);
+      processIntersections(l1, l1->next, t, iel);
     }
 
-    LineList_concat(q->lines, lines);
+    if (inherited) {
+      for (Line* l1 = q->lines->head; l1; l1 = l1->next) {
+        processIntersections(l1, lines->head, t, iel);
+      }
+
+      LineList_concat(q->lines, lines);
+    }
+#ifdef WORKSPAN
+    q->work = q->span = q->burdenedSpan = tdiff(start, gettime());
+#endif
   }
 
   if (!q->leaf) {
-    if (q->lines->count > MAX_INTERSECTS) {
-      cilk_for (int i = 0; i < 4; i++) {
-        QuadTree_detectEvents(q->quads[i], q->lines, t, iel);
-      }
+    detectEvents_children(q, t, iel);
+  }
+}
+
+void QuadTree_removeLine(QuadTree* q, Line* l, double t) {
+  // Retrace the path QuadTree_addLines sorted l along.
+  int type;
+  while (!q->leaf && (type = QuadTree_getQuad(q, l, t)) != PARENT_QUAD) {
+    q = q->quads[type];
+  }
+  LineList_removeLine(q->lines, l);
+}
+
+void QuadTree_detectEventsWithLine(QuadTree* q,
+                                   Line* l,
+                                   double t,
+                                   IntersectionEventCollector* iel) {
+  processIntersections(l, q->lines->head, t, iel);
+  if (q->leaf) {
+    return;
+  }
+
+  // Lines in a child lie strictly on its side of the midlines, so only
+  // children that the bounding box of l reaches can hold a match.
+  bool left = l->l_x <= q->x0;
+  bool right = l->u_x >= q->x0;
+  bool low = l->l_y <= q->y0;
+  bool high = l->u_y >= q->y0;
+  if (low && left) {
+    QuadTree_detectEventsWithLine(q->quads[0], l, t, iel);
+  }
+  if (low && right) {
+    QuadTree_detectEventsWithLine(q->quads[1], l, t, iel);
+  }
+  if (high && left) {
+    QuadTree_detectEventsWithLine(q->quads[2], l, t, iel);
+  }
+  if (high && right) {
+    QuadTree_detectEventsWithLine(q->quads[3], l, t, iel);
+  }
+}
+
+static inline void QuadTreeBox_add(QuadTreeBox* b, Line* l) {
+  b->x1 = MIN(b->x1, l->l_x);
+  b->x2 = MAX(b->x2, l->u_x);
+  b->y1 = MIN(b->y1, l->l_y);
+  b->y2 = MAX(b->y2, l->u_y);
+}
+
+void QuadTree_boundLines(QuadTree* q) {
+  static const QuadTreeBox empty = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+  LineList crossing = {0, NULL, NULL};
+  LineList rest = {0, NULL, NULL};
+  q->crossingBounds = q->restBounds = empty;
+  Line* next;
+  for (Line* l = q->lines->head; l; l = next) {
+    next = l->next;
+    if (l->l_x <= q->x0 && l->u_x >= q->x0) {
+      LineList_addLine(&crossing, l);
+      QuadTreeBox_add(&q->crossingBounds, l);
     } else {
-      QuadTree_detectEvents(q->quads[0], q->lines, t, iel);
-      QuadTree_detectEvents(q->quads[1], q->lines, t, iel);
-      QuadTree_detectEvents(q->quads[2], q->lines, t, iel);
-      QuadTree_detectEvents(q->quads[3], q->lines, t, iel);
+      LineList_addLine(&rest, l);
+      QuadTreeBox_add(&q->restBounds, l);
+    }
+  }
+  q->firstRest = rest.head;
+  LineList_concat(&crossing, &rest);
+  *q->lines = crossing;
+
+  if (!q->leaf) {
+    for (int i = 0; i < 4; i++) {
+      if (q->quads[i]->subtreeLines > 0) {
+        QuadTree_boundLines(q->quads[i]);
+      }
     }
   }
 }
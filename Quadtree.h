@@ -6,11 +6,31 @@
 #include "./Vec.h"
 #include "./IntersectionEventList.h"
 
+// Default quadtree parameters, used unless they are set at run time.
 #define N 50
-#define MAX_INTERSECTS 5
+#define SPAWN_GRAIN 2048
 #define MAX_DEPTH 5
+#define MAX_DEPTH_LIMIT 8
 #define PARENT_QUAD 4
 
+// Most chunks the own lines of one node are split into.
+#define SPLIT_MAX_CHUNKS 32
+
+// Tuning parameters shared by every node of a quadtree.
+typedef struct QuadTreeParams {
+  // A node with at most this many lines is not split further.
+  int maxLines;
+  // Estimated pair tests below which a subtree is not worth a parallel
+  // task of its own.
+  int spawnGrain;
+  // Number of levels below the root.
+  int maxDepth;
+} QuadTreeParams;
+
+#define QUADTREE_DEFAULT_PARAMS {N, SPAWN_GRAIN, MAX_DEPTH}
+
+bool QuadTreeParams_valid(const QuadTreeParams* params);
+
 typedef struct LineList {
   int count;
   Line* head;
@@ -21,14 +41,37 @@ void LineList_addLine(LineList* ll, Line* l);
 
 void LineList_concat(LineList* l, LineList* r);
 
+void LineList_removeLine(LineList* ll, Line* l);
+
+// An axis-aligned box, empty if x1 > x2.
+typedef struct QuadTreeBox {
+  double x1, x2, y1, y2;
+} QuadTreeBox;
+
 typedef struct QuadTree {
   double x1, x2, y1, y2, x0, y0;
   struct QuadTree** quads;
   LineList* lines;
+  const QuadTreeParams* params;
+  int depth;
   bool children, leaf;
+  // Estimated work of QuadTree_detectEvents on this subtree, set by
+  // QuadTree_addLines: given k lines from above, it makes
+  // subtreeTests + k * subtreeLines pair tests.
+  long subtreeLines, subtreeTests;
+  // Set by QuadTree_boundLines: the own lines before firstRest are those
+  // whose boxes reach across the vertical midline, and crossingBounds and
+  // restBounds bound the boxes of those and of the other own lines.
+  struct Line* firstRest;
+  QuadTreeBox crossingBounds, restBounds;
+#ifdef WORKSPAN
+  // Work, span and burdened span of the last pass over this subtree.
+  double work, span, burdenedSpan;
+#endif
 } QuadTree;
 
-QuadTree* QuadTree_make(double x1, double x2, double y1, double y2);
+QuadTree* QuadTree_make(double x1, double x2, double y1, double y2,
+                        const QuadTreeParams* params);
 
 void QuadTree_delete(QuadTree* q);
 
@@ -42,7 +85,39 @@ int QuadTree_getQuad(QuadTree* q, Line* l, double t);
 
 void QuadTree_addLines(QuadTree* q, double t);
 
-void QuadTree_detectEvents(QuadTree* q, LineList* lines, double t, IntersectionEventListReducer* iel);
+// Brings the boxes of the n lines up to date for time step t, and sorts
+// them into q in place of the lines it held.
+void QuadTree_sortLines(QuadTree* q, Line** lines, int n, double t);
+
+// Computes the work estimate of q from its own lines and its children's.
+void QuadTree_estimateWork(QuadTree* q);
+
+void QuadTree_detectEvents(QuadTree* q,
+                           LineList* lines,
+                           double t,
+                           IntersectionEventCollector* iel);
+
+// Removes line l from the tree it was sorted into by QuadTree_addLines, as
+// long as l has not moved since.
+void QuadTree_removeLine(QuadTree* q, Line* l, double t);
+
+// Detects the events between line l and the lines in q whose bounding boxes
+// may overlap its own.  l must not be in q itself.
+void QuadTree_detectEventsWithLine(QuadTree* q,
+                                   Line* l,
+                                   double t,
+                                   IntersectionEventCollector* iel);
+
+// Orders and bounds the own lines of every node of q for spatial queries,
+// after QuadTree_addLines and before QuadTree_detectEvents.
+void QuadTree_boundLines(QuadTree* q);
+
+#ifdef WORKSPAN
+// Adds the work and span of the four children of q to its own.  spawned is
+// a bit mask of the children that ran as parallel tasks; the others ran one
+// after another alongside them.
+void QuadTree_joinWorkSpan(QuadTree* q, int spawned);
+#endif
 
 #endif  // QUADTREE_H_
 
@@ -0,0 +1,88 @@
+#include "./Raster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+Raster* Raster_new(int width, int height) {
+  Raster* raster = malloc(sizeof(Raster));
+  if (raster == NULL) {
+    return NULL;
+  }
+  raster->width = width;
+  raster->height = height;
+  raster->pixels = malloc((size_t) width * height * 3);
+  if (raster->pixels == NULL) {
+    free(raster);
+    return NULL;
+  }
+  return raster;
+}
+
+void Raster_delete(Raster* raster) {
+  free(raster->pixels);
+  free(raster);
+}
+
+void Raster_clear(Raster* raster, Rgb color) {
+  uint8_t* p = raster->pixels;
+  uint8_t* end = p + (size_t) raster->width * raster->height * 3;
+  for (; p < end; p += 3) {
+    p[0] = color.r;
+    p[1] = color.g;
+    p[2] = color.b;
+  }
+}
+
+static inline void plot(Raster* raster, int x, int y, Rgb color) {
+  if (x < 0 || x >= raster->width || y < 0 || y >= raster->height) {
+    return;
+  }
+  uint8_t* p = raster->pixels + ((size_t) y * raster->width + x) * 3;
+  p[0] = color.r;
+  p[1] = color.g;
+  p[2] = color.b;
+}
+
+// Bresenham's algorithm, including both endpoints.
+static void draw_segment(Raster* raster, const Segment* s, Rgb color) {
+  int x = s->x1;
+  int y = s->y1;
+  int dx = abs(s->x2 - x);
+  int dy = -abs(s->y2 - y);
+  int sx = x < s->x2 ? 1 : -1;
+  int sy = y < s->y2 ? 1 : -1;
+  int err = dx + dy;
+  while (true) {
+    plot(raster, x, y, color);
+    if (x == s->x2 && y == s->y2) {
+      return;
+    }
+    int e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      x += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y += sy;
+    }
+  }
+}
+
+void Raster_drawSegments(Raster* raster, const Segment* segments,
+                         int numSegments, Rgb color) {
+  for (int i = 0; i < numSegments; i++) {
+    draw_segment(raster, &segments[i], color);
+  }
+}
+
+bool Raster_writePPM(const Raster* raster, const char* path) {
+  FILE* out = fopen(path, "wb");
+  if (out == NULL) {
+    return false;
+  }
+  size_t size = (size_t) raster->width * raster->height * 3;
+  fprintf(out, "P6\n%d %d\n255\n", raster->width, raster->height);
+  bool ok = fwrite(raster->pixels, 1, size, out) == size;
+  return fclose(out) == 0 && ok;
+}
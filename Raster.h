@@ -0,0 +1,44 @@
+#ifndef RASTER_H_
+#define RASTER_H_
+
+// A software framebuffer for drawing frames without an X display.
+//
+// Pixels are 8-bit RGB triples, row by row from the top left, which is also
+// the layout of a binary PPM image.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "./Snapshot.h"
+
+typedef struct {
+  uint8_t r, g, b;
+} Rgb;
+
+// The colors of the X renderer: black, "gray" and "dark red".
+#define RASTER_BACKGROUND ((Rgb) {0, 0, 0})
+#define RASTER_GRAY ((Rgb) {190, 190, 190})
+#define RASTER_RED ((Rgb) {139, 0, 0})
+
+typedef struct {
+  int width;
+  int height;
+  uint8_t* pixels;
+} Raster;
+
+// Returns NULL if the framebuffer cannot be allocated.
+Raster* Raster_new(int width, int height);
+
+void Raster_delete(Raster* raster);
+
+// Fills the whole framebuffer with color.
+void Raster_clear(Raster* raster, Rgb color);
+
+// Draws one-pixel-wide segments, clipped to the framebuffer.
+void Raster_drawSegments(Raster* raster, const Segment* segments,
+                         int numSegments, Rgb color);
+
+// Writes the framebuffer to path as a binary PPM image.
+bool Raster_writePPM(const Raster* raster, const char* path);
+
+#endif  // RASTER_H_
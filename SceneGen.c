@@ -0,0 +1,273 @@
+/**
+ * SceneGen.c -- generate large synthetic input scenes for Screensaver
+ *
+ * Writes scenes in the line.in format: the number of lines, then one line
+ * per segment with its endpoints and velocity in window coordinates and
+ * whether it is gray.  Placement, length and velocity distributions, the
+ * gray/red ratio and the random seed are all controllable, so the same
+ * command always produces the same scene.
+ **/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./Line.h"
+
+typedef enum {
+  PLACE_UNIFORM,
+  PLACE_CLUSTERED,
+  PLACE_FRACTAL
+} Placement;
+
+typedef enum {
+  DIST_FIXED,
+  DIST_UNIFORM,
+  DIST_EXPONENTIAL,
+  DIST_GAUSSIAN
+} Distribution;
+
+typedef struct {
+  double x;
+  double y;
+  double sigma;
+} Cluster;
+
+// xorshift64* -- small, fast and identical on every platform, unlike rand().
+static uint64_t rng_state;
+
+static inline double rng_uniform() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline double rng_gaussian() {
+  double u = rng_uniform();
+  double v = rng_uniform();
+  return sqrt(-2 * log(u + 1e-300)) * cos(2 * M_PI * v);
+}
+
+// A sample with the given mean from the distribution.
+static double sample(Distribution dist, double mean) {
+  switch (dist) {
+    case DIST_FIXED:
+      return mean;
+    case DIST_UNIFORM:
+      return 2 * mean * rng_uniform();
+    case DIST_EXPONENTIAL:
+      return -mean * log(1 - rng_uniform());
+    case DIST_GAUSSIAN:
+      return fabs(mean + mean / 3 * rng_gaussian());
+  }
+  return mean;
+}
+
+static bool parse_distribution(const char* s, Distribution* dist) {
+  if (strcmp(s, "fixed") == 0) {
+    *dist = DIST_FIXED;
+  } else if (strcmp(s, "uniform") == 0) {
+    *dist = DIST_UNIFORM;
+  } else if (strcmp(s, "exp") == 0) {
+    *dist = DIST_EXPONENTIAL;
+  } else if (strcmp(s, "gaussian") == 0) {
+    *dist = DIST_GAUSSIAN;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Picks a center by descending `levels` times into one of four quadrants
+// with skewed probabilities, which gives a self-similar (multifractal)
+// density, then jitters uniformly within the final cell.
+static void fractal_point(double* x, double* y, int levels, double w,
+                          double h) {
+  static const double weights[4] = {0.4, 0.3, 0.2, 0.1};
+  double x1 = 0, y1 = 0;
+  for (int i = 0; i < levels; i++) {
+    double r = rng_uniform();
+    int q = 0;
+    while (q < 3 && r >= weights[q]) {
+      r -= weights[q];
+      q++;
+    }
+    w /= 2;
+    h /= 2;
+    x1 += (q & 1) * w;
+    y1 += (q >> 1) * h;
+  }
+  *x = x1 + w * rng_uniform();
+  *y = y1 + h * rng_uniform();
+}
+
+static void usage(const char* argv0) {
+  printf("Usage: %s -n lines [options] [output file]\n", argv0);
+  printf("  -n : number of lines (e.g. 10000 to 10000000)\n");
+  printf("  -p : placement: uniform (default), clustered or fractal\n");
+  printf("  -c : clusters for clustered placement (default 16)\n");
+  printf("  -l : mean line length in pixels (default scales with n)\n");
+  printf("  -L : length distribution: fixed, uniform (default), exp,"
+         " gaussian\n");
+  printf("  -v : mean speed in pixels per frame (default 1)\n");
+  printf("  -V : speed distribution: fixed, uniform (default), exp,"
+         " gaussian\n");
+  printf("  -z : fraction of lines with zero velocity (default 0)\n");
+  printf("  -g : fraction of gray lines (default 0.5)\n");
+  printf("  -s : random seed (default 1)\n");
+  printf("  -w : place lines over cols,rows windows, for Screensaver -T"
+         " (default 1,1)\n");
+  printf("Output goes to stdout if no file is given.\n");
+  exit(-1);
+}
+
+int main(int argc, char* argv[]) {
+  long n = 0;
+  Placement placement = PLACE_UNIFORM;
+  int numClusters = 16;
+  double length = 0;
+  Distribution lengthDist = DIST_UNIFORM;
+  double speed = 1;
+  Distribution speedDist = DIST_UNIFORM;
+  double staticRatio = 0;
+  double grayRatio = 0.5;
+  uint64_t seed = 1;
+  int cols = 1, rows = 1;
+  int optchar;
+
+  while ((optchar = getopt(argc, argv, "n:p:c:l:L:v:V:z:g:s:w:")) != -1) {
+    switch (optchar) {
+      case 'n':
+        n = atol(optarg);
+        break;
+      case 'p':
+        if (strcmp(optarg, "uniform") == 0) {
+          placement = PLACE_UNIFORM;
+        } else if (strcmp(optarg, "clustered") == 0) {
+          placement = PLACE_CLUSTERED;
+        } else if (strcmp(optarg, "fractal") == 0) {
+          placement = PLACE_FRACTAL;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 'c':
+        numClusters = atoi(optarg);
+        break;
+      case 'l':
+        length = atof(optarg);
+        break;
+      case 'L':
+        if (!parse_distribution(optarg, &lengthDist)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'v':
+        speed = atof(optarg);
+        break;
+      case 'V':
+        if (!parse_distribution(optarg, &speedDist)) {
+          usage(argv[0]);
+        }
+        break;
+      case 'z':
+        staticRatio = atof(optarg);
+        break;
+      case 'g':
+        grayRatio = atof(optarg);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'w':
+        if (sscanf(optarg, "%d,%d", &cols, &rows) != 2) {
+          usage(argv[0]);
+        }
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (n <= 0 || numClusters <= 0 || cols <= 0 || rows <= 0) {
+    usage(argv[0]);
+  }
+  FILE* out = stdout;
+  if (optind < argc) {
+    out = fopen(argv[optind], "w");
+    if (out == NULL) {
+      perror(argv[optind]);
+      exit(-1);
+    }
+  }
+
+  // Default to lines about half as long as the mean spacing between them,
+  // so dense scenes do not start out as one big pile of intersections.
+  const double width = (double) cols * WINDOW_WIDTH;
+  const double height = (double) rows * WINDOW_HEIGHT;
+  if (length <= 0) {
+    length = 0.5 * sqrt(width * height / n);
+  }
+  rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  Cluster* clusters = malloc(numClusters * sizeof(Cluster));
+  for (int i = 0; i < numClusters; i++) {
+    clusters[i].x = width * (0.1 + 0.8 * rng_uniform());
+    clusters[i].y = height * (0.1 + 0.8 * rng_uniform());
+    clusters[i].sigma = WINDOW_HEIGHT * (0.02 + 0.08 * rng_uniform());
+  }
+  int fractalLevels = (int) ceil(log(n) / log(4)) + 1;
+
+  fprintf(out, "%ld\n", n);
+  for (long i = 0; i < n; i++) {
+    double len = sample(lengthDist, length);
+    double half = MIN(len, WINDOW_HEIGHT / 2.0) / 2;
+
+    // Pick a center, retrying until the whole line fits in the domain.
+    double cx, cy;
+    do {
+      switch (placement) {
+        case PLACE_CLUSTERED: {
+          const Cluster* c = &clusters[(int) (rng_uniform() * numClusters)];
+          cx = c->x + c->sigma * rng_gaussian();
+          cy = c->y + c->sigma * rng_gaussian();
+          break;
+        }
+        case PLACE_FRACTAL:
+          fractal_point(&cx, &cy, fractalLevels, width, height);
+          break;
+        default:
+          cx = width * rng_uniform();
+          cy = height * rng_uniform();
+          break;
+      }
+    } while (cx - half < 0 || cx + half >= width ||
+             cy - half < 0 || cy + half >= height);
+
+    double angle = M_PI * rng_uniform();
+    double dx = half * cos(angle);
+    double dy = half * sin(angle);
+
+    double vx = 0, vy = 0;
+    if (rng_uniform() >= staticRatio) {
+      double s = sample(speedDist, speed);
+      double heading = 2 * M_PI * rng_uniform();
+      vx = s * cos(heading);
+      vy = s * sin(heading);
+    }
+
+    fprintf(out, "(%.6f, %.6f), (%.6f, %.6f), %.6f, %.6f, %d\n",
+            cx - dx, cy - dy, cx + dx, cy + dy, vx, vy,
+            rng_uniform() < grayRatio ? GRAY : RED);
+  }
+
+  free(clusters);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
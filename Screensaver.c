@@ -22,11 +22,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <cilk/cilk.h>
 
 #include "./fasttime.h"
+#include "./Instrument.h"
 #include "./Line.h"
+#include "./ContinuousWorld.h"
 #include "./LineDemo.h"
+#include "./SlabWorld.h"
+#include "./TileWorld.h"
 
 // The PROFILE_BUILD preprocessor define is used to indicate we are building for
 // profiling, so don't include any graphics or Cilk functions.
@@ -46,17 +52,263 @@ void lineMain(LineDemo *lineDemo) {
   }
 }
 
+static void printCounts(double elapsed, unsigned int numLineWallCollisions,
+                        unsigned int numLineLineCollisions,
+                        const Histogram* latency) {
+  printf("---- RESULTS ----\n");
+  printf("Elapsed execution time: %fs\n", elapsed);
+  printf("%u Line-Wall Collisions\n", numLineWallCollisions);
+  printf("%u Line-Line Collisions\n", numLineLineCollisions);
+  printf("Frame latency p50/p90/p99/p99.9/max: %.3f/%.3f/%.3f/%.3f/%.3fms\n",
+         Histogram_percentile(latency, 50) * 1e-6,
+         Histogram_percentile(latency, 90) * 1e-6,
+         Histogram_percentile(latency, 99) * 1e-6,
+         Histogram_percentile(latency, 99.9) * 1e-6,
+         latency->max * 1e-6);
+  printf("---- END RESULTS ----\n");
+}
+
+static void printResults(LineDemo* lineDemo, double elapsed, bool autotune) {
+  if (autotune) {
+    const QuadTreeParams* tuned = LineDemo_getQuadTreeParams(lineDemo);
+    printf("Quadtree parameters%s: -n %d -x %d -d %d\n",
+           Autotune_isSettled(lineDemo->autotune) ? "" : " (still tuning)",
+           tuned->maxLines, tuned->spawnGrain, tuned->maxDepth);
+  }
+  printCounts(elapsed, LineDemo_getNumLineWallCollisions(lineDemo),
+              LineDemo_getNumLineLineCollisions(lineDemo),
+              LineDemo_getFrameLatency(lineDemo));
+}
+
+// Runs the frames of lineDemo split over numSlabs processes, with the same
+// results as a single run.  Nothing may run in parallel before this.
+static void slabMain(LineDemo* lineDemo, unsigned int numFrames, int numSlabs,
+                     const QuadTreeParams* params, const char* positionsPath) {
+  SlabWorld* slabWorld = SlabWorld_new(lineDemo->collisionWorld, numSlabs,
+                                       params);
+  if (slabWorld == NULL) {
+    printf("Cannot set up %d slabs\n", numSlabs);
+    exit(-1);
+  }
+  const fasttime_t start_time = gettime();
+  // LineDemo_update stops after running numFrames + 1 frames.
+  bool ok = SlabWorld_run(slabWorld, numFrames + 1);
+  const fasttime_t end_time = gettime();
+  if (!ok) {
+    printf("A slab process failed\n");
+    exit(-1);
+  }
+
+  printCounts(tdiff(start_time, end_time),
+              SlabWorld_getNumLineWallCollisions(slabWorld),
+              SlabWorld_getNumLineLineCollisions(slabWorld),
+              SlabWorld_getFrameLatency(slabWorld));
+  printf("Slabs: %d processes, %.1f halo lines per slab and frame,"
+         " %lu lines handed over\n", numSlabs,
+         SlabWorld_getMeanHaloLines(slabWorld),
+         SlabWorld_getNumMigrations(slabWorld));
+  SlabWorld_copyLines(slabWorld, lineDemo->collisionWorld);
+  SlabWorld_delete(slabWorld);
+  if (positionsPath && !LineDemo_writePositions(lineDemo, positionsPath)) {
+    exit(-1);
+  }
+}
+
+// Runs the frames of lineDemo in a domain of cols x rows windows, each cut
+// into 2^split x 2^split tiles.
+static void tileMain(LineDemo* lineDemo, unsigned int numFrames, int cols,
+                     int rows, int split, const QuadTreeParams* params,
+                     const char* positionsPath) {
+  TileWorld* tileWorld = TileWorld_new(lineDemo->collisionWorld, cols, rows,
+                                       split, params);
+  if (tileWorld == NULL) {
+    printf("Invalid domain: -T %d,%d,%d\n", cols, rows, split);
+    exit(-1);
+  }
+  const fasttime_t start_time = gettime();
+  // LineDemo_update stops after running numFrames + 1 frames.
+  TileWorld_run(tileWorld, numFrames + 1);
+  const fasttime_t end_time = gettime();
+
+  printCounts(tdiff(start_time, end_time),
+              TileWorld_getNumLineWallCollisions(tileWorld),
+              TileWorld_getNumLineLineCollisions(tileWorld),
+              TileWorld_getFrameLatency(tileWorld));
+  printf("Tiles: %d x %d of %.1f x %.1f pixels, %.1f occupied and %.1f"
+         " border copies per frame\n", cols << split, rows << split,
+         TileWorld_getTileWidth(tileWorld), TileWorld_getTileHeight(tileWorld),
+         TileWorld_getMeanTiles(tileWorld),
+         TileWorld_getMeanBorderCopies(tileWorld));
+  TileWorld_copyLines(tileWorld, lineDemo->collisionWorld);
+  TileWorld_delete(tileWorld);
+  if (positionsPath && !LineDemo_writePositions(lineDemo, positionsPath)) {
+    exit(-1);
+  }
+}
+
+// Runs the time of the frames of lineDemo from contact to contact, in steps
+// of framesPerStep frames.
+static void continuousMain(LineDemo* lineDemo, unsigned int numFrames,
+                           int framesPerStep, const char* positionsPath) {
+  ContinuousWorld* continuousWorld =
+      ContinuousWorld_new(lineDemo->collisionWorld, framesPerStep);
+  if (continuousWorld == NULL) {
+    printf("Invalid step: -e %d\n", framesPerStep);
+    exit(-1);
+  }
+  const fasttime_t start_time = gettime();
+  // LineDemo_update stops after running numFrames + 1 frames.
+  ContinuousWorld_run(continuousWorld, numFrames + 1);
+  const fasttime_t end_time = gettime();
+
+  printCounts(tdiff(start_time, end_time),
+              ContinuousWorld_getNumLineWallCollisions(continuousWorld),
+              ContinuousWorld_getNumLineLineCollisions(continuousWorld),
+              ContinuousWorld_getStepLatency(continuousWorld));
+  printf("Continuous: %u steps of %d frames (latencies are per step),"
+         " %lu contacts predicted,\n"
+         "            %lu out of date, %lu left out at %d per line and step\n",
+         ContinuousWorld_getNumSteps(continuousWorld), framesPerStep,
+         ContinuousWorld_getNumPredictions(continuousWorld),
+         ContinuousWorld_getNumStale(continuousWorld),
+         ContinuousWorld_getNumCapped(continuousWorld),
+         CONTINUOUS_MAX_CONTACTS);
+  ContinuousWorld_copyLines(continuousWorld, lineDemo->collisionWorld);
+  ContinuousWorld_delete(continuousWorld);
+  if (positionsPath && !LineDemo_writePositions(lineDemo, positionsPath)) {
+    exit(-1);
+  }
+}
+
+// One scene of a batch.
+typedef struct {
+  char* path;
+  unsigned int numFrames;
+  LineDemo* lineDemo;
+  double elapsed;
+} BatchScene;
+
+// Reads a batch file with one scene per line, "<numFrames> <input_file>",
+// like the arguments of a single run.  Returns the number of scenes.
+static int readBatch(const char* path, BatchScene** scenes) {
+  FILE* in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    exit(-1);
+  }
+  int n = 0;
+  int capacity = 16;
+  *scenes = malloc(capacity * sizeof(BatchScene));
+  char file[4096];
+  unsigned int numFrames;
+  while (fscanf(in, "%u %4095s", &numFrames, file) == 2) {
+    if (n == capacity) {
+      capacity *= 2;
+      *scenes = realloc(*scenes, capacity * sizeof(BatchScene));
+    }
+    (*scenes)[n].path = strdup(file);
+    (*scenes)[n].numFrames = numFrames;
+    n++;
+  }
+  fclose(in);
+  return n;
+}
+
+// Runs every scene of a batch in its own LineDemo.  Each scene's frames run
+// in order as one task, and the tasks of all scenes, together with the
+// parallel work inside their frames, share the one pool of Cilk workers, so
+// small scenes keep the workers that one of them alone could not.  The
+// results of each scene are the same as those of a single run of it.
+static void batchMain(const char* batchPath, const QuadTreeParams* params,
+                      bool autotune, bool adaptive) {
+  BatchScene* scenes;
+  int n = readBatch(batchPath, &scenes);
+  unsigned long totalFrames = 0;
+  unsigned long totalLines = 0;
+  for (int i = 0; i < n; i++) {
+    scenes[i].lineDemo = LineDemo_new();
+    LineDemo_setInputFile(scenes[i].lineDemo, scenes[i].path);
+    LineDemo_initLine(scenes[i].lineDemo);
+    LineDemo_setNumFrames(scenes[i].lineDemo, scenes[i].numFrames);
+    LineDemo_setQuadTreeParams(scenes[i].lineDemo, params);
+    if (autotune) {
+      LineDemo_enableAutotune(scenes[i].lineDemo);
+    }
+    LineDemo_setAdaptiveStepping(scenes[i].lineDemo, adaptive);
+    totalFrames += scenes[i].numFrames;
+    totalLines += LineDemo_getNumOfLines(scenes[i].lineDemo);
+  }
+  INSTRUMENT_INIT(totalFrames + n);
+
+  // Start the biggest scenes first, so that no long scene starts last.
+  BatchScene** order = malloc(n * sizeof(BatchScene*));
+  for (int i = 0; i < n; i++) {
+    int j = i;
+    double size = (double) LineDemo_getNumOfLines(scenes[i].lineDemo) *
+        scenes[i].numFrames;
+    for (; j > 0 && (double) LineDemo_getNumOfLines(order[j - 1]->lineDemo) *
+         order[j - 1]->numFrames < size; j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = &scenes[i];
+  }
+
+  const fasttime_t start_time = gettime();
+#ifdef INSTRUMENT
+  // Phase timings are kept for one frame at a time, so instrumented builds
+  // run the scenes one after another.
+  for (int i = 0; i < n; i++) {
+#else
+  #pragma cilk grainsize = 1
+  cilk_for (int i = 0; i < n; i++) {
+#endif
+    const fasttime_t start = gettime();
+    lineMain(order[i]->lineDemo);
+    order[i]->elapsed = tdiff(start, gettime());
+  }
+  const double elapsed = tdiff(start_time, gettime());
+
+  for (int i = 0; i < n; i++) {
+    printf("Input file path is: %s\n", scenes[i].path);
+    printf("Number of frames = %u\n", scenes[i].numFrames);
+    printResults(scenes[i].lineDemo, scenes[i].elapsed, autotune);
+  }
+  printf("Batch: %d scenes, %lu lines, %lu frames in %fs, %.1f frames/s\n",
+         n, totalLines, totalFrames, elapsed, totalFrames / elapsed);
+
+  INSTRUMENT_REPORT(getenv("INSTRUMENT_OUTPUT"));
+  for (int i = 0; i < n; i++) {
+    LineDemo_delete(scenes[i].lineDemo);
+    free(scenes[i].path);
+  }
+  free(order);
+  free(scenes);
+}
+
 int main(int argc, char *argv[]) {
   int optchar;
 #ifndef PROFILE_BUILD
   bool graphicDemoFlag = false;
 #endif
   bool imageOnlyFlag = false;
+  char* statsPageName = NULL;
+  QuadTreeParams params = QUADTREE_DEFAULT_PARAMS;
+  bool autotuneFlag = false;
+  bool adaptiveFlag = false;
+  char* batchPath = NULL;
+  char* positionsPath = NULL;
+  char* framesPattern = NULL;
+  unsigned int framesEvery = 1;
+  char* commandPath = NULL;
+  unsigned int validateEvery = 0;
+  int numSlabs = 0;
+  int domain[3] = {0, 0, 0};
+  int framesPerStep = 0;
   unsigned int numFrames = 1;
   extern int optind;
 
   // Process command line options.
-  while ((optchar = getopt(argc, argv, "gi")) != -1) {
+  while ((optchar = getopt(argc, argv, "gis:n:x:d:amb:p:o:k:c:v:P:T:e:")) != -1) {
     switch (optchar) {
       case 'g':
 #ifndef PROFILE_BUILD
@@ -69,13 +321,62 @@ int main(int argc, char *argv[]) {
         graphicDemoFlag = true;
 #endif
         break;
+      case 's':
+        statsPageName = optarg;
+        break;
+      case 'n':
+        params.maxLines = atoi(optarg);
+        break;
+      case 'x':
+        params.spawnGrain = atoi(optarg);
+        break;
+      case 'd':
+        params.maxDepth = atoi(optarg);
+        break;
+      case 'a':
+        autotuneFlag = true;
+        break;
+      case 'm':
+        adaptiveFlag = true;
+        break;
+      case 'b':
+        batchPath = optarg;
+        break;
+      case 'p':
+        positionsPath = optarg;
+        break;
+      case 'o':
+        framesPattern = optarg;
+        break;
+      case 'k':
+        framesEvery = atoi(optarg);
+        break;
+      case 'c':
+        commandPath = optarg;
+        break;
+      case 'v':
+        validateEvery = atoi(optarg);
+        break;
+      case 'P':
+        numSlabs = atoi(optarg);
+        break;
+      case 'T':
+        if (sscanf(optarg, "%d,%d,%d", &domain[0], &domain[1],
+                   &domain[2]) < 2) {
+          printf("Invalid domain: -T %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'e':
+        framesPerStep = atoi(optarg);
+        break;
       default:
         printf("Ignoring unrecognized option: %c\n", optchar);
         continue;
     }
   }
 
-  if (!imageOnlyFlag) {
+  if (!imageOnlyFlag && !batchPath) {
     // Shift remaining arguments over.
     int remaining_args = argc - optind;
     for (int i = 1; i <= remaining_args; i++) {
@@ -84,9 +385,51 @@ int main(int argc, char *argv[]) {
 
     // Check to make sure number of arguments is correct.
     if (remaining_args < 1) {
-      printf("Usage: %s [-g] [-i] <numFrames> <optional input_file>\n", argv[0]);
+      printf("Usage: %s [-g] [-i] [-s name] [-n lines] [-x tests] [-d depth]"
+             " [-a] [-m] [-p file] [-o pattern [-k every]] [-c pipe]"
+             " [-v every] [-P slabs] [-T cols,rows[,split]] [-e frames]"
+             " <numFrames>\n"
+             "       <optional input_file>\n",
+             argv[0]);
+      printf("       %s [-n lines] [-x tests] [-d depth] [-a] [-m] -b batch\n",
+             argv[0]);
       printf("  -g : show graphics\n");
       printf("  -i : show first image only (ignore numFrames)\n");
+      printf("  -s : publish live stats to shared memory object /name\n");
+      printf("  -n : max lines in a quadtree leaf (default %d)\n", N);
+      printf("  -x : min estimated pair tests for a parallel quadtree task"
+             " (default %d)\n", SPAWN_GRAIN);
+      printf("  -d : quadtree depth, 1 to %d (default %d)\n", MAX_DEPTH_LIMIT,
+             MAX_DEPTH);
+      printf("  -a : autotune the quadtree parameters, cached in"
+             " $AUTOTUNE_DIR\n"
+             "       (default $XDG_CACHE_HOME/screensaver or"
+             " ~/.cache/screensaver)\n");
+      printf("  -m : step lines far from others several frames at a time\n");
+      printf("  -p : write the final line positions to file\n");
+      printf("  -o : write frames as PPM images named by the printf pattern,"
+             " e.g. frames/%%05d.ppm\n");
+      printf("  -k : with -o, write only every kth frame (default 1)\n");
+      printf("  -c : between frames, apply the commands read from pipe"
+             " (- for stdin):\n"
+             "       \"add (x1, y1), (x2, y2), vx, vy, isGray\" or"
+             " \"remove id\"\n");
+      printf("  -v : check every kth frame, starting with the first, against"
+             " a brute-force\n"
+             "       reference, and fail at the first divergence\n");
+      printf("  -P : split the box into vertical slabs simulated by as many"
+             " processes\n"
+             "       (only -n, -x, -d and -p apply; set CILK_NWORKERS per"
+             " process)\n");
+      printf("  -T : simulate a domain of cols x rows windows, each cut into"
+             " 2^split x 2^split\n"
+             "       tiles (only -n, -x, -d and -p apply)\n");
+      printf("  -e : step from contact to contact at their times of impact,"
+             " in steps of\n"
+             "       frames frames (only -p applies)\n");
+      printf("  -b : run all the scenes listed in batch, one"
+             " \"<numFrames> <input_file>\"\n"
+             "       per line, on one pool of workers\n");
       exit(-1);
     }
 
@@ -101,11 +444,61 @@ int main(int argc, char *argv[]) {
     printf("Number of frames = %u\n", numFrames);
   }
 
+  if (numSlabs < 0) {
+    printf("Invalid number of slabs: -P %d\n", numSlabs);
+    exit(-1);
+  }
+  if (!QuadTreeParams_valid(&params)) {
+    printf("Invalid quadtree parameters: -n %d -x %d -d %d\n", params.maxLines,
+           params.spawnGrain, params.maxDepth);
+    exit(-1);
+  }
+
+  if (batchPath) {
+    batchMain(batchPath, &params, autotuneFlag, adaptiveFlag);
+    return 0;
+  }
+
   // Create and initialize the Line simulation environment.
   LineDemo *lineDemo = LineDemo_new();
-  LineDemo_setInputFile(input_file_path);
+  LineDemo_setInputFile(lineDemo, input_file_path);
   LineDemo_initLine(lineDemo);
   LineDemo_setNumFrames(lineDemo, numFrames);
+  LineDemo_setQuadTreeParams(lineDemo, &params);
+  if (numSlabs > 0) {
+    slabMain(lineDemo, numFrames, numSlabs, &params, positionsPath);
+    LineDemo_delete(lineDemo);
+    return 0;
+  }
+  if (framesPerStep != 0) {
+    continuousMain(lineDemo, numFrames, framesPerStep, positionsPath);
+    LineDemo_delete(lineDemo);
+    return 0;
+  }
+  if (domain[0] > 0) {
+    tileMain(lineDemo, numFrames, domain[0], domain[1], domain[2], &params,
+             positionsPath);
+    LineDemo_delete(lineDemo);
+    return 0;
+  }
+  if (autotuneFlag) {
+    LineDemo_enableAutotune(lineDemo);
+  }
+  LineDemo_setAdaptiveStepping(lineDemo, adaptiveFlag);
+  LineDemo_setValidation(lineDemo, validateEvery);
+  if (statsPageName && !LineDemo_openStatsPage(lineDemo, statsPageName)) {
+    exit(-1);
+  }
+  if (framesPattern &&
+      !LineDemo_openFrameWriter(lineDemo, framesPattern, framesEvery)) {
+    printf("Cannot start writing frames to %s\n", framesPattern);
+    exit(-1);
+  }
+  if (commandPath && !LineDemo_openCommandPipe(lineDemo, commandPath)) {
+    printf("Cannot read commands from %s\n", commandPath);
+    exit(-1);
+  }
+  INSTRUMENT_INIT(numFrames + 1);
 
   const fasttime_t start_time = gettime();
 
@@ -119,18 +512,34 @@ int main(int argc, char *argv[]) {
 #else
   lineMain(lineDemo);
 #endif
+  // Writing out the last frames is part of the run.
+  int numImages = LineDemo_closeFrameWriter(lineDemo);
 
   const fasttime_t end_time = gettime();
 
-  // Output results.
-  printf("---- RESULTS ----\n");
-  printf("Elapsed execution time: %fs\n",
-         tdiff(start_time, end_time));
-  printf("%u Line-Wall Collisions\n",
-         LineDemo_getNumLineWallCollisions(lineDemo));
-  printf("%u Line-Line Collisions\n",
-         LineDemo_getNumLineLineCollisions(lineDemo));
-  printf("---- END RESULTS ----\n");
+  printResults(lineDemo, tdiff(start_time, end_time), autotuneFlag);
+  if (framesPattern) {
+    if (numImages < 0) {
+      exit(-1);
+    }
+    printf("Wrote %d frames to %s\n", numImages, framesPattern);
+  }
+  if (positionsPath && !LineDemo_writePositions(lineDemo, positionsPath)) {
+    exit(-1);
+  }
+  const Oracle* oracle = LineDemo_getOracle(lineDemo);
+  if (oracle) {
+    if (oracle->diverged) {
+      printf("Diverged from the brute-force reference at frame %u\n",
+             oracle->frame);
+      exit(-1);
+    }
+    printf("Checked %u frames against the brute-force reference\n",
+           oracle->numFrames);
+  }
+
+  // Write per-phase timings and counters, if this is an instrumented build.
+  INSTRUMENT_REPORT(getenv("INSTRUMENT_OUTPUT"));
 
   // delete objects
   LineDemo_delete(lineDemo);
@@ -0,0 +1,494 @@
+#include "./SlabWorld.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cilk/cilk.h>
+
+#include "./fasttime.h"
+#include "./IntersectionEventList.h"
+#include "./Line.h"
+
+// Events each slab has room for in one frame: SLAB_EVENTS_PER_LINE per
+// line in the box, and at least SLAB_MIN_EVENTS.  The room is reserved but
+// only takes memory once used.
+#define SLAB_EVENTS_PER_LINE 64
+#define SLAB_MIN_EVENTS (1 << 20)
+
+// An event between the lines at indices l1 < l2 of the shared lines.  As
+// the lines are sorted by ID, the indices order events as the IDs do.
+typedef struct {
+  unsigned int l1, l2;
+  IntersectionType type;
+} SlabEvent;
+
+// What the process of each slab publishes.
+typedef struct {
+  unsigned int numSpill;   // lines reaching across the right border
+  unsigned int numOut;     // lines handed over at the end of the frame
+  unsigned int numEvents;  // events found this frame
+  bool overflow;           // whether they did not all fit
+  unsigned int numLineWallCollisions;
+  unsigned int numLineLineCollisions;
+  unsigned long numHaloLines;
+  unsigned long numMigrations;
+} SlabHeader;
+
+struct SlabWorld {
+  int numSlabs;
+  unsigned int numLines;
+  unsigned int numFrames;
+  double timeStep;
+  QuadTreeParams params;
+  size_t eventCapacity;
+
+  // The memory shared by the processes, made up of the arrays below it.
+  // Slab s spans bounds[s] <= x < bounds[s + 1].  spill, out and events
+  // hold one list per slab, of numLines, numLines and eventCapacity
+  // entries; spill and out list indices in lines.
+  char* shared;
+  size_t sharedSize;
+  pthread_barrier_t* barrier;
+  SlabHeader* headers;
+  double* bounds;
+  Line* lines;
+  unsigned int* spill;
+  unsigned int* out;
+  SlabEvent* events;
+
+  Histogram frameLatency;
+};
+
+// Rounds size up to a whole number of cache lines.
+static inline size_t cache_align(size_t size) {
+  return (size + 63) & ~(size_t) 63;
+}
+
+static int compare_ids(const void* a, const void* b) {
+  return compareLines((Line*) a, (Line*) b);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+static inline int compare_events(const SlabEvent* a, const SlabEvent* b) {
+  if (a->l1 != b->l1) {
+    return a->l1 < b->l1 ? -1 : 1;
+  }
+  return a->l2 < b->l2 ? -1 : a->l2 > b->l2;
+}
+
+static int compare_events_qsort(const void* a, const void* b) {
+  return compare_events(a, b);
+}
+
+SlabWorld* SlabWorld_new(CollisionWorld* collisionWorld, int numSlabs,
+                         const QuadTreeParams* params) {
+  assert(numSlabs > 0);
+  unsigned int n = CollisionWorld_getNumOfLines(collisionWorld);
+  SlabWorld* sw = malloc(sizeof(SlabWorld));
+  if (sw == NULL) {
+    return NULL;
+  }
+  sw->numSlabs = numSlabs;
+  sw->numLines = n;
+  sw->numFrames = 0;
+  sw->timeStep = collisionWorld->timeStep;
+  sw->params = *params;
+  sw->eventCapacity = MAX((size_t) SLAB_EVENTS_PER_LINE * n, SLAB_MIN_EVENTS);
+  Histogram_init(&sw->frameLatency);
+
+  size_t sizes[] = {
+    cache_align(sizeof(pthread_barrier_t)),
+    cache_align(numSlabs * sizeof(SlabHeader)),
+    cache_align((numSlabs + 1) * sizeof(double)),
+    cache_align(n * sizeof(Line)),
+    cache_align((size_t) numSlabs * n * sizeof(unsigned int)),
+    cache_align((size_t) numSlabs * n * sizeof(unsigned int)),
+    numSlabs * sw->eventCapacity * sizeof(SlabEvent)
+  };
+  size_t offsets[7];
+  sw->sharedSize = 0;
+  for (int i = 0; i < 7; i++) {
+    offsets[i] = sw->sharedSize;
+    sw->sharedSize += sizes[i];
+  }
+  sw->shared = mmap(NULL, sw->sharedSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (sw->shared == MAP_FAILED) {
+    perror("mmap");
+    free(sw);
+    return NULL;
+  }
+  sw->barrier = (pthread_barrier_t*) (sw->shared + offsets[0]);
+  sw->headers = (SlabHeader*) (sw->shared + offsets[1]);
+  sw->bounds = (double*) (sw->shared + offsets[2]);
+  sw->lines = (Line*) (sw->shared + offsets[3]);
+  sw->spill = (unsigned int*) (sw->shared + offsets[4]);
+  sw->out = (unsigned int*) (sw->shared + offsets[5]);
+  sw->events = (SlabEvent*) (sw->shared + offsets[6]);
+
+  pthread_barrierattr_t attr;
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  int err = pthread_barrier_init(sw->barrier, &attr, numSlabs);
+  pthread_barrierattr_destroy(&attr);
+  if (err != 0) {
+    munmap(sw->shared, sw->sharedSize);
+    free(sw);
+    return NULL;
+  }
+
+  for (unsigned int i = 0; i < n; i++) {
+    sw->lines[i] = *CollisionWorld_getLine(collisionWorld, i);
+  }
+  qsort(sw->lines, n, sizeof(Line), compare_ids);
+  for (unsigned int i = 0; i < n; i++) {
+    sw->lines[i].next = NULL;
+    update_box(&sw->lines[i], sw->timeStep);
+  }
+
+  // Cut the box where equal numbers of boxes start, to begin with.
+  double* starts = malloc(n * sizeof(double));
+  for (unsigned int i = 0; i < n; i++) {
+    starts[i] = sw->lines[i].l_x;
+  }
+  qsort(starts, n, sizeof(double), compare_doubles);
+  sw->bounds[0] = -INFINITY;
+  sw->bounds[numSlabs] = INFINITY;
+  for (int s = 1; s < numSlabs; s++) {
+    sw->bounds[s] = n > 0 ? starts[(size_t) s * n / numSlabs] :
+        BOX_XMIN + (BOX_XMAX - BOX_XMIN) * s / numSlabs;
+  }
+  free(starts);
+  return sw;
+}
+
+void SlabWorld_delete(SlabWorld* slabWorld) {
+  pthread_barrier_destroy(slabWorld->barrier);
+  munmap(slabWorld->shared, slabWorld->sharedSize);
+  free(slabWorld);
+}
+
+// The slab in which the box of l starts.
+static inline int slab_of(const SlabWorld* sw, const Line* l) {
+  int s = 0;
+  while (s + 1 < sw->numSlabs && l->l_x >= sw->bounds[s + 1]) {
+    s++;
+  }
+  return s;
+}
+
+// Finds the events among the n own lines, and between them and the
+// numHalo halo lines, which are in no tree, collecting them in iel.
+static IntersectionEventList detect_events(QuadTree* tree, Line** owned,
+                                           unsigned int n, Line** halo,
+                                           unsigned int numHalo, double t,
+                                           IntersectionEventCollector* iel) {
+  QuadTree_sortLines(tree, owned, n, t);
+
+  // QuadTree_detectEvents passes lines down into the lists of the nodes
+  // below them, so the halo lines go first.
+  cilk_for (int i = 0; i < numHalo; i++) {
+    QuadTree_detectEventsWithLine(tree, halo[i], t, iel);
+  }
+  QuadTree_detectEvents(tree, NULL, t, iel);
+  return IntersectionEventCollector_take(iel);
+}
+
+// Runs numFrames frames as the process of slab index.  Returns false if
+// the events of any slab overflowed.
+static bool run_slab(SlabWorld* sw, int index, unsigned int numFrames) {
+  unsigned int n = sw->numLines;
+  int numSlabs = sw->numSlabs;
+  double t = sw->timeStep;
+  SlabHeader* header = &sw->headers[index];
+  unsigned int* spill = sw->spill + (size_t) index * n;
+  unsigned int* out = sw->out + (size_t) index * n;
+  SlabEvent* events = sw->events + index * sw->eventCapacity;
+
+  // The own lines, the halo lines of this frame, and the merge position in
+  // each slab's events.  mine holds the frame each line was last owned by
+  // this slab in.  scratch holds private copies of the lines in the events
+  // to solve, by index, and copied the frame each was last copied in.
+  // order holds the events of all slabs in ID order.
+  Line** owned = malloc(n * sizeof(Line*));
+  Line** halo = malloc(n * sizeof(Line*));
+  unsigned int* mine = calloc(n, sizeof(unsigned int));
+  Line* scratch = malloc(n * sizeof(Line));
+  unsigned int* copied = calloc(n, sizeof(unsigned int));
+  unsigned int* merged = malloc(numSlabs * sizeof(unsigned int));
+  const SlabEvent** order = NULL;
+  size_t orderCapacity = 0;
+  QuadTree* tree = QuadTree_make(BOX_XMIN, BOX_XMAX, BOX_YMIN, BOX_YMAX,
+                                 &sw->params);
+  QuadTree_build(tree, sw->params.maxDepth);
+  IntersectionEventCollector collector;
+  IntersectionEventCollector_init(&collector);
+
+  unsigned int numOwned = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    if (slab_of(sw, &sw->lines[i]) == index) {
+      owned[numOwned++] = &sw->lines[i];
+    }
+  }
+
+  bool ok = true;
+  for (unsigned int frame = 1; frame <= numFrames; frame++) {
+    const fasttime_t start = gettime();
+
+    // Take over the lines handed to this slab at the end of the last frame,
+    // and publish the own lines whose boxes reach into the next slab.
+    for (int s = 0; s < numSlabs; s++) {
+      const unsigned int* theirs = sw->out + (size_t) s * n;
+      for (unsigned int k = 0; s != index && k < sw->headers[s].numOut; k++) {
+        Line* l = &sw->lines[theirs[k]];
+        if (slab_of(sw, l) == index) {
+          owned[numOwned++] = l;
+          header->numMigrations++;
+        }
+      }
+    }
+    unsigned int numSpill = 0;
+    for (unsigned int i = 0; index + 1 < numSlabs && i < numOwned; i++) {
+      if (owned[i]->u_x >= sw->bounds[index + 1]) {
+        spill[numSpill++] = owned[i] - sw->lines;
+      }
+    }
+    header->numSpill = numSpill;
+    pthread_barrier_wait(sw->barrier);
+
+    // Test the own lines against each other and against the lines of the
+    // slabs to the left that reach into this one, and publish the events.
+    unsigned int numHalo = 0;
+    for (int s = 0; s < index; s++) {
+      const unsigned int* theirs = sw->spill + (size_t) s * n;
+      for (unsigned int k = 0; k < sw->headers[s].numSpill; k++) {
+        Line* l = &sw->lines[theirs[k]];
+        if (l->u_x >= sw->bounds[index]) {
+          halo[numHalo++] = l;
+        }
+      }
+    }
+    header->numHaloLines += numHalo;
+    IntersectionEventList iel = detect_events(tree, owned, numOwned, halo,
+                                              numHalo, t, &collector);
+    header->overflow = iel.count > sw->eventCapacity;
+    unsigned int numEvents = 0;
+    for (IntersectionEventNode* node = iel.head;
+         node && numEvents < sw->eventCapacity; node = node->next) {
+      SlabEvent e = {node->l1 - sw->lines, node->l2 - sw->lines,
+                     node->intersectionType};
+      events[numEvents++] = e;
+    }
+    IntersectionEventList_deleteNodes(&iel);
+    qsort(events, numEvents, sizeof(SlabEvent), compare_events_qsort);
+    header->numEvents = numEvents;
+    header->numLineLineCollisions += numEvents;
+    pthread_barrier_wait(sw->barrier);
+
+    for (int s = 0; s < numSlabs; s++) {
+      ok = ok && !sw->headers[s].overflow;
+    }
+    if (!ok) {
+      if (index == 0) {
+        fprintf(stderr, "More than %zu events in one slab in frame %u\n",
+                sw->eventCapacity, frame);
+      }
+      break;
+    }
+
+    // Merge the events of all slabs in ID order, as one CollisionWorld
+    // would solve them.
+    size_t numAll = 0;
+    for (int s = 0; s < numSlabs; s++) {
+      numAll += sw->headers[s].numEvents;
+      merged[s] = 0;
+    }
+    if (numAll > orderCapacity) {
+      orderCapacity = MAX(numAll, 2 * orderCapacity);
+      order = realloc(order, orderCapacity * sizeof(SlabEvent*));
+      assert(order);
+    }
+    for (size_t i = 0; i < numAll; i++) {
+      const SlabEvent* next = NULL;
+      int from = 0;
+      for (int s = 0; s < numSlabs; s++) {
+        const SlabEvent* e = sw->events + s * sw->eventCapacity + merged[s];
+        if (merged[s] < sw->headers[s].numEvents &&
+            (next == NULL || compare_events(e, next) < 0)) {
+          next = e;
+          from = s;
+        }
+      }
+      merged[from]++;
+      order[i] = next;
+    }
+
+    // An event changes the velocities of the own lines only if it involves
+    // one of them, or a line of a later event that does.  Going backwards,
+    // keep those events at the end of order, and copy their lines before
+    // their owners change them.
+    for (unsigned int i = 0; i < numOwned; i++) {
+      mine[owned[i] - sw->lines] = frame;
+    }
+    size_t first = numAll;
+    for (size_t i = numAll; i-- > 0;) {
+      const SlabEvent* e = order[i];
+      if (mine[e->l1] != frame && copied[e->l1] != frame &&
+          mine[e->l2] != frame && copied[e->l2] != frame) {
+        continue;
+      }
+      unsigned int ends[2] = {e->l1, e->l2};
+      for (int j = 0; j < 2; j++) {
+        if (copied[ends[j]] != frame) {
+          scratch[ends[j]] = sw->lines[ends[j]];
+          copied[ends[j]] = frame;
+        }
+      }
+      order[--first] = e;
+    }
+    pthread_barrier_wait(sw->barrier);
+
+    for (size_t i = first; i < numAll; i++) {
+      // The solver keeps no state in the CollisionWorld.
+      CollisionWorld_collisionSolver(NULL, &scratch[order[i]->l1],
+                                     &scratch[order[i]->l2], order[i]->type);
+    }
+
+    // Move the own lines, and hand over those whose boxes now start in
+    // another slab.
+    unsigned int kept = 0;
+    unsigned int numOut = 0;
+    for (unsigned int i = 0; i < numOwned; i++) {
+      Line* l = owned[i];
+      unsigned int k = l - sw->lines;
+      if (copied[k] == frame) {
+        l->velocity = scratch[k].velocity;
+      }
+      step_line(l, t);
+      if (bounce_off_walls(l)) {
+        header->numLineWallCollisions++;
+      }
+      update_box(l, t);
+      if (slab_of(sw, l) == index) {
+        owned[kept++] = l;
+      } else {
+        out[numOut++] = k;
+      }
+    }
+    numOwned = kept;
+    header->numOut = numOut;
+    pthread_barrier_wait(sw->barrier);
+
+    if (index == 0) {
+      Histogram_record(&sw->frameLatency,
+                       (uint64_t) (tdiff(start, gettime()) * 1e9));
+    }
+  }
+
+  QuadTree_delete(tree);
+  IntersectionEventCollector_destroy(&collector);
+  free(owned);
+  free(halo);
+  free(mine);
+  free(scratch);
+  free(copied);
+  free(merged);
+  free(order);
+  return ok;
+}
+
+bool SlabWorld_run(SlabWorld* slabWorld, unsigned int numFrames) {
+  int numChildren = slabWorld->numSlabs - 1;
+  pid_t* children = malloc(numChildren * sizeof(pid_t));
+  slabWorld->numFrames = numFrames;
+  fflush(stdout);
+  fflush(stderr);
+  for (int i = 0; i < numChildren; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      _exit(run_slab(slabWorld, i + 1, numFrames) ? 0 : 1);
+    }
+    if (pid < 0) {
+      perror("fork");
+      for (int j = 0; j < i; j++) {
+        kill(children[j], SIGKILL);
+        waitpid(children[j], NULL, 0);
+      }
+      free(children);
+      return false;
+    }
+    children[i] = pid;
+  }
+
+  bool ok = run_slab(slabWorld, 0, numFrames);
+  for (int i = 0; i < numChildren; i++) {
+    int status;
+    if (waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      ok = false;
+    }
+  }
+  free(children);
+  return ok;
+}
+
+void SlabWorld_copyLines(SlabWorld* slabWorld,
+                         CollisionWorld* collisionWorld) {
+  for (unsigned int i = 0; i < slabWorld->numLines; i++) {
+    Line* from = &slabWorld->lines[i];
+    Line* to = CollisionWorld_getLineById(collisionWorld, from->id);
+    to->p1 = from->p1;
+    to->p2 = from->p2;
+    to->velocity = from->velocity;
+  }
+}
+
+unsigned int SlabWorld_getNumLineWallCollisions(SlabWorld* slabWorld) {
+  unsigned int sum = 0;
+  for (int s = 0; s < slabWorld->numSlabs; s++) {
+    sum += slabWorld->headers[s].numLineWallCollisions;
+  }
+  return sum;
+}
+
+unsigned int SlabWorld_getNumLineLineCollisions(SlabWorld* slabWorld) {
+  unsigned int sum = 0;
+  for (int s = 0; s < slabWorld->numSlabs; s++) {
+    sum += slabWorld->headers[s].numLineLineCollisions;
+  }
+  return sum;
+}
+
+double SlabWorld_getMeanHaloLines(SlabWorld* slabWorld) {
+  unsigned long sum = 0;
+  for (int s = 0; s < slabWorld->numSlabs; s++) {
+    sum += slabWorld->headers[s].numHaloLines;
+  }
+  return slabWorld->numFrames > 0 ?
+      (double) sum / slabWorld->numSlabs / slabWorld->numFrames : 0;
+}
+
+unsigned long SlabWorld_getNumMigrations(SlabWorld* slabWorld) {
+  unsigned long sum = 0;
+  for (int s = 0; s < slabWorld->numSlabs; s++) {
+    sum += slabWorld->headers[s].numMigrations;
+  }
+  return sum;
+}
+
+const Histogram* SlabWorld_getFrameLatency(SlabWorld* slabWorld) {
+  return &slabWorld->frameLatency;
+}
@@ -0,0 +1,70 @@
+#ifndef SLABWORLD_H_
+#define SLABWORLD_H_
+
+// The simulation split over several processes on one host.
+//
+// The box is cut into vertical slabs, one per process, at quantiles of
+// where the lines' boxes start, and each process owns the lines whose boxes
+// start in its slab.  All lines live in memory shared by the processes, but
+// each process writes only the lines it owns.  Every frame it publishes
+// the lines whose boxes reach across its right border.  Each process then
+// tests its own lines against each other and against those halo lines from
+// the slabs to its left, so every pair that may meet is tested exactly
+// once, by the owner of the line whose box starts further right.
+//
+// The events of all slabs are merged in line ID order.  Each process then
+// picks out the events that lead up to the new velocities of the lines it
+// owns: going back from the last event, those that involve one of its lines
+// or a line of an event already picked.  It solves only those, in order, on
+// private copies of their lines, and keeps the new velocities of its own
+// lines.  So the solver sees the events that matter in the same order, and
+// the counts and positions come out the same, as in a single CollisionWorld,
+// while most of the solving is split among the processes.  A line whose box
+// starts in another slab after it moves is handed over to that slab's
+// process for the next frame.  The processes keep in step through barriers
+// in the shared memory.
+//
+// Static lines and adaptive stepping are not used; every line is stepped
+// and checked against the walls every frame.
+
+#include <stdbool.h>
+
+#include "./CollisionWorld.h"
+#include "./Histogram.h"
+#include "./Quadtree.h"
+
+typedef struct SlabWorld SlabWorld;
+
+// Copies the lines of collisionWorld, which must not have run a frame yet,
+// into shared memory for numSlabs processes.  Returns NULL if the memory
+// cannot be set up.
+SlabWorld* SlabWorld_new(CollisionWorld* collisionWorld, int numSlabs,
+                         const QuadTreeParams* params);
+
+void SlabWorld_delete(SlabWorld* slabWorld);
+
+// Runs numFrames frames in this process and numSlabs - 1 forked ones.  No
+// Cilk parallel work may have run in this process before, as forking does
+// not copy the Cilk runtime's worker threads.  Returns false if a process
+// failed or could not be started.
+bool SlabWorld_run(SlabWorld* slabWorld, unsigned int numFrames);
+
+// Copies the positions and velocities of the lines back into
+// collisionWorld, the one the SlabWorld was made from.
+void SlabWorld_copyLines(SlabWorld* slabWorld,
+                         CollisionWorld* collisionWorld);
+
+unsigned int SlabWorld_getNumLineWallCollisions(SlabWorld* slabWorld);
+
+unsigned int SlabWorld_getNumLineLineCollisions(SlabWorld* slabWorld);
+
+// Get the mean number of halo lines per slab and frame, and the number of
+// lines handed over between slabs.
+double SlabWorld_getMeanHaloLines(SlabWorld* slabWorld);
+unsigned long SlabWorld_getNumMigrations(SlabWorld* slabWorld);
+
+// Get the histogram of frame latencies, in nanoseconds, seen by this
+// process.
+const Histogram* SlabWorld_getFrameLatency(SlabWorld* slabWorld);
+
+#endif  // SLABWORLD_H_
@@ -0,0 +1,55 @@
+#include "./Snapshot.h"
+
+#include <stdlib.h>
+
+void Snapshot_init(Snapshot* snapshot) {
+  snapshot->lines = NULL;
+  snapshot->numLines = 0;
+  snapshot->capacity = 0;
+}
+
+void Snapshot_destroy(Snapshot* snapshot) {
+  free(snapshot->lines);
+  Snapshot_init(snapshot);
+}
+
+void Snapshot_capture(Snapshot* snapshot, CollisionWorld* collisionWorld) {
+  unsigned int numLines = CollisionWorld_getNumOfLines(collisionWorld);
+  if (numLines > snapshot->capacity) {
+    free(snapshot->lines);
+    snapshot->lines = malloc(numLines * sizeof(SnapshotLine));
+    snapshot->capacity = numLines;
+  }
+  for (unsigned int i = 0; i < numLines; i++) {
+    Line* line = CollisionWorld_getLine(collisionWorld, i);
+    snapshot->lines[i].p1 = line->p1;
+    snapshot->lines[i].p2 = line->p2;
+    snapshot->lines[i].color = line->color;
+  }
+  snapshot->numLines = numLines;
+}
+
+void Snapshot_toSegments(const Snapshot* snapshot, Segment* red, int* numRed,
+                         Segment* gray, int* numGray) {
+  window_dimension px1;
+  window_dimension py1;
+  window_dimension px2;
+  window_dimension py2;
+
+  *numRed = 0;
+  *numGray = 0;
+  for (unsigned int i = 0; i < snapshot->numLines; i++) {
+    const SnapshotLine* line = &snapshot->lines[i];
+
+    // Convert box coordinates to window coordinates.
+    boxToWindow(&px1, &py1, line->p1.x, line->p1.y);
+    boxToWindow(&px2, &py2, line->p2.x, line->p2.y);
+    Segment* segment = line->color == RED ? &red[(*numRed)++]
+                                          : &gray[(*numGray)++];
+    // Convert doubles to short ints.
+    segment->x1 = (int16_t) px1;
+    segment->y1 = (int16_t) py1;
+    segment->x2 = (int16_t) px2;
+    segment->y2 = (int16_t) py2;
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+// A copy of the line positions at the end of a frame.
+//
+// Renderers draw from snapshots on their own threads while the simulation
+// moves on.  Taking a snapshot only copies the endpoints and colors; the
+// conversion to window coordinates is left to the renderer.
+
+#include <stdint.h>
+
+#include "./CollisionWorld.h"
+#include "./Line.h"
+
+// The position and color of one line.
+typedef struct {
+  Vec p1;
+  Vec p2;
+  Color color;
+} SnapshotLine;
+
+typedef struct {
+  SnapshotLine* lines;
+  unsigned int numLines;
+  unsigned int capacity;
+} Snapshot;
+
+// A line segment in window coordinates.  It has the layout of XSegment, so
+// the X renderer can draw an array of them directly.
+typedef struct {
+  int16_t x1, y1, x2, y2;
+} Segment;
+
+// Initializes an empty snapshot.
+void Snapshot_init(Snapshot* snapshot);
+
+void Snapshot_destroy(Snapshot* snapshot);
+
+// Copies every line of collisionWorld into snapshot.
+void Snapshot_capture(Snapshot* snapshot, CollisionWorld* collisionWorld);
+
+// Converts the lines of snapshot to window coordinates and splits them by
+// color.  red and gray must each have room for snapshot->numLines segments.
+void Snapshot_toSegments(const Snapshot* snapshot, Segment* red, int* numRed,
+                         Segment* gray, int* numGray);
+
+#endif  // SNAPSHOT_H_
@@ -0,0 +1,374 @@
+#include "./SpatialQuery.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <cilk/cilk.h>
+
+// Slack around the regions of quadtree nodes and the bounds of their lines,
+// so that rounding in the tests against them never skips a line on their
+// edge.
+#define QUERY_SLACK 1e-12
+
+typedef QuadTreeBox Box;
+
+// The region of child i of q, given the region of q.  QuadTree_getQuad puts
+// a line in a child only if it lies strictly on the child's side of both
+// midlines of q, but only the midlines bound it: the root is unbounded,
+// since lines may cross the walls.
+static inline Box child_box(const Box* region, const QuadTree* q, int i) {
+  Box c = *region;
+  if (i & 1) {
+    c.x1 = q->x0 - QUERY_SLACK;
+  } else {
+    c.x2 = q->x0 + QUERY_SLACK;
+  }
+  if (i & 2) {
+    c.y1 = q->y0 - QUERY_SLACK;
+  } else {
+    c.y2 = q->y0 + QUERY_SLACK;
+  }
+  return c;
+}
+
+static const Box unbounded = {-INFINITY, INFINITY, -INFINITY, INFINITY};
+
+static inline bool boxes_overlap(const Box* a, const Box* b) {
+  return a->x1 <= b->x2 && b->x1 <= a->x2 && a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+static inline double cross(double x1, double y1, double x2, double y2) {
+  return x1 * y2 - y1 * x2;
+}
+
+static void reserve(SpatialQuery* query, int count) {
+  if (count > query->capacity) {
+    query->capacity = MAX(count, 2 * query->capacity);
+    query->ids = realloc(query->ids, query->capacity * sizeof(unsigned int));
+    assert(query->ids);
+  }
+}
+
+static inline void add_id(SpatialQuery* query, unsigned int id) {
+  reserve(query, query->count + 1);
+  query->ids[query->count++] = id;
+}
+
+// Keeps l as the answer if it is nearer than the one found so far.
+static inline void offer(SpatialQuery* query, const Line* l, double d) {
+  if (d < query->distance ||
+      (d == query->distance && query->count > 0 && l->id < query->ids[0])) {
+    reserve(query, 1);
+    query->ids[0] = l->id;
+    query->count = 1;
+    query->distance = d;
+  }
+}
+
+// Whether segment l touches the closed box r: their bounding boxes overlap
+// and the corners of r are not all on one side of the line through l.
+static inline bool segment_touches_box(const Line* l, const Box* r) {
+  double x1 = l->p1.x;
+  double y1 = l->p1.y;
+  double x2 = l->p2.x;
+  double y2 = l->p2.y;
+  if (MAX(x1, x2) < r->x1 || MIN(x1, x2) > r->x2 ||
+      MAX(y1, y2) < r->y1 || MIN(y1, y2) > r->y2) {
+    return false;
+  }
+  double ex = x2 - x1;
+  double ey = y2 - y1;
+  double c1 = cross(ex, ey, r->x1 - x1, r->y1 - y1);
+  double c2 = cross(ex, ey, r->x2 - x1, r->y1 - y1);
+  double c3 = cross(ex, ey, r->x1 - x1, r->y2 - y1);
+  double c4 = cross(ex, ey, r->x2 - x1, r->y2 - y1);
+  return !((c1 > 0 && c2 > 0 && c3 > 0 && c4 > 0) ||
+           (c1 < 0 && c2 < 0 && c3 < 0 && c4 < 0));
+}
+
+// Whether the ray from o in direction d hits segment l, and if so sets *t
+// to the ray parameter of the first point hit.
+static inline bool ray_hits_segment(Vec o, Vec d, const Line* l, double* t) {
+  double wx = (double) l->p1.x - o.x;
+  double wy = (double) l->p1.y - o.y;
+  double ex = (double) l->p2.x - l->p1.x;
+  double ey = (double) l->p2.y - l->p1.y;
+  double denom = cross(d.x, d.y, ex, ey);
+  if (denom != 0) {
+    double s = cross(wx, wy, d.x, d.y) / denom;
+    *t = cross(wx, wy, ex, ey) / denom;
+    return *t >= 0 && s >= 0 && s <= 1;
+  }
+
+  // Parallel: a hit only if collinear, at the nearer end ahead of o.
+  double dd = (double) d.x * d.x + (double) d.y * d.y;
+  if (dd == 0 || cross(wx, wy, d.x, d.y) != 0) {
+    return false;
+  }
+  double t1 = (wx * d.x + wy * d.y) / dd;
+  double t2 = ((wx + ex) * d.x + (wy + ey) * d.y) / dd;
+  if (MAX(t1, t2) < 0) {
+    return false;
+  }
+  *t = MAX(0, MIN(t1, t2));
+  return true;
+}
+
+// Narrows [*t0, *t1] to the ray parameters within [lo, hi] on one axis.
+static inline bool clip_slab(double o, double d, double lo, double hi,
+                             double* t0, double* t1) {
+  if (d == 0) {
+    return lo <= o && o <= hi;
+  }
+  double a = (lo - o) / d;
+  double b = (hi - o) / d;
+  *t0 = MAX(*t0, MIN(a, b));
+  *t1 = MIN(*t1, MAX(a, b));
+  return *t0 <= *t1;
+}
+
+// Whether the ray from o in direction d reaches box b, and if so sets
+// *entry to the ray parameter at which it first does.
+static inline bool ray_enters_box(Vec o, Vec d, const Box* b, double* entry) {
+  double t0 = 0;
+  double t1 = INFINITY;
+  if (!clip_slab(o.x, d.x, b->x1, b->x2, &t0, &t1) ||
+      !clip_slab(o.y, d.y, b->y1, b->y2, &t0, &t1)) {
+    return false;
+  }
+  *entry = t0;
+  return true;
+}
+
+static inline double segment_distance2(Vec p, const Line* l) {
+  double ex = (double) l->p2.x - l->p1.x;
+  double ey = (double) l->p2.y - l->p1.y;
+  double wx = (double) p.x - l->p1.x;
+  double wy = (double) p.y - l->p1.y;
+  double ee = ex * ex + ey * ey;
+  double s = ee > 0 ? MIN(1, MAX(0, (wx * ex + wy * ey) / ee)) : 0;
+  double dx = wx - s * ex;
+  double dy = wy - s * ey;
+  return dx * dx + dy * dy;
+}
+
+static inline double box_distance2(Vec p, const Box* b) {
+  double dx = MAX(0, MAX(b->x1 - p.x, p.x - b->x2));
+  double dy = MAX(0, MAX(b->y1 - p.y, p.y - b->y2));
+  return dx * dx + dy * dy;
+}
+
+// Tests one line against the query.  Nearest queries compare squared
+// distances until they are done.
+static inline void visit_line(SpatialQuery* query, const Line* l,
+                              const Box* range) {
+  double t;
+  switch (query->type) {
+    case QUERY_RANGE:
+      if (segment_touches_box(l, range)) {
+        add_id(query, l->id);
+      }
+      break;
+    case QUERY_RAY:
+      if (ray_hits_segment(query->a, query->b, l, &t)) {
+        offer(query, l, t);
+      }
+      break;
+    case QUERY_NEAREST:
+      offer(query, l, segment_distance2(query->a, l));
+      break;
+  }
+}
+
+// Tests the lines from first up to, not including, last.
+static inline void visit_lines(Line* first, Line* last, SpatialQuery* query,
+                               const Box* range) {
+  for (Line* l = first; l != last; l = l->next) {
+    visit_line(query, l, range);
+  }
+}
+
+// Searches q for the lines touching range: the own lines of q in each group
+// whose bounds reach range, then the children whose regions do.
+static void range_node(const QuadTree* q, const Box* region,
+                       SpatialQuery* query, const Box* range) {
+  Line* rest = q->firstRest;
+  if (q->lines->head != rest && boxes_overlap(&q->crossingBounds, range)) {
+    visit_lines(q->lines->head, rest, query, range);
+  }
+  if (rest && boxes_overlap(&q->restBounds, range)) {
+    visit_lines(rest, NULL, query, range);
+  }
+  if (q->leaf) {
+    return;
+  }
+  for (int i = 0; i < 4; i++) {
+    Box c = child_box(region, q, i);
+    if (q->quads[i]->subtreeLines > 0 && boxes_overlap(&c, range)) {
+      range_node(q->quads[i], &c, query, range);
+    }
+  }
+}
+
+// Inserts entry child into the first *n entries of order, kept sorted by
+// key.
+static inline void insert_child(int* order, double* keys, int* n, int child,
+                                double key) {
+  int k = (*n)++;
+  for (; k > 0 && keys[k - 1] > key; k--) {
+    keys[k] = keys[k - 1];
+    order[k] = order[k - 1];
+  }
+  keys[k] = key;
+  order[k] = child;
+}
+
+// A lower bound on the distance to the query of any line within box b, or
+// false if none can be found there.
+static inline bool box_key(const SpatialQuery* query, const Box* b,
+                           double* key) {
+  Box padded = {b->x1 - QUERY_SLACK, b->x2 + QUERY_SLACK,
+                b->y1 - QUERY_SLACK, b->y2 + QUERY_SLACK};
+  if (query->type == QUERY_RAY) {
+    return ray_enters_box(query->a, query->b, &padded, key);
+  }
+  *key = box_distance2(query->a, &padded);
+  return true;
+}
+
+// Searches q for the line nearest to the query, the first hit along a ray
+// or the nearest to a point.  The two groups of own lines of q and its
+// children are searched in order of a lower bound on the distance of their
+// lines, up to the first that cannot hold anything nearer than the answer
+// so far.  Entries 0 and 1 are the groups, 2 to 5 the children.
+static void closest_node(const QuadTree* q, const Box* region,
+                         SpatialQuery* query) {
+  Line* rest = q->firstRest;
+  Box boxes[6];
+  double keys[6];
+  int order[6];
+  int n = 0;
+  double key;
+  if (q->lines->head != rest && box_key(query, &q->crossingBounds, &key)) {
+    insert_child(order, keys, &n, 0, key);
+  }
+  if (rest && box_key(query, &q->restBounds, &key)) {
+    insert_child(order, keys, &n, 1, key);
+  }
+  for (int i = 0; !q->leaf && i < 4; i++) {
+    boxes[i + 2] = child_box(region, q, i);
+    if (q->quads[i]->subtreeLines > 0 &&
+        box_key(query, &boxes[i + 2], &key)) {
+      insert_child(order, keys, &n, i + 2, key);
+    }
+  }
+
+  for (int k = 0; k < n && keys[k] <= query->distance; k++) {
+    switch (order[k]) {
+      case 0:
+        visit_lines(q->lines->head, rest, query, NULL);
+        break;
+      case 1:
+        visit_lines(rest, NULL, query, NULL);
+        break;
+      default:
+        closest_node(q->quads[order[k] - 2], &boxes[order[k]], query);
+        break;
+    }
+  }
+}
+
+SpatialQueryBatch* SpatialQueryBatch_new() {
+  SpatialQueryBatch* batch = malloc(sizeof(SpatialQueryBatch));
+  if (batch == NULL) {
+    return NULL;
+  }
+  batch->queries = NULL;
+  batch->count = 0;
+  batch->capacity = 0;
+  return batch;
+}
+
+void SpatialQueryBatch_delete(SpatialQueryBatch* batch) {
+  for (int i = 0; i < batch->capacity; i++) {
+    free(batch->queries[i].ids);
+  }
+  free(batch->queries);
+  free(batch);
+}
+
+void SpatialQueryBatch_clear(SpatialQueryBatch* batch) {
+  batch->count = 0;
+}
+
+// Adds a query, reusing the result buffer of an earlier one in its place.
+static int add_query(SpatialQueryBatch* batch, SpatialQueryType type, Vec a,
+                     Vec b) {
+  if (batch->count == batch->capacity) {
+    int capacity = MAX(16, 2 * batch->capacity);
+    batch->queries = realloc(batch->queries, capacity * sizeof(SpatialQuery));
+    assert(batch->queries);
+    for (int i = batch->capacity; i < capacity; i++) {
+      batch->queries[i].ids = NULL;
+      batch->queries[i].capacity = 0;
+    }
+    batch->capacity = capacity;
+  }
+  SpatialQuery* query = &batch->queries[batch->count];
+  query->type = type;
+  query->a = a;
+  query->b = b;
+  query->count = 0;
+  query->distance = INFINITY;
+  return batch->count++;
+}
+
+int SpatialQueryBatch_addRange(SpatialQueryBatch* batch, Vec lo, Vec hi) {
+  return add_query(batch, QUERY_RANGE, lo, hi);
+}
+
+int SpatialQueryBatch_addRay(SpatialQueryBatch* batch, Vec origin,
+                             Vec direction) {
+  return add_query(batch, QUERY_RAY, origin, direction);
+}
+
+int SpatialQueryBatch_addNearest(SpatialQueryBatch* batch, Vec point) {
+  return add_query(batch, QUERY_NEAREST, point, point);
+}
+
+static int compare_ids(const void* a, const void* b) {
+  unsigned int x = *(const unsigned int*) a;
+  unsigned int y = *(const unsigned int*) b;
+  return x < y ? -1 : x > y;
+}
+
+void SpatialQueryBatch_run(SpatialQueryBatch* batch, QuadTree** trees,
+                           int numTrees, Line** lines, int numLines) {
+  for (int j = 0; j < numTrees; j++) {
+    QuadTree_boundLines(trees[j]);
+  }
+
+  cilk_for (int i = 0; i < batch->count; i++) {
+    SpatialQuery* query = &batch->queries[i];
+    Box range = {query->a.x, query->b.x, query->a.y, query->b.y};
+    query->count = 0;
+    query->distance = INFINITY;
+
+    for (int j = 0; j < numTrees; j++) {
+      if (query->type == QUERY_RANGE) {
+        range_node(trees[j], &unbounded, query, &range);
+      } else {
+        closest_node(trees[j], &unbounded, query);
+      }
+    }
+    for (int j = 0; j < numLines; j++) {
+      visit_line(query, lines[j], &range);
+    }
+
+    if (query->type == QUERY_RANGE) {
+      qsort(query->ids, query->count, sizeof(unsigned int), compare_ids);
+    } else if (query->type == QUERY_NEAREST) {
+      query->distance = sqrt(query->distance);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef SPATIALQUERY_H_
+#define SPATIALQUERY_H_
+
+// Batches of spatial queries against the lines of a scene: the lines that
+// touch a box, the first line a ray hits, and the line nearest to a point.
+//
+// The queries of a batch are answered in parallel by walking quadtrees
+// whose nodes hold the lines, as sorted by QuadTree_addLines, so the tree
+// built for collision detection serves as the index.  Lines that are in no
+// tree can be passed alongside and are scanned one by one.  All positions
+// are in box coordinates, and answers do not depend on how the lines are
+// spread over the trees.
+
+#include <stdbool.h>
+
+#include "./Line.h"
+#include "./Quadtree.h"
+#include "./Vec.h"
+
+typedef enum {
+  QUERY_RANGE,    // lines touching the closed box with corners a <= b
+  QUERY_RAY,      // first line hit by the ray from a in direction b
+  QUERY_NEAREST   // line nearest to the point a
+} SpatialQueryType;
+
+typedef struct SpatialQuery {
+  SpatialQueryType type;
+  Vec a, b;
+
+  // The IDs of the lines found, ids[0] to ids[count - 1].  A range query
+  // lists them in ID order.  A ray or nearest query finds at most one line,
+  // at distance distance: the ray parameter of the hit in units of b, or
+  // the Euclidean distance to a.  Ties go to the line with the lowest ID.
+  unsigned int* ids;
+  int count;
+  int capacity;
+  double distance;
+} SpatialQuery;
+
+typedef struct SpatialQueryBatch {
+  SpatialQuery* queries;
+  int count;
+  int capacity;
+} SpatialQueryBatch;
+
+SpatialQueryBatch* SpatialQueryBatch_new();
+
+void SpatialQueryBatch_delete(SpatialQueryBatch* batch);
+
+// Empties the batch, keeping its memory for the next one.
+void SpatialQueryBatch_clear(SpatialQueryBatch* batch);
+
+// Each adds a query to the batch and returns its index in queries.
+int SpatialQueryBatch_addRange(SpatialQueryBatch* batch, Vec lo, Vec hi);
+int SpatialQueryBatch_addRay(SpatialQueryBatch* batch, Vec origin,
+                             Vec direction);
+int SpatialQueryBatch_addNearest(SpatialQueryBatch* batch, Vec point);
+
+// Answers every query in the batch from the lines in the numTrees trees and
+// the numLines lines.  The trees must have been sorted by QuadTree_addLines
+// (or the build in CollisionWorld) since their lines last moved, and not
+// searched by QuadTree_detectEvents since; QuadTree_boundLines is run on
+// them first.  With no trees this is a brute force scan.
+void SpatialQueryBatch_run(SpatialQueryBatch* batch, QuadTree** trees,
+                           int numTrees, Line** lines, int numLines);
+
+#endif  // SPATIALQUERY_H_
@@ -0,0 +1,115 @@
+#include "./fasttime.h"
+#include "./StatsPage.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Minimum time between two updates of the page, in seconds.
+#define STATSPAGE_INTERVAL 0.01
+
+struct StatsPage {
+  char* name;
+  StatsPageData* data;
+  fasttime_t start;
+  fasttime_t last;
+  uint64_t lastCollisions;
+  bool started;
+};
+
+StatsPage* StatsPage_open(const char* name) {
+  int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(name);
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(StatsPageData)) != 0) {
+    perror(name);
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  StatsPageData* data = mmap(NULL, sizeof(StatsPageData),
+                             PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(name);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  StatsPage* page = malloc(sizeof(StatsPage));
+  page->name = strdup(name);
+  page->data = data;
+  page->lastCollisions = 0;
+  page->started = false;
+
+  memset(data, 0, sizeof(StatsPageData));
+  data->magic = STATSPAGE_MAGIC;
+  data->version = STATSPAGE_VERSION;
+  return page;
+}
+
+void StatsPage_close(StatsPage* page) {
+  munmap(page->data, sizeof(StatsPageData));
+  shm_unlink(page->name);
+  free(page->name);
+  free(page);
+}
+
+static void publish(StatsPage* page, bool force, uint64_t frame,
+                    uint64_t numLineWallCollisions,
+                    uint64_t numLineLineCollisions,
+                    const Histogram* frameLatency) {
+  fasttime_t now = gettime();
+  if (!page->started) {
+    page->start = page->last = now;
+    page->started = true;
+  }
+  double interval = tdiff(page->last, now);
+  if (interval < STATSPAGE_INTERVAL && frame > 1 && !force) {
+    return;
+  }
+
+  uint64_t collisions = numLineWallCollisions + numLineLineCollisions;
+  StatsPageData* d = page->data;
+
+  d->seq++;
+  __sync_synchronize();
+  d->frame = frame;
+  d->numLineWallCollisions = numLineWallCollisions;
+  d->numLineLineCollisions = numLineLineCollisions;
+  d->elapsed = tdiff(page->start, now);
+  d->collisionsPerSecond = interval > 0
+      ? (collisions - page->lastCollisions) / interval : 0;
+  d->p50 = Histogram_percentile(frameLatency, 50) * 1e-6;
+  d->p90 = Histogram_percentile(frameLatency, 90) * 1e-6;
+  d->p99 = Histogram_percentile(frameLatency, 99) * 1e-6;
+  d->p999 = Histogram_percentile(frameLatency, 99.9) * 1e-6;
+  d->max = frameLatency->max * 1e-6;
+  __sync_synchronize();
+  d->seq++;
+
+  page->last = now;
+  page->lastCollisions = collisions;
+}
+
+void StatsPage_publish(StatsPage* page, uint64_t frame,
+                       uint64_t numLineWallCollisions,
+                       uint64_t numLineLineCollisions,
+                       const Histogram* frameLatency) {
+  publish(page, false, frame, numLineWallCollisions, numLineLineCollisions,
+          frameLatency);
+}
+
+void StatsPage_flush(StatsPage* page, uint64_t frame,
+                     uint64_t numLineWallCollisions,
+                     uint64_t numLineLineCollisions,
+                     const Histogram* frameLatency) {
+  publish(page, true, frame, numLineWallCollisions, numLineLineCollisions,
+          frameLatency);
+}
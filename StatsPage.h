@@ -0,0 +1,56 @@
+#ifndef STATSPAGE_H_
+#define STATSPAGE_H_
+
+#include <stdint.h>
+
+#include "./Histogram.h"
+
+// A page of live simulation statistics in POSIX shared memory (visible as
+// /dev/shm/<name> on Linux) that a monitoring process can poll while the
+// simulation runs.  Writes are guarded by a sequence lock: seq is odd while
+// an update is in progress, so a reader copies the page and retries if seq
+// was odd or changed during the copy.  The simulation never waits on readers.
+#define STATSPAGE_MAGIC 0x53535453  // "STSS"
+#define STATSPAGE_VERSION 1
+
+typedef struct StatsPageData {
+  uint32_t magic;
+  uint32_t version;
+  volatile uint64_t seq;
+  uint64_t frame;
+  uint64_t numLineWallCollisions;
+  uint64_t numLineLineCollisions;
+  double elapsed;              // seconds since the first frame
+  double collisionsPerSecond;  // over the last publish interval
+  // Frame latency percentiles in milliseconds.
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+  double max;
+} StatsPageData;
+
+typedef struct StatsPage StatsPage;
+
+// Creates (or truncates) the shared memory object name, which must start
+// with a slash.  Returns NULL on failure.
+StatsPage* StatsPage_open(const char* name);
+
+// Unmaps and unlinks the page.
+void StatsPage_close(StatsPage* page);
+
+// Publishes the current statistics.  Updates are rate limited internally,
+// so this can be called every frame.
+void StatsPage_publish(StatsPage* page, uint64_t frame,
+                       uint64_t numLineWallCollisions,
+                       uint64_t numLineLineCollisions,
+                       const Histogram* frameLatency);
+
+// Publishes the final statistics regardless of the rate limit.  Call it on
+// the last frame, which StatsPage_publish may skip.
+void StatsPage_flush(StatsPage* page, uint64_t frame,
+                     uint64_t numLineWallCollisions,
+                     uint64_t numLineLineCollisions,
+                     const Histogram* frameLatency);
+
+#endif  // STATSPAGE_H_
@@ -0,0 +1,551 @@
+#include "./TileWorld.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <cilk/cilk.h>
+
+#include "./fasttime.h"
+#include "./IntersectionEventList.h"
+#include "./Line.h"
+
+// The most tiles along either side of the domain.
+#define MAX_TILES_PER_SIDE (1 << 20)
+
+// An occupied tile, whose lines are members[first] to
+// members[first + numLines - 1].
+typedef struct {
+  int x, y;
+  unsigned int first;
+  unsigned int numLines;
+} Tile;
+
+// An event between the lines at indices l1 < l2, found in tile (x, y).  As
+// the lines are sorted by ID, the indices order events as the IDs do.
+typedef struct {
+  unsigned int l1, l2;
+  int x, y;
+  IntersectionType type;
+} TileEvent;
+
+struct TileWorld {
+  int cols, rows;          // size of the domain in tiles
+  double tileW, tileH;     // size of a tile in box units
+  double originX, originY; // where each tile starts in its own frame
+  double timeStep;
+  QuadTreeParams params;
+
+  // The lines, sorted by ID, and the tile each is relative to.
+  Line* lines;
+  int* tileX;
+  int* tileY;
+  unsigned int numLines;
+
+  // The tiles occupied this frame, in the order they were first reached,
+  // and an open-addressing table of their indices plus one, 0 if free.
+  Tile* tiles;
+  unsigned int numTiles, tileCapacity;
+  unsigned int* table;
+  unsigned int tableCapacity;
+
+  // The lines of every tile, and the copies of lines in tiles other than
+  // their home, with the index of each one's line and the tile it is in.
+  Line** members;
+  unsigned int memberCapacity;
+  Line* visitors;
+  unsigned int* origins;
+  unsigned int* visitorTile;
+  unsigned int numVisitors, visitorCapacity;
+
+  // The quadtree for tiles[k], made when it first holds too many lines for
+  // one leaf.
+  QuadTree** trees;
+  unsigned int treeCapacity;
+
+  // The events found in the tiles, and those kept, sorted.
+  IntersectionEventCollector collector;
+  TileEvent* events;
+  unsigned int eventCapacity;
+
+  unsigned int numFrames;
+  unsigned int numLineWallCollisions;
+  unsigned int numLineLineCollisions;
+  unsigned long sumTiles;
+  unsigned long sumVisitors;
+  Histogram frameLatency;
+};
+
+static int compare_ids(const void* a, const void* b) {
+  return compareLines((Line*) a, (Line*) b);
+}
+
+static int compare_events(const void* a, const void* b) {
+  const TileEvent* e1 = a;
+  const TileEvent* e2 = b;
+  if (e1->l1 != e2->l1) {
+    return e1->l1 < e2->l1 ? -1 : 1;
+  }
+  return e1->l2 < e2->l2 ? -1 : e1->l2 > e2->l2;
+}
+
+// Grows *array of *capacity elements of size bytes to hold at least n.
+static void reserve(void** array, unsigned int* capacity, unsigned int n,
+                    size_t size) {
+  if (n <= *capacity) {
+    return;
+  }
+  unsigned int grown = MAX(n, 2 * *capacity);
+  *array = realloc(*array, grown * size);
+  assert(*array != NULL);
+  *capacity = grown;
+}
+
+static inline int clamp(int v, int lo, int hi) {
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+// How many tiles of size `size` past the home tile coordinate v lies.
+static inline int tile_offset(double v, double size, double origin) {
+  double k = floor((v - origin) / size);
+  return k < INT_MIN / 2 ? INT_MIN / 2 : k > INT_MAX / 2 ? INT_MAX / 2 : k;
+}
+
+// Moves l by dx, dy, without its box.
+static inline void translate(Line* l, double dx, double dy) {
+  l->p1.x += dx;
+  l->p1.y += dy;
+  l->p2.x += dx;
+  l->p2.y += dy;
+}
+
+// Makes the tile in which the box of line i starts its home, or the
+// nearest tile in the domain, and brings its box up to date.
+static void rehome(TileWorld* tw, unsigned int i) {
+  Line* l = &tw->lines[i];
+  update_box(l, tw->timeStep);
+  // Translating far out can round, so check again after each move.
+  for (int tries = 0; tries < 2; tries++) {
+    int x = clamp(tw->tileX[i] + tile_offset(l->l_x, tw->tileW, tw->originX),
+                  0, tw->cols - 1);
+    int y = clamp(tw->tileY[i] + tile_offset(l->l_y, tw->tileH, tw->originY),
+                  0, tw->rows - 1);
+    if (x == tw->tileX[i] && y == tw->tileY[i]) {
+      return;
+    }
+    translate(l, (tw->tileX[i] - x) * tw->tileW,
+              (tw->tileY[i] - y) * tw->tileH);
+    tw->tileX[i] = x;
+    tw->tileY[i] = y;
+    update_box(l, tw->timeStep);
+  }
+}
+
+TileWorld* TileWorld_new(CollisionWorld* collisionWorld, int cols, int rows,
+                         int split, const QuadTreeParams* params) {
+  if (cols <= 0 || rows <= 0 || split < 0 ||
+      split > 20 || (long) cols << split > MAX_TILES_PER_SIDE ||
+      (long) rows << split > MAX_TILES_PER_SIDE) {
+    return NULL;
+  }
+  TileWorld* tw = malloc(sizeof(TileWorld));
+  if (tw == NULL) {
+    return NULL;
+  }
+  unsigned int n = CollisionWorld_getNumOfLines(collisionWorld);
+  tw->cols = cols << split;
+  tw->rows = rows << split;
+  tw->tileW = ((double) BOX_XMAX - BOX_XMIN) / (1 << split);
+  tw->tileH = ((double) BOX_YMAX - BOX_YMIN) / (1 << split);
+  // Centering the tile in the box keeps the coordinates of lines near it in
+  // [.5, 1), where moving them by whole tiles is exact, so lines compute the
+  // same in any tile's frame as in the box.
+  tw->originX = (BOX_XMIN + BOX_XMAX - tw->tileW) / 2;
+  tw->originY = (BOX_YMIN + BOX_YMAX - tw->tileH) / 2;
+  tw->timeStep = collisionWorld->timeStep;
+  tw->params = *params;
+
+  tw->lines = malloc(n * sizeof(Line));
+  tw->tileX = calloc(n, sizeof(int));
+  tw->tileY = calloc(n, sizeof(int));
+  assert(n == 0 || (tw->lines && tw->tileX && tw->tileY));
+  tw->numLines = n;
+  for (unsigned int i = 0; i < n; i++) {
+    tw->lines[i] = *CollisionWorld_getLine(collisionWorld, i);
+  }
+  qsort(tw->lines, n, sizeof(Line), compare_ids);
+  for (unsigned int i = 0; i < n; i++) {
+    Line* l = &tw->lines[i];
+    l->next = NULL;
+    update_box(l, tw->timeStep);
+    tw->tileX[i] = clamp(tile_offset(l->l_x, tw->tileW, BOX_XMIN), 0,
+                         tw->cols - 1);
+    tw->tileY[i] = clamp(tile_offset(l->l_y, tw->tileH, BOX_YMIN), 0,
+                         tw->rows - 1);
+    translate(l, tw->originX - BOX_XMIN - tw->tileX[i] * tw->tileW,
+              tw->originY - BOX_YMIN - tw->tileY[i] * tw->tileH);
+    rehome(tw, i);
+  }
+
+  tw->tiles = NULL;
+  tw->numTiles = tw->tileCapacity = 0;
+  tw->tableCapacity = 64;
+  tw->table = calloc(tw->tableCapacity, sizeof(unsigned int));
+  tw->members = NULL;
+  tw->memberCapacity = 0;
+  tw->visitors = NULL;
+  tw->origins = NULL;
+  tw->visitorTile = NULL;
+  tw->numVisitors = tw->visitorCapacity = 0;
+  tw->trees = NULL;
+  tw->treeCapacity = 0;
+  IntersectionEventCollector_init(&tw->collector);
+  tw->events = NULL;
+  tw->eventCapacity = 0;
+
+  tw->numFrames = 0;
+  tw->numLineWallCollisions = 0;
+  tw->numLineLineCollisions = 0;
+  tw->sumTiles = 0;
+  tw->sumVisitors = 0;
+  Histogram_init(&tw->frameLatency);
+  return tw;
+}
+
+void TileWorld_delete(TileWorld* tileWorld) {
+  for (unsigned int k = 0; k < tileWorld->treeCapacity; k++) {
+    if (tileWorld->trees[k]) {
+      QuadTree_delete(tileWorld->trees[k]);
+    }
+  }
+  free(tileWorld->trees);
+  free(tileWorld->lines);
+  free(tileWorld->tileX);
+  free(tileWorld->tileY);
+  free(tileWorld->tiles);
+  free(tileWorld->table);
+  free(tileWorld->members);
+  free(tileWorld->visitors);
+  free(tileWorld->origins);
+  free(tileWorld->visitorTile);
+  IntersectionEventCollector_destroy(&tileWorld->collector);
+  free(tileWorld->events);
+  free(tileWorld);
+}
+
+static inline unsigned int hash_tile(const TileWorld* tw, int x, int y) {
+  uint64_t key = (uint64_t) y * (uint64_t) tw->cols + (uint64_t) x;
+  return (key * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static void rehash(TileWorld* tw) {
+  free(tw->table);
+  tw->tableCapacity *= 2;
+  tw->table = calloc(tw->tableCapacity, sizeof(unsigned int));
+  assert(tw->table != NULL);
+  unsigned int mask = tw->tableCapacity - 1;
+  for (unsigned int k = 0; k < tw->numTiles; k++) {
+    unsigned int h = hash_tile(tw, tw->tiles[k].x, tw->tiles[k].y) & mask;
+    while (tw->table[h] != 0) {
+      h = (h + 1) & mask;
+    }
+    tw->table[h] = k + 1;
+  }
+}
+
+// The tile at x, y, occupied this frame if it was not yet.
+static Tile* occupy(TileWorld* tw, int x, int y) {
+  unsigned int mask = tw->tableCapacity - 1;
+  unsigned int h = hash_tile(tw, x, y) & mask;
+  for (; tw->table[h] != 0; h = (h + 1) & mask) {
+    Tile* tile = &tw->tiles[tw->table[h] - 1];
+    if (tile->x == x && tile->y == y) {
+      return tile;
+    }
+  }
+  reserve((void**) &tw->tiles, &tw->tileCapacity, tw->numTiles + 1,
+          sizeof(Tile));
+  Tile* tile = &tw->tiles[tw->numTiles++];
+  tile->x = x;
+  tile->y = y;
+  tile->first = 0;
+  tile->numLines = 0;
+  tw->table[h] = tw->numTiles;
+  if (2 * tw->numTiles > tw->tableCapacity) {
+    rehash(tw);
+  }
+  return tile;
+}
+
+// The range of tiles the box of line i reaches into.
+static inline void reach(const TileWorld* tw, unsigned int i, int* x0,
+                         int* x1, int* y0, int* y1) {
+  const Line* l = &tw->lines[i];
+  *x0 = clamp(tw->tileX[i] + tile_offset(l->l_x, tw->tileW, tw->originX), 0,
+              tw->cols - 1);
+  *x1 = clamp(tw->tileX[i] + tile_offset(l->u_x, tw->tileW, tw->originX), 0,
+              tw->cols - 1);
+  *y0 = clamp(tw->tileY[i] + tile_offset(l->l_y, tw->tileH, tw->originY), 0,
+              tw->rows - 1);
+  *y1 = clamp(tw->tileY[i] + tile_offset(l->u_y, tw->tileH, tw->originY), 0,
+              tw->rows - 1);
+}
+
+// Sets up the tiles the lines reach into, with their lines and copies.
+static void occupy_tiles(TileWorld* tw) {
+  memset(tw->table, 0, tw->tableCapacity * sizeof(unsigned int));
+  tw->numTiles = 0;
+  unsigned int numMembers = 0;
+  unsigned int numVisitors = 0;
+  for (unsigned int i = 0; i < tw->numLines; i++) {
+    int x0, x1, y0, y1;
+    reach(tw, i, &x0, &x1, &y0, &y1);
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        occupy(tw, x, y)->numLines++;
+      }
+    }
+    unsigned int covered = (x1 - x0 + 1) * (y1 - y0 + 1);
+    numMembers += covered;
+    numVisitors += covered - 1;
+  }
+
+  unsigned int first = 0;
+  for (unsigned int k = 0; k < tw->numTiles; k++) {
+    tw->tiles[k].first = first;
+    first += tw->tiles[k].numLines;
+    tw->tiles[k].numLines = 0;
+  }
+  reserve((void**) &tw->members, &tw->memberCapacity, numMembers,
+          sizeof(Line*));
+  if (numVisitors > tw->visitorCapacity) {
+    tw->visitorCapacity = MAX(numVisitors, 2 * tw->visitorCapacity);
+    tw->visitors = realloc(tw->visitors, tw->visitorCapacity * sizeof(Line));
+    tw->origins = realloc(tw->origins,
+                          tw->visitorCapacity * sizeof(unsigned int));
+    tw->visitorTile = realloc(tw->visitorTile,
+                              tw->visitorCapacity * sizeof(unsigned int));
+    assert(tw->visitors && tw->origins && tw->visitorTile);
+  }
+
+  tw->numVisitors = 0;
+  for (unsigned int i = 0; i < tw->numLines; i++) {
+    int x0, x1, y0, y1;
+    reach(tw, i, &x0, &x1, &y0, &y1);
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        Tile* tile = occupy(tw, x, y);
+        Line** slot = &tw->members[tile->first + tile->numLines++];
+        if (x == tw->tileX[i] && y == tw->tileY[i]) {
+          *slot = &tw->lines[i];
+          continue;
+        }
+        unsigned int v = tw->numVisitors++;
+        Line* copy = &tw->visitors[v];
+        *copy = tw->lines[i];
+        translate(copy, (tw->tileX[i] - x) * tw->tileW,
+                  (tw->tileY[i] - y) * tw->tileH);
+        update_box(copy, tw->timeStep);
+        tw->origins[v] = i;
+        tw->visitorTile[v] = tile - tw->tiles;
+        *slot = copy;
+      }
+    }
+  }
+  tw->sumTiles += tw->numTiles;
+  tw->sumVisitors += tw->numVisitors;
+}
+
+// Finds the events among the lines of tiles[k].
+static void detect_tile(TileWorld* tw, unsigned int k,
+                        IntersectionEventCollector* iel) {
+  const Tile* tile = &tw->tiles[k];
+  Line** lines = &tw->members[tile->first];
+  int n = tile->numLines;
+  double t = tw->timeStep;
+  if (n <= tw->params.maxLines) {
+    for (int i = 0; i < n; i++) {
+      for (int j = i + 1; j < n; j++) {
+        Line* l1 = lines[i];
+        Line* l2 = lines[j];
+        if (compareLines(l1, l2) > 0) {
+          l1 = lines[j];
+          l2 = lines[i];
+        }
+        IntersectionType type = intersect(l1, l2, t);
+        if (type != NO_INTERSECTION) {
+          IntersectionEventList_appendNode(IntersectionEventCollector_view(iel),
+                                           l1, l2, type);
+        }
+      }
+    }
+    return;
+  }
+  if (tw->trees[k] == NULL) {
+    tw->trees[k] = QuadTree_make(tw->originX, tw->originX + tw->tileW,
+                                 tw->originY, tw->originY + tw->tileH,
+                                 &tw->params);
+    QuadTree_build(tw->trees[k], tw->params.maxDepth);
+  }
+  QuadTree_sortLines(tw->trees[k], lines, n, t);
+  QuadTree_detectEvents(tw->trees[k], NULL, t, iel);
+}
+
+// The index of the line that l, a line or a copy of one, stands for.
+static inline unsigned int origin_of(const TileWorld* tw, const Line* l) {
+  if (l >= tw->visitors && l < tw->visitors + tw->numVisitors) {
+    return tw->origins[l - tw->visitors];
+  }
+  return l - tw->lines;
+}
+
+// Whether line i's box starts further right than line j's, or as far.
+static inline bool starts_right_of(const TileWorld* tw, unsigned int i,
+                                   unsigned int j) {
+  return tw->tileX[i] != tw->tileX[j] ? tw->tileX[i] > tw->tileX[j] :
+      tw->lines[i].l_x >= tw->lines[j].l_x;
+}
+
+static inline bool starts_above(const TileWorld* tw, unsigned int i,
+                                unsigned int j) {
+  return tw->tileY[i] != tw->tileY[j] ? tw->tileY[i] > tw->tileY[j] :
+      tw->lines[i].l_y >= tw->lines[j].l_y;
+}
+
+// Finds the events of the frame, each once, sorted by line ID.
+static unsigned int detect_events(TileWorld* tw) {
+  unsigned int numTiles = tw->numTiles;
+  unsigned int capacity = tw->treeCapacity;
+  reserve((void**) &tw->trees, &tw->treeCapacity, numTiles, sizeof(QuadTree*));
+  for (unsigned int k = capacity; k < tw->treeCapacity; k++) {
+    tw->trees[k] = NULL;
+  }
+
+  cilk_for (unsigned int k = 0; k < numTiles; k++) {
+    detect_tile(tw, k, &tw->collector);
+  }
+  IntersectionEventList iel = IntersectionEventCollector_take(&tw->collector);
+
+  // Keep each pair only in the tile that holds the lower left corner of
+  // where the boxes overlap.  The corner is found from where the boxes
+  // start in their home tiles, so every tile agrees on it.
+  reserve((void**) &tw->events, &tw->eventCapacity, iel.count,
+          sizeof(TileEvent));
+  unsigned int numEvents = 0;
+  for (IntersectionEventNode* node = iel.head; node; node = node->next) {
+    unsigned int l1 = origin_of(tw, node->l1);
+    unsigned int l2 = origin_of(tw, node->l2);
+    int x = tw->tileX[starts_right_of(tw, l1, l2) ? l1 : l2];
+    int y = tw->tileY[starts_above(tw, l1, l2) ? l1 : l2];
+    const Line* copy = node->l1 != &tw->lines[l1] ? node->l1 :
+        node->l2 != &tw->lines[l2] ? node->l2 : NULL;
+    if (copy) {
+      const Tile* tile = &tw->tiles[tw->visitorTile[copy - tw->visitors]];
+      if (tile->x != x || tile->y != y) {
+        continue;
+      }
+    }
+    TileEvent e = {l1, l2, x, y, node->intersectionType};
+    tw->events[numEvents++] = e;
+  }
+  IntersectionEventList_deleteNodes(&iel);
+  qsort(tw->events, numEvents, sizeof(TileEvent), compare_events);
+  return numEvents;
+}
+
+// A copy of line i in the frame of tile (x, y).
+static inline Line copy_in(const TileWorld* tw, unsigned int i, int x, int y) {
+  Line copy = tw->lines[i];
+  translate(&copy, (tw->tileX[i] - x) * tw->tileW,
+            (tw->tileY[i] - y) * tw->tileH);
+  return copy;
+}
+
+void TileWorld_update(TileWorld* tileWorld) {
+  TileWorld* tw = tileWorld;
+  occupy_tiles(tw);
+  unsigned int numEvents = detect_events(tw);
+  tw->numLineLineCollisions += numEvents;
+
+  // The solver keeps no state in the CollisionWorld, and sees each pair
+  // where it was found.
+  for (unsigned int k = 0; k < numEvents; k++) {
+    const TileEvent* e = &tw->events[k];
+    Line l1 = copy_in(tw, e->l1, e->x, e->y);
+    Line l2 = copy_in(tw, e->l2, e->x, e->y);
+    CollisionWorld_collisionSolver(NULL, &l1, &l2, e->type);
+    tw->lines[e->l1].velocity = l1.velocity;
+    tw->lines[e->l2].velocity = l2.velocity;
+  }
+
+  for (unsigned int i = 0; i < tw->numLines; i++) {
+    Line* l = &tw->lines[i];
+    step_line(l, tw->timeStep);
+    // The walls of the domain, in the frame of the line's tile.
+    double xmin = tw->originX - tw->tileX[i] * tw->tileW;
+    double ymin = tw->originY - tw->tileY[i] * tw->tileH;
+    if (bounce_off_bounds(l, xmin, xmin + tw->cols * tw->tileW, ymin,
+                          ymin + tw->rows * tw->tileH)) {
+      tw->numLineWallCollisions++;
+    }
+    rehome(tw, i);
+  }
+  tw->numFrames++;
+}
+
+void TileWorld_run(TileWorld* tileWorld, unsigned int numFrames) {
+  for (unsigned int frame = 0; frame < numFrames; frame++) {
+    fasttime_t start = gettime();
+    TileWorld_update(tileWorld);
+    Histogram_record(&tileWorld->frameLatency,
+                     (uint64_t) (tdiff(start, gettime()) * 1e9));
+  }
+}
+
+void TileWorld_copyLines(TileWorld* tileWorld, CollisionWorld* collisionWorld) {
+  for (unsigned int i = 0; i < tileWorld->numLines; i++) {
+    Line* from = &tileWorld->lines[i];
+    Line* to = CollisionWorld_getLineById(collisionWorld, from->id);
+    double dx = BOX_XMIN - tileWorld->originX +
+        tileWorld->tileX[i] * tileWorld->tileW;
+    double dy = BOX_YMIN - tileWorld->originY +
+        tileWorld->tileY[i] * tileWorld->tileH;
+    to->p1.x = from->p1.x + dx;
+    to->p1.y = from->p1.y + dy;
+    to->p2.x = from->p2.x + dx;
+    to->p2.y = from->p2.y + dy;
+    to->velocity = from->velocity;
+  }
+}
+
+unsigned int TileWorld_getNumLineWallCollisions(TileWorld* tileWorld) {
+  return tileWorld->numLineWallCollisions;
+}
+
+unsigned int TileWorld_getNumLineLineCollisions(TileWorld* tileWorld) {
+  return tileWorld->numLineLineCollisions;
+}
+
+double TileWorld_getTileWidth(TileWorld* tileWorld) {
+  return tileWorld->tileW / ((double) BOX_XMAX - BOX_XMIN) * WINDOW_WIDTH;
+}
+
+double TileWorld_getTileHeight(TileWorld* tileWorld) {
+  return tileWorld->tileH / ((double) BOX_YMAX - BOX_YMIN) * WINDOW_HEIGHT;
+}
+
+double TileWorld_getMeanTiles(TileWorld* tileWorld) {
+  return tileWorld->numFrames > 0 ?
+      (double) tileWorld->sumTiles / tileWorld->numFrames : 0;
+}
+
+double TileWorld_getMeanBorderCopies(TileWorld* tileWorld) {
+  return tileWorld->numFrames > 0 ?
+      (double) tileWorld->sumVisitors / tileWorld->numFrames : 0;
+}
+
+const Histogram* TileWorld_getFrameLatency(TileWorld* tileWorld) {
+  return &tileWorld->frameLatency;
+}
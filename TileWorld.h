@@ -0,0 +1,71 @@
+#ifndef TILEWORLD_H_
+#define TILEWORLD_H_
+
+// The simulation over a domain of many windows, most of it empty.
+//
+// The domain is cols x rows windows, each cut into 2^split x 2^split tiles.
+// Every line keeps its coordinates relative to its home tile, the one in
+// which its box starts.  Every tile has the same place in the middle of the
+// box in its own frame, so the lines keep the precision they have in the
+// box however far out they are.  Each frame the tiles that
+// boxes reach into are looked up in a hash table, and only those are set
+// up: the cost grows with the number of lines and not with the area.
+//
+// A line whose box reaches across the right or top border of its home tile
+// is copied into the frame of every other tile it reaches into.  Each tile
+// tests its own lines and those copies against each other, in a quadtree of
+// its own if it holds enough lines, and keeps only the pairs whose boxes
+// overlap in a corner inside it, so a pair that spans tiles is counted by
+// exactly one of them.  The events are then solved in line ID order in the
+// frame of the tile that found them.  With one tile the domain is the box,
+// and the counts and positions are those of a single CollisionWorld.
+//
+// The walls are the borders of the domain.  Static lines and adaptive
+// stepping are not used; every line is stepped and checked against the
+// walls every frame.
+
+#include <stdbool.h>
+
+#include "./CollisionWorld.h"
+#include "./Histogram.h"
+#include "./Quadtree.h"
+
+typedef struct TileWorld TileWorld;
+
+// Moves the lines of collisionWorld, which must not have run a frame yet,
+// into a domain of cols x rows windows from the box's lower left corner,
+// each cut into 2^split x 2^split tiles.  Lines that start outside the
+// domain go to the nearest tile and bounce back in.  Returns NULL if the
+// domain is empty or has too many tiles.
+TileWorld* TileWorld_new(CollisionWorld* collisionWorld, int cols, int rows,
+                         int split, const QuadTreeParams* params);
+
+void TileWorld_delete(TileWorld* tileWorld);
+
+// Runs one frame.
+void TileWorld_update(TileWorld* tileWorld);
+
+// Runs numFrames frames, recording how long each takes.
+void TileWorld_run(TileWorld* tileWorld, unsigned int numFrames);
+
+// Copies the positions, in box coordinates from the first tile, and
+// velocities of the lines back into collisionWorld, the one the TileWorld
+// was made from.
+void TileWorld_copyLines(TileWorld* tileWorld, CollisionWorld* collisionWorld);
+
+unsigned int TileWorld_getNumLineWallCollisions(TileWorld* tileWorld);
+
+unsigned int TileWorld_getNumLineLineCollisions(TileWorld* tileWorld);
+
+// Get the size of a tile in window pixels.
+double TileWorld_getTileWidth(TileWorld* tileWorld);
+double TileWorld_getTileHeight(TileWorld* tileWorld);
+
+// Get the mean number of occupied tiles, and of lines copied into tiles
+// other than their home, per frame.
+double TileWorld_getMeanTiles(TileWorld* tileWorld);
+double TileWorld_getMeanBorderCopies(TileWorld* tileWorld);
+
+const Histogram* TileWorld_getFrameLatency(TileWorld* tileWorld);
+
+#endif  // TILEWORLD_H_
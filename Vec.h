@@ -26,7 +26,15 @@
 
 #include <stdbool.h>
 
+// Coordinates, velocities and the geometry computed from them are doubles,
+// or floats in builds with -DVEC_FLOAT (make float), which halves the size
+// of the line data.  bench.py --validate measures how far the float build
+// drifts from the double one.
+#ifdef VEC_FLOAT
+typedef float vec_dimension;
+#else
 typedef double vec_dimension;
+#endif
 
 // Forward definition of Line to avoid needing to circularly include Line.h
 struct Line;
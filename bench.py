@@ -0,0 +1,537 @@
+#!/usr/bin/env python3
+"""Benchmark Screensaver over line.in and betainputs/ and verify its results.
+
+Every scene in the golden table (bench_golden.txt) is run at each requested
+worker count, several times, and the line-wall and line-line collision
+counts are checked against the table.  Timings are summarised as a mean
+with a 95% confidence interval and written as CSV and/or JSON.  Given the
+JSON of an earlier run (--baseline), each timing is flagged as a regression
+when it is slower by more than --threshold and the confidence intervals do
+not overlap.
+
+Exits with status 1 if any count mismatched, any run failed, or any
+regression was flagged.
+
+With --batch all scenes run together in one Screensaver -b process per
+repetition, sharing its workers; each scene is still verified on its own,
+and the total throughput of the batch is reported in frames per second.
+
+With --validate CANDIDATE every scene is run once by --binary and once by
+CANDIDATE (e.g. ./Screensaver.float from "make float"), and the difference
+in collision counts and the largest and RMS distance between the final line
+positions of the two runs, in pixels, are reported, with the time of each
+run and the candidate's speedup.
+
+With --continuous K the candidate is instead --binary -e K, which steps from
+contact to contact K frames at a time, so the same report gives its accuracy
+and speed against fixed stepping.
+
+Options after -- go to every Screensaver run.  With -- -v K each run also
+checks every Kth frame against a brute-force reference detector and fails
+at the first divergence, which it describes on stderr; -- -v 1 checks
+every frame and is slow on large scenes.
+
+With --weak P the scenes are replaced by synthetic ones from SceneGen with
+--weak-lines lines per process, run with -P 1, 2, ..., P slab processes of
+--workers Cilk workers each.  Each row gets its weak-scaling efficiency, the
+time at one process over its own, and its scaled speedup, P times that.
+
+With --sweep P every scene is run at 1, 2, ..., P workers instead, and each
+row also gets its speedup over one worker and its parallel efficiency
+(speedup / workers), which gives the scaling curve of the scene.
+
+Examples:
+  ./bench.py                                # all scenes, default frames
+  ./bench.py --workers 1,2,4,8 --repeat 5 --json new.json
+  ./bench.py --baseline old.json --json new.json --csv new.csv
+  ./bench.py --scenes line.in --frames 4000
+  ./bench.py --scenes betainputs/koch.in --sweep 8 --csv scaling.csv
+  ./bench.py --batch --workers 8 --repeat 5
+  ./bench.py --validate ./Screensaver.float --json drift.json
+  ./bench.py --continuous 16 --scenes line.in,betainputs/koch-betainput.in
+  ./bench.py --repeat 1 -- -m -v 1          # check adaptive stepping
+  ./bench.py --repeat 1 -- -P 4             # check four slab processes
+  ./bench.py --repeat 1 -- -T 1,1           # check the tiled world
+  ./bench.py --weak 8 --workers 1 --frames 200 --csv weak.csv
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+GOLDEN = "bench_golden.txt"
+
+# Two-sided 95% Student t quantiles by degrees of freedom.
+T95 = [0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+       2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+       2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+       2.042]
+
+RESULT_RE = {
+    "elapsed": re.compile(r"^Elapsed execution time: ([0-9.]+)s$", re.M),
+    "wall": re.compile(r"^(\d+) Line-Wall Collisions$", re.M),
+    "line": re.compile(r"^(\d+) Line-Line Collisions$", re.M),
+}
+BATCH_RE = re.compile(r"^Batch: .* ([0-9.]+) frames/s$", re.M)
+
+
+def load_golden(path):
+    """Returns (ordered scene list, {(scene, frames): (wall, line)}, skips)."""
+    scenes, counts, skips = [], {}, {}
+    with open(path) as f:
+        for raw in f:
+            line = raw.split("#", 1)[0].split()
+            if not line:
+                continue
+            scene = line[0]
+            if line[1] == "skip":
+                skips[scene] = " ".join(line[2:])
+                scenes.append(scene)
+                continue
+            frames, wall, coll = (int(x) for x in line[1:4])
+            if scene not in scenes:
+                scenes.append(scene)
+                counts[(scene, None)] = frames
+            counts[(scene, frames)] = (wall, coll)
+    return scenes, counts, skips
+
+
+def mean_ci(samples):
+    n = len(samples)
+    mean = sum(samples) / n
+    if n < 2:
+        return mean, 0.0, 0.0
+    var = sum((x - mean) ** 2 for x in samples) / (n - 1)
+    sd = math.sqrt(var)
+    t = T95[n - 1] if n - 1 < len(T95) else 1.960
+    return mean, sd, t * sd / math.sqrt(n)
+
+
+def parse_results(text):
+    result = {}
+    for key, regex in RESULT_RE.items():
+        m = regex.search(text)
+        if not m:
+            return None, "missing %s in output" % key
+        result[key] = float(m.group(1)) if key == "elapsed" else int(m.group(1))
+    return result, None
+
+
+def run_screensaver(binary, args, workers, timeout):
+    """Returns (stdout, None) or (None, error)."""
+    env = dict(os.environ)
+    env["CILK_NWORKERS"] = str(workers)
+    try:
+        out = subprocess.run([binary] + args, env=env, stdout=subprocess.PIPE,
+                             stderr=subprocess.STDOUT, timeout=timeout,
+                             universal_newlines=True)
+    except subprocess.TimeoutExpired:
+        return None, "timeout"
+    if out.returncode != 0:
+        return None, "exit status %d" % out.returncode
+    return out.stdout, None
+
+
+def run_once(binary, scene, frames, workers, extra_args, timeout):
+    text, err = run_screensaver(binary, extra_args + [str(frames), scene],
+                                workers, timeout)
+    if err:
+        return None, err
+    return parse_results(text)
+
+
+def run_batch(binary, jobs, workers, extra_args, timeout):
+    """Runs [(scene, frames)] as one batch.
+
+    Returns ({scene: result or error string}, frames per second, None), or
+    (None, None, error) if the whole batch failed.
+    """
+    with tempfile.NamedTemporaryFile("w", suffix=".batch") as f:
+        for scene, frames in jobs:
+            f.write("%d %s\n" % (frames, scene))
+        f.flush()
+        text, err = run_screensaver(binary, extra_args + ["-b", f.name],
+                                    workers, timeout)
+    if err:
+        return None, None, err
+    m = BATCH_RE.search(text)
+    if not m:
+        return None, None, "missing batch throughput in output"
+    results = {}
+    for block in text.split("Input file path is: ")[1:]:
+        scene = block.split("\n", 1)[0]
+        result, err = parse_results(block)
+        results[scene] = err or result
+    return results, float(m.group(1)), None
+
+
+def git_commit():
+    try:
+        return subprocess.check_output(
+            ["git", "rev-parse", "--short", "HEAD"], stderr=subprocess.DEVNULL,
+            universal_newlines=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def run_suite(args, scenes, counts, skips):
+    rows = []
+    for scene in scenes:
+        if scene in skips:
+            print("%-40s skipped: %s" % (scene, skips[scene]))
+            continue
+        frames = args.frames or counts[(scene, None)]
+        golden = counts.get((scene, frames))
+        for workers in args.workers:
+            samples, status = [], "ok"
+            wall = coll = None
+            for _ in range(args.repeat):
+                result, err = run_once(args.binary, scene, frames, workers,
+                                       args.args, args.timeout)
+                if err:
+                    status = "failed: " + err
+                    break
+                samples.append(result["elapsed"])
+                if wall is not None and (wall, coll) != (result["wall"],
+                                                         result["line"]):
+                    status = "nondeterministic"
+                wall, coll = result["wall"], result["line"]
+            if status == "ok" and golden is not None and golden != (wall, coll):
+                status = "mismatch: expected %d/%d" % golden
+            mean, sd, ci = mean_ci(samples) if samples else (0.0, 0.0, 0.0)
+            row = {
+                "scene": scene, "frames": frames, "workers": workers,
+                "repeat": len(samples), "mean": mean, "stdev": sd, "ci95": ci,
+                "line_wall": wall, "line_line": coll,
+                "verified": golden is not None and status == "ok",
+                "status": status, "regression": False, "baseline_mean": None,
+                "speedup": None, "efficiency": None,
+            }
+            rows.append(row)
+            print("%-40s %5d frames %3d workers  %9.4fs +- %.4fs  %6s %7s  %s"
+                  % (scene, frames, workers, mean, ci, wall, coll,
+                     status if golden is not None or status != "ok"
+                     else "ok (no golden)"))
+            sys.stdout.flush()
+    return rows
+
+
+def run_batch_suite(args, scenes, counts, skips):
+    jobs = []
+    for scene in scenes:
+        if scene in skips:
+            print("%-40s skipped: %s" % (scene, skips[scene]))
+            continue
+        jobs.append((scene, args.frames or counts[(scene, None)]))
+    rows = []
+    for workers in args.workers:
+        samples = {scene: [] for scene, _ in jobs}
+        status = {scene: "ok" for scene, _ in jobs}
+        seen = {}
+        throughput = []
+        for _ in range(args.repeat):
+            results, fps, err = run_batch(args.binary, jobs, workers,
+                                          args.args, args.timeout)
+            if err:
+                for scene, _ in jobs:
+                    status[scene] = "failed: " + err
+                break
+            throughput.append(fps)
+            for scene, _ in jobs:
+                result = results.get(scene, "missing from batch output")
+                if isinstance(result, str):
+                    status[scene] = "failed: " + result
+                    continue
+                samples[scene].append(result["elapsed"])
+                counts_now = (result["wall"], result["line"])
+                if seen.setdefault(scene, counts_now) != counts_now:
+                    status[scene] = "nondeterministic"
+        for scene, frames in jobs:
+            golden = counts.get((scene, frames))
+            wall, coll = seen.get(scene, (None, None))
+            if status[scene] == "ok" and golden is not None and \
+                    golden != (wall, coll):
+                status[scene] = "mismatch: expected %d/%d" % golden
+            mean, sd, ci = (mean_ci(samples[scene]) if samples[scene]
+                            else (0.0, 0.0, 0.0))
+            rows.append({
+                "scene": scene, "frames": frames, "workers": workers,
+                "repeat": len(samples[scene]), "mean": mean, "stdev": sd,
+                "ci95": ci, "line_wall": wall, "line_line": coll,
+                "verified": golden is not None and status[scene] == "ok",
+                "status": status[scene], "regression": False,
+                "baseline_mean": None, "speedup": None, "efficiency": None,
+            })
+            print("%-40s %5d frames %3d workers  %9.4fs +- %.4fs  %6s %7s  %s"
+                  % (scene, frames, workers, mean, ci, wall, coll,
+                     status[scene] if golden is not None
+                     or status[scene] != "ok" else "ok (no golden)"))
+        if throughput:
+            mean, _, ci = mean_ci(throughput)
+            print("Batch throughput, %d workers: %.1f +- %.1f frames/s"
+                  % (workers, mean, ci))
+        sys.stdout.flush()
+    return rows
+
+
+def read_positions(path):
+    with open(path) as f:
+        return [[float(x) for x in line.split()[1:]] for line in f]
+
+
+def position_drift(reference, candidate):
+    """Returns the largest and RMS endpoint distance between two runs."""
+    worst, total, n = 0.0, 0.0, 0
+    for a, b in zip(reference, candidate):
+        for i in (0, 2):
+            d2 = (a[i] - b[i]) ** 2 + (a[i + 1] - b[i + 1]) ** 2
+            worst = max(worst, d2)
+            total += d2
+            n += 1
+    return math.sqrt(worst), math.sqrt(total / n) if n else 0.0
+
+
+def validate(args, scenes, counts, skips, candidate, candidate_args):
+    rows = []
+    with tempfile.TemporaryDirectory() as tmp:
+        for scene in scenes:
+            if scene in skips:
+                print("%-40s skipped: %s" % (scene, skips[scene]))
+                continue
+            frames = args.frames or counts[(scene, None)]
+            runs = []
+            for i, (binary, extra) in enumerate(
+                    ((args.binary, []), (candidate, candidate_args))):
+                path = os.path.join(tmp, "positions%d" % i)
+                text, err = run_screensaver(
+                    binary,
+                    args.args + extra + ["-p", path, str(frames), scene],
+                    args.workers[0], args.timeout)
+                result = None
+                if not err:
+                    result, err = parse_results(text)
+                if err:
+                    break
+                runs.append((result, read_positions(path)))
+            row = {"scene": scene, "frames": frames,
+                   "status": "failed: " + err if err else "ok"}
+            if not err:
+                (ref, ref_pos), (cand, cand_pos) = runs
+                worst, rms = position_drift(ref_pos, cand_pos)
+                row.update({
+                    "line_wall": ref["wall"], "line_line": ref["line"],
+                    "candidate_line_wall": cand["wall"],
+                    "candidate_line_line": cand["line"],
+                    "max_drift": worst, "rms_drift": rms,
+                    "elapsed": ref["elapsed"],
+                    "candidate_elapsed": cand["elapsed"],
+                    "speedup": ref["elapsed"] / cand["elapsed"]
+                               if cand["elapsed"] > 0 else None,
+                })
+                print("%-40s %5d frames  wall %6d %+6d  line %7d %+7d  "
+                      "drift max %.3g rms %.3g px  %.3fs %.3fs x%.2f"
+                      % (scene, frames, ref["wall"], cand["wall"] - ref["wall"],
+                         ref["line"], cand["line"] - ref["line"], worst, rms,
+                         ref["elapsed"], cand["elapsed"],
+                         row["speedup"] or float("inf")))
+            else:
+                print("%-40s %s" % (scene, row["status"]))
+            sys.stdout.flush()
+            rows.append(row)
+    return rows
+
+
+def weak_scaling(args):
+    """Runs SceneGen scenes growing with the number of slab processes."""
+    rows = []
+    frames = args.frames or 100
+    workers = args.workers[0]
+    base = None
+    with tempfile.TemporaryDirectory() as tmp:
+        for procs in range(1, args.weak + 1):
+            lines = args.weak_lines * procs
+            scene = os.path.join(tmp, "weak%d.in" % procs)
+            name = "SceneGen -n %d" % lines
+            samples, status = [], "ok"
+            wall = coll = None
+            gen = subprocess.run([args.scenegen, "-n", str(lines), scene],
+                                 stdout=subprocess.DEVNULL,
+                                 stderr=subprocess.DEVNULL)
+            if gen.returncode != 0:
+                status = "failed: %s exit status %d" % (args.scenegen,
+                                                        gen.returncode)
+            for _ in range(args.repeat if status == "ok" else 0):
+                result, err = run_once(args.binary, scene, frames, workers,
+                                       args.args + ["-P", str(procs)],
+                                       args.timeout)
+                if err:
+                    status = "failed: " + err
+                    break
+                samples.append(result["elapsed"])
+                wall, coll = result["wall"], result["line"]
+            mean, sd, ci = mean_ci(samples) if samples else (0.0, 0.0, 0.0)
+            if procs == 1 and mean > 0:
+                base = mean
+            efficiency = base / mean if base and mean > 0 else None
+            row = {
+                "scene": name, "frames": frames, "workers": workers,
+                "processes": procs, "repeat": len(samples), "mean": mean,
+                "stdev": sd, "ci95": ci, "line_wall": wall, "line_line": coll,
+                "verified": False, "status": status, "regression": False,
+                "baseline_mean": None,
+                "speedup": procs * efficiency if efficiency else None,
+                "efficiency": efficiency,
+            }
+            rows.append(row)
+            print("%-22s %5d frames %3d processes  %9.4fs +- %.4fs  %6s %7s"
+                  "  %s  %s"
+                  % (name, frames, procs, mean, ci, wall, coll,
+                     "efficiency %5.1f%%" % (100 * efficiency)
+                     if efficiency else "", status))
+            sys.stdout.flush()
+    return rows
+
+
+def add_scaling(rows):
+    """Fills in speedup and efficiency relative to the 1-worker row."""
+    serial = {(r["scene"], r["frames"]): r["mean"] for r in rows
+              if r["workers"] == 1 and r["repeat"] and r["mean"] > 0}
+    print("\nScaling (speedup over 1 worker, efficiency):")
+    for row in rows:
+        base = serial.get((row["scene"], row["frames"]))
+        if base is None or not row["repeat"] or row["mean"] <= 0:
+            continue
+        row["speedup"] = base / row["mean"]
+        row["efficiency"] = row["speedup"] / row["workers"]
+        print("%-40s %3d workers  %6.2fx  %5.1f%%"
+              % (row["scene"], row["workers"], row["speedup"],
+                 100 * row["efficiency"]))
+
+
+def flag_regressions(rows, baseline_path, threshold):
+    with open(baseline_path) as f:
+        baseline = json.load(f)
+    old = {(r["scene"], r["frames"], r["workers"]): r
+           for r in baseline["results"]}
+    for row in rows:
+        prev = old.get((row["scene"], row["frames"], row["workers"]))
+        if prev is None or row["repeat"] == 0:
+            continue
+        row["baseline_mean"] = prev["mean"]
+        slower = row["mean"] > prev["mean"] * (1 + threshold)
+        separated = row["mean"] - row["ci95"] > prev["mean"] + prev["ci95"]
+        row["regression"] = slower and separated
+        if row["regression"]:
+            print("REGRESSION %s (%d workers): %.4fs -> %.4fs"
+                  % (row["scene"], row["workers"], prev["mean"], row["mean"]))
+    return baseline.get("commit")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("--binary", default="./Screensaver")
+    parser.add_argument("--golden", default=GOLDEN)
+    parser.add_argument("--scenes", help="comma-separated subset of scenes")
+    parser.add_argument("--frames", type=int,
+                        help="frames per run (default: per scene from golden)")
+    parser.add_argument("--workers", default="0",
+                        help="comma-separated CILK_NWORKERS values; "
+                             "0 means all cores (default)")
+    parser.add_argument("--sweep", type=int, metavar="P",
+                        help="run at 1..P workers and report speedup and "
+                             "efficiency (overrides --workers)")
+    parser.add_argument("--weak", type=int, metavar="P",
+                        help="weak scaling over 1..P slab processes on "
+                             "SceneGen scenes (replaces the scenes)")
+    parser.add_argument("--weak-lines", type=int, default=20000,
+                        help="lines per process for --weak (default 20000)")
+    parser.add_argument("--scenegen", default="./SceneGen")
+    parser.add_argument("--batch", action="store_true",
+                        help="run all scenes together in one batch process")
+    parser.add_argument("--validate", metavar="CANDIDATE",
+                        help="compare counts and final positions of this "
+                             "binary against --binary")
+    parser.add_argument("--continuous", type=int, metavar="K",
+                        help="compare counts, final positions and time of "
+                             "--binary -e K against fixed stepping")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--timeout", type=float, default=600)
+    parser.add_argument("--csv", help="write results as CSV to this file")
+    parser.add_argument("--json", help="write results as JSON to this file")
+    parser.add_argument("--baseline", help="JSON of an earlier run to compare")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown counted as regression")
+    parser.add_argument("args", nargs="*",
+                        help="extra Screensaver options (after --)")
+    args = parser.parse_args()
+    args.workers = [int(w) for w in args.workers.split(",")]
+    args.workers = [w or os.cpu_count() for w in args.workers]
+    if args.sweep:
+        args.workers = list(range(1, args.sweep + 1))
+
+    scenes, counts, skips = load_golden(args.golden)
+    if args.scenes:
+        wanted = args.scenes.split(",")
+        for scene in wanted:
+            if scene not in scenes:
+                scenes.append(scene)
+                counts[(scene, None)] = args.frames or 1000
+        scenes = [s for s in scenes if s in wanted]
+
+    if args.validate or args.continuous:
+        if args.continuous:
+            candidate = args.binary
+            candidate_args = ["-e", str(args.continuous)]
+        else:
+            candidate, candidate_args = args.validate, []
+        rows = validate(args, scenes, counts, skips, candidate, candidate_args)
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump({"commit": git_commit(), "binary": args.binary,
+                           "candidate": " ".join([candidate] + candidate_args),
+                           "results": rows}, f, indent=2)
+        sys.exit(1 if any(r["status"] != "ok" for r in rows) else 0)
+    if args.weak:
+        rows = weak_scaling(args)
+    elif args.batch:
+        rows = run_batch_suite(args, scenes, counts, skips)
+    else:
+        rows = run_suite(args, scenes, counts, skips)
+    if args.sweep:
+        add_scaling(rows)
+    baseline_commit = None
+    if args.baseline:
+        baseline_commit = flag_regressions(rows, args.baseline, args.threshold)
+
+    if args.csv:
+        fields = ["scene", "frames", "workers", "repeat", "mean", "stdev",
+                  "ci95", "line_wall", "line_line", "verified", "status",
+                  "baseline_mean", "regression", "speedup", "efficiency"]
+        with open(args.csv, "w") as f:
+            writer = csv.DictWriter(f, fieldnames=fields)
+            writer.writeheader()
+            for row in rows:
+                writer.writerow({k: row[k] for k in fields})
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"commit": git_commit(), "baseline": baseline_commit,
+                       "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+                       "binary": args.binary, "results": rows}, f, indent=2)
+
+    failed = [r for r in rows if r["status"] != "ok"]
+    regressed = [r for r in rows if r["regression"]]
+    print("%d runs, %d failed or mismatched, %d regressions"
+          % (len(rows), len(failed), len(regressed)))
+    sys.exit(1 if failed or regressed else 0)
+
+
+if __name__ == "__main__":
+    main()
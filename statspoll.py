@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""Poll the live statistics page published by "Screensaver -s /name".
+
+Usage: statspoll.py /name [interval_seconds]
+"""
+
+import mmap
+import os
+import struct
+import sys
+import time
+
+# Mirrors StatsPageData in StatsPage.h.
+LAYOUT = struct.Struct("=IIQQQQddddddd")
+MAGIC = 0x53535453
+VERSION = 1
+
+
+def read_page(mm):
+    """Returns a consistent snapshot of the page using its sequence lock."""
+    while True:
+        before = struct.unpack_from("=Q", mm, 8)[0]
+        fields = LAYOUT.unpack_from(mm, 0)
+        after = struct.unpack_from("=Q", mm, 8)[0]
+        if before == after and before % 2 == 0:
+            return fields
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip())
+        sys.exit(1)
+    name = sys.argv[1].lstrip("/")
+    interval = float(sys.argv[2]) if len(sys.argv) > 2 else 1.0
+
+    fd = os.open(os.path.join("/dev/shm", name), os.O_RDONLY)
+    mm = mmap.mmap(fd, LAYOUT.size, mmap.MAP_SHARED, mmap.PROT_READ)
+    try:
+        while True:
+            (magic, version, _, frame, walls, lines, elapsed, cps,
+             p50, p90, p99, p999, pmax) = read_page(mm)
+            if magic != MAGIC or version != VERSION:
+                sys.exit("not a Screensaver stats page")
+            print("frame %d  %.1fs  %d wall  %d line  %.0f coll/s  "
+                  "p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f ms"
+                  % (frame, elapsed, walls, lines, cps,
+                     p50, p90, p99, p999, pmax))
+            sys.stdout.flush()
+            time.sleep(interval)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()